@@ -0,0 +1,184 @@
+#pragma once
+
+#include <mintpl/allocators.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Minimum wall clock time spent on each measurement.
+#define BENCH_MIN_TIME_NS 500000000ull
+
+#define BENCH_CHECK(EXPR)\
+    do {\
+        if (!(EXPR)) {\
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #EXPR);\
+            exit(1);\
+        }\
+    } while (0)
+
+// Averages of one measurement. Allocations are those made through
+// bench_allocators, from any thread.
+typedef struct {
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+    size_t peak_bytes;
+} bench_result;
+
+static mtpl_accounting_allocator bench_accounting;
+static bool bench_json = false;
+static size_t bench_reported = 0;
+
+// Allocators to create contexts and tables with, for their allocations to be
+// reported.
+static const mtpl_allocators* const bench_allocators =
+    &bench_accounting.allocators;
+
+// Reads the command line, and starts the report. Passing `--json` makes
+// bench_report() print a JSON array of results instead of aligned text.
+static inline void bench_init(int argc, char** argv) {
+    mtpl_accounting_init(&mtpl_std_allocators, &bench_accounting);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            bench_json = true;
+        } else {
+            fprintf(stderr, "usage: %s [--json]\n", argv[0]);
+            exit(2);
+        }
+    }
+    if (bench_json) {
+        fputs("[\n", stdout);
+    }
+}
+
+// Ends the report. Returns the exit status of the benchmark.
+static inline int bench_finish(void) {
+    if (bench_json) {
+        fputs(bench_reported ? "\n]\n" : "]\n", stdout);
+    }
+    return 0;
+}
+
+static inline uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Repeats `body(data)` until at least BENCH_MIN_TIME_NS has passed, and
+// returns the averages per call.
+static inline bench_result bench_measure(
+    void(*body)(void* data),
+    void* data
+) {
+    uint64_t iterations = 0;
+    mtpl_accounting_reset(&bench_accounting);
+    const uint64_t start = bench_now();
+    uint64_t elapsed;
+    do {
+        body(data);
+        iterations++;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS);
+
+    const mtpl_allocation_stats stats =
+        mtpl_accounting_stats(&bench_accounting);
+    return (bench_result) {
+        .ns_per_op = (double) elapsed / iterations,
+        .allocs_per_op =
+            (double) (stats.allocations + stats.reallocations) / iterations,
+        .bytes_per_op = (double) stats.bytes_allocated / iterations,
+        .peak_bytes = stats.peak_live_bytes
+    };
+}
+
+// Prints a result. If `unit` is set, the time per op is also reported divided
+// over `units_per_op`, as in the time per iteration of a loop.
+static inline void bench_report(
+    const char* name,
+    const bench_result* result,
+    const char* unit,
+    double units_per_op
+) {
+    if (bench_json) {
+        fprintf(
+            stdout,
+            "%s  {\"name\": \"%s\", \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, "
+            "\"peak_bytes\": %zu",
+            bench_reported ? ",\n" : "",
+            name,
+            result->ns_per_op,
+            result->allocs_per_op,
+            result->bytes_per_op,
+            result->peak_bytes
+        );
+        if (unit) {
+            fprintf(
+                stdout,
+                ", \"unit\": \"%s\", \"ns_per_unit\": %.2f",
+                unit,
+                result->ns_per_op / units_per_op
+            );
+        }
+        fputs("}", stdout);
+    } else {
+        fprintf(stdout, "%-32s %12.0f ns/op", name, result->ns_per_op);
+        if (unit) {
+            fprintf(
+                stdout,
+                " %10.1f ns/%s",
+                result->ns_per_op / units_per_op,
+                unit
+            );
+        }
+        fprintf(
+            stdout,
+            " %10.1f allocs/op %10.0f B/op\n",
+            result->allocs_per_op,
+            result->bytes_per_op
+        );
+    }
+    bench_reported++;
+}
+
+// Measures `body(data)`, and reports it under `name`.
+static inline void bench_run(
+    const char* name,
+    void(*body)(void* data),
+    void* data
+) {
+    const bench_result result = bench_measure(body, data);
+    bench_report(name, &result, NULL, 0);
+}
+
+static inline char* bench_read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    BENCH_CHECK(file);
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    BENCH_CHECK(data);
+    BENCH_CHECK(fread(data, 1, size, file) == (size_t) size);
+    data[size] = '\0';
+    fclose(file);
+    return data;
+}
+
+// Builds a semicolon separated list of `count` items on the form PREFIX<n>.
+static inline char* bench_make_list(const char* prefix, size_t count) {
+    const size_t item_size = strlen(prefix) + 24;
+    char* list = malloc(item_size * count + 1);
+    BENCH_CHECK(list);
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += sprintf(&list[len], i ? ";%s%zu" : "%s%zu", prefix, i);
+    }
+    list[len] = '\0';
+    return list;
+}
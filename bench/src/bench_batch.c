@@ -0,0 +1,109 @@
+#include "bench.h"
+
+#include <mintpl/mintpl.h>
+
+// Rendering one template for many records: once per record on a single
+// context, as a baseline, and as a batch with a growing number of threads.
+
+#define NUM_RECORDS 10000
+
+static const char source[] =
+    "<tr><td>[=> name]</td><td>[=> city]</td>"
+    "[for> [range> 1 6] column {<td>[#> [=> id] * [=> column] / 4]</td>}]"
+    "</tr>\n";
+
+typedef struct {
+    mtpl_context* context;
+    mtpl_program* program;
+    mtpl_property_set* sets;
+    size_t threads;
+} batch_render;
+
+static mtpl_result discard(void* user, const char* data, size_t length) {
+    (void) user;
+    (void) data;
+    (void) length;
+    return MTPL_SUCCESS;
+}
+
+static void render_parse_loop(void* data) {
+    batch_render* render = data;
+    for (size_t i = 0; i < NUM_RECORDS; ++i) {
+        const mtpl_property_set* set = &render->sets[i];
+        for (size_t j = 0; j < set->count; ++j) {
+            mtpl_set_property_slice(
+                set->properties[j].name,
+                &set->properties[j].value,
+                render->context
+            );
+        }
+        BENCH_CHECK(
+            mtpl_parse_template(source, render->context) == MTPL_SUCCESS
+        );
+    }
+}
+
+static void render_batch(void* data) {
+    batch_render* render = data;
+    const mtpl_sink sink = { discard, NULL };
+    const mtpl_batch batch = {
+        .threads = render->threads,
+        .sets = render->sets,
+        .sink = &sink
+    };
+    BENCH_CHECK(
+        mtpl_render_batch(
+            render->program,
+            render->context,
+            NUM_RECORDS,
+            &batch
+        ) == MTPL_SUCCESS
+    );
+}
+
+static void report(const char* name, size_t threads, bench_result result) {
+    char label[64];
+    snprintf(label, sizeof(label), "batch/%s/%zu", name, threads);
+    bench_report(label, &result, "record", NUM_RECORDS);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+    static char values[NUM_RECORDS][3][24];
+    static mtpl_property properties[NUM_RECORDS][3];
+    static mtpl_property_set sets[NUM_RECORDS];
+    for (size_t i = 0; i < NUM_RECORDS; ++i) {
+        static const char* names[] = { "id", "name", "city" };
+        snprintf(values[i][0], sizeof(values[i][0]), "%zu", i);
+        snprintf(values[i][1], sizeof(values[i][1]), "Customer %zu", i);
+        snprintf(values[i][2], sizeof(values[i][2]), "City %zu", i % 97);
+        for (size_t j = 0; j < 3; ++j) {
+            properties[i][j] = (mtpl_property) {
+                names[j],
+                { values[i][j], strlen(values[i][j]) }
+            };
+        }
+        sets[i] = (mtpl_property_set) { properties[i], 3 };
+    }
+
+    batch_render render = { .sets = sets };
+    BENCH_CHECK(
+        mtpl_init_custom_alloc(bench_allocators, &render.context)
+            == MTPL_SUCCESS
+    );
+    BENCH_CHECK(
+        mtpl_compile_template(source, render.context, &render.program)
+            == MTPL_SUCCESS
+    );
+
+    report("parse_loop", 1, bench_measure(render_parse_loop, &render));
+    // The loop leaves the properties of the last record behind.
+    mtpl_clear_properties(render.context);
+    for (render.threads = 1; render.threads <= 16; render.threads *= 2) {
+        report("threads", render.threads, bench_measure(render_batch, &render));
+    }
+
+    mtpl_program_free(render.context->allocators, render.program);
+    mtpl_free(render.context);
+    return bench_finish();
+}
@@ -0,0 +1,135 @@
+#include "bench.h"
+
+#include <mintpl/buffers.h>
+
+// Cost per byte of taking arguments apart: splitting a list into its items,
+// and extracting substitutions and quotes, both flat and deeply nested.
+
+#define LIST_ITEMS 10000
+#define SUB_SIZE (64 * 1024)
+#define NESTED_DEPTH 1000
+
+typedef struct {
+    mtpl_buffer input;
+    mtpl_buffer* out;
+    bool include_outer;
+} extract_data;
+
+static void extract_items(void* data) {
+    extract_data* extract = data;
+    extract->input.cursor = 0;
+    size_t items = 0;
+    while (extract->input.data[extract->input.cursor]) {
+        extract->out->cursor = 0;
+        BENCH_CHECK(
+            mtpl_buffer_extract(
+                ';',
+                bench_allocators,
+                &extract->input,
+                extract->out
+            ) == MTPL_SUCCESS
+        );
+        items++;
+    }
+    BENCH_CHECK(items == LIST_ITEMS);
+}
+
+static void extract_sub(void* data) {
+    extract_data* extract = data;
+    extract->input.cursor = 0;
+    extract->out->cursor = 0;
+    BENCH_CHECK(
+        mtpl_buffer_extract_sub(
+            bench_allocators,
+            extract->include_outer,
+            &extract->input,
+            extract->out
+        ) == MTPL_SUCCESS
+    );
+    BENCH_CHECK(extract->out->cursor > 0);
+}
+
+// Builds a single substitution or quote of plain text, opened by `opener`
+// and closed by `closer`.
+static char* make_flat(char opener, char closer, size_t size) {
+    static const char prose[] =
+        "The quick brown fox jumps \\} over the lazy dog. ";
+    char* source = malloc(size + 1);
+    BENCH_CHECK(source);
+    source[0] = opener;
+    for (size_t i = 1; i < size - 1; ++i) {
+        source[i] = prose[i % (sizeof(prose) - 1)];
+    }
+    // Keep the last escape from taking the closer with it.
+    source[size - 2] = ' ';
+    source[size - 1] = closer;
+    source[size] = '\0';
+    return source;
+}
+
+// Builds a quote with `depth` levels of quotes nested within it, each level
+// starting with some text of its own.
+static char* make_nested(size_t depth) {
+    static const char level[] = "{nested text at this level ";
+    const size_t size = depth * sizeof(level);
+    char* source = malloc(size + 1);
+    BENCH_CHECK(source);
+    size_t len = 0;
+    for (size_t i = 0; i < depth; ++i) {
+        memcpy(&source[len], level, sizeof(level) - 1);
+        len += sizeof(level) - 1;
+    }
+    memset(&source[len], '}', depth);
+    len += depth;
+    source[len] = '\0';
+    return source;
+}
+
+static void bench_extract_sub(
+    const char* name,
+    char* source,
+    bool include_outer,
+    mtpl_buffer* out
+) {
+    const size_t length = strlen(source);
+    extract_data extract = {
+        .input = { .data = source, .cursor = 0, .size = length + 1 },
+        .out = out,
+        .include_outer = include_outer
+    };
+    const bench_result result = bench_measure(extract_sub, &extract);
+    bench_report(name, &result, "byte", length);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+    mtpl_buffer* out;
+    BENCH_CHECK(
+        mtpl_buffer_create(bench_allocators, MTPL_DEFAULT_BUFSIZE, &out)
+            == MTPL_SUCCESS
+    );
+
+    char* list = bench_make_list("item", LIST_ITEMS);
+    extract_data items = {
+        .input = { .data = list, .cursor = 0, .size = strlen(list) + 1 },
+        .out = out
+    };
+    const bench_result result = bench_measure(extract_items, &items);
+    bench_report("extract/items", &result, "item", LIST_ITEMS);
+
+    char* substitution = make_flat('[', ']', SUB_SIZE);
+    char* quote = make_flat('{', '}', SUB_SIZE);
+    char* nested = make_nested(NESTED_DEPTH);
+    bench_extract_sub("extract_sub/flat", substitution, true, out);
+    bench_extract_sub("extract_sub/flat_quote", quote, false, out);
+    bench_extract_sub("extract_sub/nested", nested, true, out);
+    bench_extract_sub("extract_sub/nested_quote", nested, false, out);
+
+    free(nested);
+    free(quote);
+    free(substitution);
+    free(list);
+    mtpl_buffer_free(bench_allocators, out);
+
+    return bench_finish();
+}
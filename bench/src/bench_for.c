@@ -0,0 +1,143 @@
+#include "bench.h"
+
+#include <mintpl/mintpl.h>
+
+// Cost per iteration of the 'for' generator as the iterated list grows, and
+// of counted loops over integer and fractional ranges. Also the scaling of
+// 'pfor' with the number of threads, for a loop body of some weight, and the
+// overhead of small parallel loops run over and over.
+
+static const char source[] = "[for> [=> items] item {<[=> item]>}]";
+
+static const char range_source[] =
+    "[for> [range> 0 [=> count]] i {<[=> i]>}]";
+
+static const char real_range_source[] =
+    "[for> [range> 0 [=> count] 0.25] i {<[=> i]>}]";
+
+// One invoice row per item.
+static const char pfor_source[] =
+    "[pfor> [=> items] item {"
+    "<tr><td>[=> item]</td>"
+    "[for> [range> 1 9] column {<td>[#> [len> [=> item]] * [=> column] + 0.5]</td>}]"
+    "</tr>}]";
+
+#define PFOR_ITEMS 1000
+
+// Small parallel loops, one per row, where starting threads would dominate.
+static const char pfor_rows_source[] =
+    "[for> [range> 0 [=> rows]] row {[pfor> [range> 0 8] x {[=> x]}]}]";
+
+#define PFOR_ROWS 100
+
+static void render(void* data) {
+    mtpl_context* context = data;
+    BENCH_CHECK(mtpl_parse_template(source, context) == MTPL_SUCCESS);
+}
+
+static void render_range(void* data) {
+    mtpl_context* context = data;
+    BENCH_CHECK(mtpl_parse_template(range_source, context) == MTPL_SUCCESS);
+}
+
+static void render_real_range(void* data) {
+    mtpl_context* context = data;
+    BENCH_CHECK(
+        mtpl_parse_template(real_range_source, context) == MTPL_SUCCESS
+    );
+}
+
+static void render_pfor(void* data) {
+    mtpl_context* context = data;
+    BENCH_CHECK(mtpl_parse_template(pfor_source, context) == MTPL_SUCCESS);
+}
+
+static void render_pfor_rows(void* data) {
+    mtpl_context* context = data;
+    BENCH_CHECK(
+        mtpl_parse_template(pfor_rows_source, context) == MTPL_SUCCESS
+    );
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+    for (size_t count = 10; count <= 100000; count *= 10) {
+        mtpl_context* context;
+        BENCH_CHECK(
+            mtpl_init_custom_alloc(bench_allocators, &context) == MTPL_SUCCESS
+        );
+        char* items = bench_make_list("item", count);
+        mtpl_set_property("items", items, context);
+
+        char label[64];
+        snprintf(label, sizeof(label), "for/%zu", count);
+        const bench_result result = bench_measure(render, context);
+        bench_report(label, &result, "iteration", count);
+
+        free(items);
+        mtpl_free(context);
+    }
+
+    for (size_t count = 10; count <= 1000000; count *= 10) {
+        mtpl_context* context;
+        BENCH_CHECK(
+            mtpl_init_custom_alloc(bench_allocators, &context) == MTPL_SUCCESS
+        );
+        char count_data[32];
+        snprintf(count_data, sizeof(count_data), "%zu", count);
+        mtpl_set_property("count", count_data, context);
+
+        char label[64];
+        snprintf(label, sizeof(label), "for/range/%zu", count);
+        const bench_result result = bench_measure(render_range, context);
+        bench_report(label, &result, "iteration", count);
+
+        mtpl_free(context);
+    }
+
+    for (size_t count = 10; count <= 1000000; count *= 10) {
+        mtpl_context* context;
+        BENCH_CHECK(
+            mtpl_init_custom_alloc(bench_allocators, &context) == MTPL_SUCCESS
+        );
+        // Steps of a quarter, so that COUNT / 4 covers COUNT iterations.
+        char count_data[32];
+        snprintf(count_data, sizeof(count_data), "%zu", count / 4);
+        mtpl_set_property("count", count_data, context);
+
+        char label[64];
+        snprintf(label, sizeof(label), "for/range_real/%zu", count);
+        const bench_result result = bench_measure(render_real_range, context);
+        bench_report(label, &result, "iteration", count);
+
+        mtpl_free(context);
+    }
+
+    mtpl_context* context;
+    BENCH_CHECK(
+        mtpl_init_custom_alloc(bench_allocators, &context) == MTPL_SUCCESS
+    );
+    char* items = bench_make_list("item", PFOR_ITEMS);
+    mtpl_set_property("items", items, context);
+    for (size_t threads = 1; threads <= 16; threads *= 2) {
+        context->pfor_threads = threads;
+        char label[64];
+        snprintf(label, sizeof(label), "pfor/threads/%zu", threads);
+        const bench_result result = bench_measure(render_pfor, context);
+        bench_report(label, &result, "iteration", PFOR_ITEMS);
+    }
+    char rows[32];
+    snprintf(rows, sizeof(rows), "%d", PFOR_ROWS);
+    mtpl_set_property("rows", rows, context);
+    for (size_t threads = 1; threads <= 4; threads *= 2) {
+        context->pfor_threads = threads;
+        char label[64];
+        snprintf(label, sizeof(label), "pfor/rows/threads/%zu", threads);
+        const bench_result result = bench_measure(render_pfor_rows, context);
+        bench_report(label, &result, "loop", PFOR_ROWS);
+    }
+    free(items);
+    mtpl_free(context);
+
+    return bench_finish();
+}
@@ -0,0 +1,107 @@
+#include "bench.h"
+
+#include <mintpl/hashtable.h>
+
+// Insertion and lookup cost per key for tables of increasing size.
+
+typedef struct {
+    size_t count;
+    char** keys;
+    char** missing;
+    mtpl_hashtable* htable;
+} table_data;
+
+static char** make_keys(const char* prefix, size_t count) {
+    char** keys = malloc(sizeof(char*) * count);
+    BENCH_CHECK(keys);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i] = malloc(strlen(prefix) + 24);
+        BENCH_CHECK(keys[i]);
+        sprintf(keys[i], "%s%zu", prefix, i);
+    }
+    return keys;
+}
+
+static void free_keys(char** keys, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+static void insert_all(void* data) {
+    table_data* table = data;
+    mtpl_hashtable* htable;
+    BENCH_CHECK(mtpl_htable_create(bench_allocators, &htable) == MTPL_SUCCESS);
+    for (size_t i = 0; i < table->count; ++i) {
+        BENCH_CHECK(
+            mtpl_htable_insert(
+                table->keys[i],
+                "value",
+                sizeof("value"),
+                bench_allocators,
+                htable
+            ) == MTPL_SUCCESS
+        );
+    }
+    mtpl_htable_free(bench_allocators, htable);
+}
+
+static void search_hits(void* data) {
+    table_data* table = data;
+    for (size_t i = 0; i < table->count; ++i) {
+        BENCH_CHECK(mtpl_htable_search(table->keys[i], table->htable));
+    }
+}
+
+static void search_misses(void* data) {
+    table_data* table = data;
+    for (size_t i = 0; i < table->count; ++i) {
+        BENCH_CHECK(!mtpl_htable_search(table->missing[i], table->htable));
+    }
+}
+
+static void report(const char* name, size_t count, bench_result result) {
+    char label[64];
+    snprintf(label, sizeof(label), "%s/%zu", name, count);
+    bench_report(label, &result, "key", count);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+    static const size_t counts[] = { 10, 1000, 1000000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        table_data table = { counts[c] };
+        table.keys = make_keys("key", table.count);
+        table.missing = make_keys("missing", table.count);
+
+        report("insert", table.count, bench_measure(insert_all, &table));
+
+        BENCH_CHECK(
+            mtpl_htable_create(bench_allocators, &table.htable) == MTPL_SUCCESS
+        );
+        for (size_t i = 0; i < table.count; ++i) {
+            BENCH_CHECK(
+                mtpl_htable_insert(
+                    table.keys[i],
+                    "value",
+                    sizeof("value"),
+                    bench_allocators,
+                    table.htable
+                ) == MTPL_SUCCESS
+            );
+        }
+        report("search_hit", table.count, bench_measure(search_hits, &table));
+        report(
+            "search_miss",
+            table.count,
+            bench_measure(search_misses, &table)
+        );
+        mtpl_htable_free(bench_allocators, table.htable);
+
+        free_keys(table.missing, table.count);
+        free_keys(table.keys, table.count);
+    }
+
+    return bench_finish();
+}
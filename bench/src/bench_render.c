@@ -0,0 +1,173 @@
+#include "bench.h"
+
+#include <mintpl/mintpl.h>
+
+// Render throughput for the bundled examples, comparing templates parsed on
+// every render with templates compiled once and rendered repeatedly. The
+// examples are scaled up to lists of up to ten thousand names, and to
+// factorials a thousand calls deep.
+
+static const size_t num_names[] = { 100, 1000, 10000 };
+static const size_t factorial_starts[] = { 10, 100, 1000 };
+
+// Evaluates the same arithmetic expression with different values, as a
+// report computing line totals would.
+static const char arithmetic[] =
+    "[for> [range> 0 100] i {[#> ([=> i] * 1.25 + 3) / 2 - [=> i] % 7]\n}]";
+
+typedef struct {
+    mtpl_context* context;
+    const char* source;
+    mtpl_program* program;
+} render_data;
+
+static void parse_and_render(void* data) {
+    render_data* render = data;
+    BENCH_CHECK(
+        mtpl_parse_template(render->source, render->context) == MTPL_SUCCESS
+    );
+}
+
+static void render_compiled(void* data) {
+    render_data* render = data;
+    BENCH_CHECK(
+        mtpl_run_template(render->program, render->context) == MTPL_SUCCESS
+    );
+}
+
+static void compile_only(void* data) {
+    render_data* render = data;
+    mtpl_program* program;
+    BENCH_CHECK(
+        mtpl_compile_template(render->source, render->context, &program)
+            == MTPL_SUCCESS
+    );
+    mtpl_program_free(render->context->allocators, program);
+}
+
+static void init_context(render_data* render) {
+    BENCH_CHECK(
+        mtpl_init_custom_alloc(bench_allocators, &render->context)
+            == MTPL_SUCCESS
+    );
+}
+
+// Builds a template of mostly plain text, with a substitution every
+// `run_length` characters.
+static char* make_literal_template(size_t size, size_t run_length) {
+    static const char prose[] = "The quick brown fox jumps over the lazy dog. ";
+    const char substitution[] = "[=>name]";
+    char* source = malloc(size + sizeof(substitution));
+    BENCH_CHECK(source);
+    size_t len = 0;
+    while (len < size) {
+        if (len % run_length < sizeof(substitution) - 1) {
+            memcpy(&source[len], substitution, sizeof(substitution) - 1);
+            len += sizeof(substitution) - 1;
+        } else {
+            source[len] = prose[len % (sizeof(prose) - 1)];
+            len++;
+        }
+    }
+    source[len] = '\0';
+    return source;
+}
+
+// Builds a template of quoted blocks with nested quotes, as found in macro
+// definitions.
+static char* make_quoted_template(size_t size) {
+    static const char block[] =
+        "{The quick {brown} fox jumps \\} over {the {lazy} dog}.}";
+    char* source = malloc(size + sizeof(block));
+    BENCH_CHECK(source);
+    size_t len = 0;
+    while (len < size) {
+        memcpy(&source[len], block, sizeof(block) - 1);
+        len += sizeof(block) - 1;
+    }
+    source[len] = '\0';
+    return source;
+}
+
+// Measures `render` both parsed and compiled. If `unit` is set, the time is
+// also reported per `units` of it, such as per name of a list.
+static void bench_template(
+    const char* name,
+    render_data* render,
+    const char* unit,
+    size_t units
+) {
+    char label[64];
+    BENCH_CHECK(
+        mtpl_compile_template(render->source, render->context, &render->program)
+            == MTPL_SUCCESS
+    );
+    snprintf(label, sizeof(label), "%s/parse_template", name);
+    bench_result result = bench_measure(parse_and_render, render);
+    bench_report(label, &result, unit, units);
+    snprintf(label, sizeof(label), "%s/run_template", name);
+    result = bench_measure(render_compiled, render);
+    bench_report(label, &result, unit, units);
+    mtpl_program_free(render->context->allocators, render->program);
+}
+
+int main(int argc, char** argv) {
+    render_data render;
+    bench_init(argc, argv);
+
+    char label[64];
+    char* names = bench_read_file(EXAMPLES_DIR "/names.mtpl");
+    for (size_t i = 0; i < sizeof(num_names) / sizeof(num_names[0]); ++i) {
+        char* first_names = bench_make_list("First", num_names[i]);
+        char* surnames = bench_make_list("Last", num_names[i]);
+        init_context(&render);
+        mtpl_set_property("first_names", first_names, render.context);
+        mtpl_set_property("surnames", surnames, render.context);
+        render.source = names;
+        snprintf(label, sizeof(label), "names/%zu", num_names[i]);
+        bench_template(label, &render, "name", num_names[i]);
+        mtpl_free(render.context);
+        free(surnames);
+        free(first_names);
+    }
+
+    char* factorial = bench_read_file(EXAMPLES_DIR "/factorial.mtpl");
+    const size_t num_starts =
+        sizeof(factorial_starts) / sizeof(factorial_starts[0]);
+    for (size_t i = 0; i < num_starts; ++i) {
+        char start[32];
+        snprintf(start, sizeof(start), "%zu", factorial_starts[i]);
+        init_context(&render);
+        mtpl_set_property("start", start, render.context);
+        render.source = factorial;
+        snprintf(label, sizeof(label), "factorial/%zu", factorial_starts[i]);
+        bench_template(label, &render, "call", factorial_starts[i]);
+        mtpl_free(render.context);
+    }
+
+    char* literal = make_literal_template(64 * 1024, 1024);
+    init_context(&render);
+    mtpl_set_property("name", "mintpl", render.context);
+    render.source = literal;
+    bench_run("literal/compile", compile_only, &render);
+    bench_template("literal", &render, NULL, 0);
+    mtpl_free(render.context);
+
+    char* quoted = make_quoted_template(64 * 1024);
+    init_context(&render);
+    render.source = quoted;
+    bench_run("quoted/compile", compile_only, &render);
+    mtpl_free(render.context);
+
+    init_context(&render);
+    render.source = arithmetic;
+    bench_template("arithmetic", &render, NULL, 0);
+    mtpl_free(render.context);
+
+    free(quoted);
+    free(literal);
+    free(factorial);
+    free(names);
+
+    return bench_finish();
+}
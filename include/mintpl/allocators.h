@@ -0,0 +1,50 @@
+#pragma once
+
+#include <mintpl/common.h>
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    // Blocks allocated, including by reallocating NULL, and blocks resized.
+    size_t allocations;
+    size_t reallocations;
+    // Bytes requested by allocating and resizing blocks.
+    size_t bytes_allocated;
+    // Bytes in blocks not yet freed, and the most there were at once.
+    size_t live_bytes;
+    size_t peak_live_bytes;
+} mtpl_allocation_stats;
+
+// Allocators that count the allocations made through them, before passing
+// them on to `parent`. Counters are updated atomically, so renders on several
+// threads may share them.
+//
+// To count the allocations of a render, create the context using
+// `allocators`, and reset the counters before rendering. The accounting
+// allocator must outlive the context.
+typedef struct {
+    mtpl_allocators allocators;
+    const mtpl_allocators* parent;
+    mtpl_allocation_stats stats;
+} mtpl_accounting_allocator;
+
+void mtpl_accounting_init(
+    const mtpl_allocators* parent,
+    mtpl_accounting_allocator* accounting
+);
+
+mtpl_allocation_stats mtpl_accounting_stats(
+    const mtpl_accounting_allocator* accounting
+);
+
+// Starts counting over. Live bytes are kept, as the blocks are, and become
+// the peak to measure from.
+void mtpl_accounting_reset(mtpl_accounting_allocator* accounting);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,6 +20,12 @@ typedef struct {
     size_t size;
 } mtpl_readbuffer;
 
+// A length delimited view of a string, which may contain null characters.
+typedef struct {
+    const char* data;
+    size_t length;
+} mtpl_slice;
+
 mtpl_result mtpl_buffer_create(
     const mtpl_allocators* allocators,
     size_t size,
@@ -44,6 +50,14 @@ mtpl_result mtpl_buffer_nprint(
     size_t len
 );
 
+// Appends the slice to the output, followed by a terminator that is not
+// counted by the output cursor.
+mtpl_result mtpl_buffer_write(
+    const mtpl_slice* input,
+    const mtpl_allocators* allocators,
+    mtpl_buffer* output
+);
+
 mtpl_result mtpl_buffer_extract(
     char delimiter,
     const mtpl_allocators* allocators,
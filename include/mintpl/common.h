@@ -12,7 +12,7 @@ extern "C" {
 
 #define MTPL_REALLOC_CHECKED(allocators, addr, size, errcon)\
     do {\
-        void* res_addr = allocators->realloc(addr, size);\
+        void* res_addr = mtpl_reallocate(allocators, addr, size);\
         if (!res_addr) {\
             errcon;\
         }\
@@ -24,15 +24,56 @@ typedef enum {
     MTPL_ERR_MEMORY,
     MTPL_ERR_SYNTAX,
     MTPL_ERR_UNKNOWN_KEY,
-    MTPL_ERR_MALFORMED_NAME
+    MTPL_ERR_MALFORMED_NAME,
+    MTPL_ERR_IO,
+    MTPL_ERR_FROZEN,
+    // A render exceeded one of the limits of its context.
+    MTPL_ERR_DEPTH_LIMIT,
+    MTPL_ERR_STEP_LIMIT,
+    MTPL_ERR_OUTPUT_LIMIT,
+    MTPL_ERR_TIME_LIMIT
 } mtpl_result;
 
+// Memory management functions. Each of them is handed `user`, which may refer
+// to state of the allocator, such as the counters of an accounting allocator.
+// Allocators may be used from several threads at once.
 typedef struct {
-    void* (*malloc)(size_t);
-    void* (*realloc)(void*, size_t);
-    void (*free)(void*);
+    void* (*malloc)(void* user, size_t size);
+    void* (*realloc)(void* user, void* addr, size_t size);
+    void (*free)(void* user, void* addr);
+    void* user;
 } mtpl_allocators;
 
+// Allocation functions of the C standard library, which ignore `user`.
+void* mtpl_std_malloc(void* user, size_t size);
+void* mtpl_std_realloc(void* user, void* addr, size_t size);
+void mtpl_std_free(void* user, void* addr);
+
+// Allocators of the C standard library, as used by mtpl_init().
+extern const mtpl_allocators mtpl_std_allocators;
+
+static inline void* mtpl_allocate(
+    const mtpl_allocators* allocators,
+    size_t size
+) {
+    return allocators->malloc(allocators->user, size);
+}
+
+static inline void* mtpl_reallocate(
+    const mtpl_allocators* allocators,
+    void* addr,
+    size_t size
+) {
+    return allocators->realloc(allocators->user, addr, size);
+}
+
+static inline void mtpl_deallocate(
+    const mtpl_allocators* allocators,
+    void* addr
+) {
+    allocators->free(allocators->user, addr);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,7 @@
 #include <mintpl/buffers.h>
 #include <mintpl/common.h>
 #include <mintpl/hashtable.h>
+#include <mintpl/number.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -96,6 +97,21 @@ mtpl_result mtpl_generator_for(
     mtpl_buffer* out
 );
 
+// Parallel variant of mtpl_generator_for(), which runs the iterations on
+// several threads at once. Output is passed on in list order. Iterations each
+// have a scope of their own, so bindings made by one aren't seen by the next,
+// and all generators used by the body must be safe to call from several
+// threads, as must the allocators. The number of threads is set per context,
+// by its `pfor_threads`. Loops nested in a `pfor` body always run on the
+// thread they are reached on.
+mtpl_result mtpl_generator_pfor(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
 mtpl_result mtpl_generator_if(
     const mtpl_allocators* allocators,
     mtpl_buffer* arg,
@@ -208,6 +224,78 @@ mtpl_result mtpl_generator_element(
     mtpl_buffer* out
 );
 
+// Variant of a generator taking its first argument as the property holding a
+// list, rather than as the text of the list. This lets list generators keep an
+// index of the list cached on the property, instead of scanning it on every
+// call. `arg` holds the remaining arguments. The output is the same as that of
+// the generator given the value of the property followed by `arg`.
+typedef mtpl_result(*mtpl_list_generator)(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* list,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
+mtpl_result mtpl_generator_len_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* list,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
+mtpl_result mtpl_generator_element_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* list,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
+// Returns the list variant of a generator, or NULL if it has none.
+mtpl_list_generator mtpl_generator_list_variant(mtpl_generator generator);
+
+// Sequence of numbers given by the arguments of the range generator: from
+// `start` (always included) up to, but not including, `end`. Either all of
+// the numbers are integral, or none of them are.
+typedef struct {
+    mtpl_number start;
+    mtpl_number end;
+    mtpl_number step;
+} mtpl_range;
+
+// Parses range generator arguments, on the form "start end [step]".
+mtpl_result mtpl_range_parse(const char* text, mtpl_range* out_range);
+
+// Variant of a generator taking its first argument as a range, rather than as
+// the list of numbers making up the range. `arg` holds the remaining
+// arguments.
+typedef mtpl_result(*mtpl_range_generator)(
+    const mtpl_allocators* allocators,
+    const mtpl_range* range,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
+// Iterates over the numbers of a range directly, without building a list.
+mtpl_result mtpl_generator_for_range(
+    const mtpl_allocators* allocators,
+    const mtpl_range* range,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+);
+
+// Returns the range variant of a generator, or NULL if it has none.
+mtpl_range_generator mtpl_generator_range_variant(mtpl_generator generator);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,24 +1,57 @@
 #pragma once
 
+#include <mintpl/buffers.h>
 #include <mintpl/common.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define MTPL_HTABLE_SIZE 1024
+// Number of entries stored directly in the table before it is hashed.
+#define MTPL_HTABLE_INLINE_SLOTS 4
+// Initial size of the hashed entry array. Always a power of two.
+#define MTPL_HTABLE_MIN_SIZE 16
+
+// Derived data kept alongside an entry's value, such as a parsed form of it.
+// Caches are owned by the entry, and released through their `free` function
+// whenever the entry is overwritten or removed. An entry can hold one cache of
+// each kind, told apart by their `free` function.
+typedef struct mtpl_hashcache {
+    void (*free)(
+        const mtpl_allocators* allocators,
+        struct mtpl_hashcache* cache
+    );
+    struct mtpl_hashcache* next;
+} mtpl_hashcache;
 
 typedef struct {
     char* key;
     void* data;
+    mtpl_hashcache* cache;
+    // Size of the value, and of the storage allocated for it.
+    size_t size;
+    size_t capacity;
+    uint32_t hash;
 } mtpl_hashentry;
 
+// Tables start out with `entries` pointing at the inline slots, which keeps
+// small tables such as loop and macro scopes cheap to create and clear. Larger
+// tables use open addressing with Robin Hood probing, and grow as needed.
+//
+// `next` refers to the enclosing scope: lookups that miss in a table continue
+// in the next one. A table does not own its enclosing scope.
+//
+// Frozen tables reject changes, and can be read by any number of threads at
+// once, for instance as the enclosing scope of a table per thread.
 typedef struct mtpl_hashtable {
     mtpl_hashentry* entries;
     size_t size;
     size_t count;
     struct mtpl_hashtable* next;
+    bool frozen;
+    mtpl_hashentry slots[MTPL_HTABLE_INLINE_SLOTS];
 } mtpl_hashtable;
 
 mtpl_result mtpl_htable_create(
@@ -31,8 +64,54 @@ void mtpl_htable_free(
     mtpl_hashtable* htable
 );
 
+// Removes all entries, but keeps the table itself (and its scope parent).
+void mtpl_htable_clear(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+);
+
 void* mtpl_htable_search(const char* key, const mtpl_hashtable* htable);
 
+// Returns a string value as a slice, or a slice without data if the key is
+// missing.
+mtpl_slice mtpl_htable_search_string(
+    const char* key,
+    const mtpl_hashtable* htable
+);
+
+// Returns the value of an entry as a string slice. Values stored as strings,
+// or as null terminated data, have their terminator left out.
+mtpl_slice mtpl_htable_entry_string(const mtpl_hashentry* entry);
+
+mtpl_hashentry* mtpl_htable_lookup(
+    const char* key,
+    const mtpl_hashtable* htable
+);
+
+// Replaces all caches of an entry with `cache`, which may be NULL.
+void mtpl_htable_set_cache(
+    mtpl_hashentry* entry,
+    mtpl_hashcache* cache,
+    const mtpl_allocators* allocators
+);
+
+// Returns the entry's cache of the kind released by `free_cache`, or NULL if
+// it has none.
+mtpl_hashcache* mtpl_htable_find_cache(
+    const mtpl_hashentry* entry,
+    void (*free_cache)(const mtpl_allocators*, mtpl_hashcache*)
+);
+
+// Adds a cache to an entry, and returns the cache of that kind to use from
+// then on. Entries of frozen tables may gain caches from several threads at
+// once: if another cache of the same kind got there first, `cache` is
+// released, and the other one returned.
+mtpl_hashcache* mtpl_htable_attach_cache(
+    mtpl_hashentry* entry,
+    mtpl_hashcache* cache,
+    const mtpl_allocators* allocators
+);
+
 mtpl_result mtpl_htable_insert(
     const char* key,
     const void* value,
@@ -41,12 +120,28 @@ mtpl_result mtpl_htable_insert(
     mtpl_hashtable* htable
 );
 
+// Inserts a string value. The value is stored with a terminator, which is not
+// counted by the length of the slice returned by mtpl_htable_search_string().
+// Values inserted using mtpl_htable_insert() are also terminated, though
+// the terminator is not part of their size.
+mtpl_result mtpl_htable_insert_string(
+    const char* key,
+    const mtpl_slice* value,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+);
+
 mtpl_result mtpl_htable_delete(
     const char* key,
     const mtpl_allocators* allocators,
     mtpl_hashtable* htable
 );
 
+// Makes the table read only. Insertions and deletions fail with
+// MTPL_ERR_FROZEN from then on, including deletions of keys found further
+// along the scope chain.
+void mtpl_htable_freeze(mtpl_hashtable* htable);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,20 +1,78 @@
 #pragma once
 
+#include <mintpl/allocators.h>
 #include <mintpl/buffers.h>
 #include <mintpl/common.h>
 #include <mintpl/generators.h>
 #include <mintpl/hashtable.h>
+#include <mintpl/substitute.h>
 #include <mintpl/version.h>
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Stack taken by each evaluation of a template nested within another on the
+// C stack, as by `pfor` and by custom generators calling mtpl_substitute(),
+// which take up to about 1.6 KiB each. Other built-in generators nest their
+// templates on the heap instead.
+#define MTPL_STACK_PER_DEPTH 2048
+
+// Stack that the default limits assume a render to have, as on the main thread
+// of most platforms. Renders on threads with smaller stacks should lower
+// `max_stack` to fit.
+#define MTPL_DEFAULT_STACK_SIZE (2 * 1024 * 1024)
+
+// Nesting of generator invocations allowed by default. Nesting on the heap
+// takes memory, and time to look up properties through the scopes of each
+// level, but well short of this stays cheap.
+#define MTPL_DEFAULT_MAX_DEPTH 50000
+
+// Limits on each render with a context, so that a runaway template fails with
+// an error rather than exhausting the stack, memory or time of its thread.
+// Zero means unlimited.
 typedef struct {
+    // Generator invocations nested within each other, as by recursive macros.
+    size_t max_depth;
+    // Bytes of the C stack taken by evaluations of templates nested within
+    // each other on it, reckoned at MTPL_STACK_PER_DEPTH each. Exceeding it
+    // fails with MTPL_ERR_DEPTH_LIMIT as well.
+    size_t max_stack;
+    // Generator invocations and loop iterations in all.
+    size_t max_steps;
+    // Bytes of output, or of any intermediate result such as the argument of
+    // a generator. This is checked as generators return and buffers grow.
+    size_t max_output;
+    // Wall-clock time in milliseconds.
+    uint64_t max_time_ms;
+} mtpl_limits;
+
+typedef struct mtpl_context {
     const mtpl_allocators* allocators;
     mtpl_hashtable* generators;
     mtpl_hashtable* properties;
     mtpl_buffer* output;
+    // Transient storage reused across renders.
+    struct mtpl_arena* arena;
+    // Threads kept between renders to run parallel loops and batches on,
+    // started as they are first needed.
+    struct mtpl_pool* pool;
+    // Context this one is layered onto, whose generators it shares, or NULL.
+    const struct mtpl_context* base;
+    // Statistics on the generators invoked, if profiling is enabled.
+    struct mtpl_profile* profile;
+    // Start and end of each generator invoked, if tracing is enabled.
+    struct mtpl_trace* trace;
+    // Limits on renders, which overlays start out with as well. Only
+    // `max_depth` and `max_stack` are set by default, to
+    // MTPL_DEFAULT_MAX_DEPTH and MTPL_DEFAULT_STACK_SIZE.
+    mtpl_limits limits;
+    // Threads `pfor` spreads iterations over in renders with the context, the
+    // rendering thread included. The default of 0 uses one per processor.
+    // Overlays start out with the setting of their base.
+    size_t pfor_threads;
 } mtpl_context;
 
 mtpl_result mtpl_init(mtpl_context** out_context);
@@ -26,6 +84,29 @@ mtpl_result mtpl_init_custom_alloc(
 
 void mtpl_free(mtpl_context* context);
 
+// Makes the generators and properties of a context read only, so that any
+// number of threads can render with overlays of it at the same time. Setting
+// generators or properties of a frozen context fails with MTPL_ERR_FROZEN.
+void mtpl_freeze(mtpl_context* context);
+
+// Creates a context that reads the generators and properties of `base`
+// without copying them. Properties set on the overlay, including those bound
+// by `let` while rendering, shadow those of `base` and are only visible to
+// the overlay, which also has its own output. Overlays share the generators
+// of their base and can't add to them.
+//
+// Each overlay is meant for use by one thread at a time. `base` must be
+// frozen if overlays of it are used from several threads, and must outlive
+// them.
+mtpl_result mtpl_init_overlay(
+    const mtpl_context* base,
+    mtpl_context** out_context
+);
+
+// Removes all properties set on the context itself. The properties of an
+// overlay's base remain visible. Has no effect on frozen contexts.
+void mtpl_clear_properties(mtpl_context* context);
+
 mtpl_result mtpl_set_generator(
     const char* name,
     mtpl_generator generator,
@@ -38,8 +119,155 @@ mtpl_result mtpl_set_property(
     mtpl_context* context
 );
 
+// Sets a property from a length delimited value, which may be binary.
+mtpl_result mtpl_set_property_slice(
+    const char* name,
+    const mtpl_slice* value,
+    mtpl_context* context
+);
+
 mtpl_result mtpl_parse_template(const char* source, mtpl_context* context);
 
+// Compiles a template for repeated rendering with mtpl_run_template(). The
+// program should be released using mtpl_program_free() with the context's
+// allocators.
+mtpl_result mtpl_compile_template(
+    const char* source,
+    mtpl_context* context,
+    mtpl_program** out_program
+);
+
+mtpl_result mtpl_run_template(
+    const mtpl_program* program,
+    mtpl_context* context
+);
+
+// Streaming variants of mtpl_parse_template() and mtpl_run_template(), which
+// pass output on to the sink while rendering rather than collecting it in the
+// context's output buffer.
+mtpl_result mtpl_parse_template_sink(
+    const char* source,
+    mtpl_context* context,
+    const mtpl_sink* sink
+);
+
+mtpl_result mtpl_run_template_sink(
+    const mtpl_program* program,
+    mtpl_context* context,
+    const mtpl_sink* sink
+);
+
+// Renders a template read in chunks from `reader`, without keeping all of it
+// in memory.
+mtpl_result mtpl_parse_stream(
+    const mtpl_reader* reader,
+    mtpl_context* context,
+    const mtpl_sink* sink
+);
+
+typedef struct {
+    const char* name;
+    mtpl_slice value;
+} mtpl_property;
+
+typedef struct {
+    const mtpl_property* properties;
+    size_t count;
+} mtpl_property_set;
+
+// Records to render with mtpl_render_batch(), and where their output goes.
+//
+// The properties of each record come from `sets`, or from calling `prepare`
+// if set, which should set them on `record_context` using mtpl_set_property().
+// That context is an overlay of the batch's context, which keeps the
+// properties of one record at a time.
+//
+// The output of each record is passed to `write` if set, and otherwise to
+// `sink`, in record order. Output passed to `write` is the complete output of
+// a record, handed over in a single call.
+//
+// `prepare` and `write` are called from several threads at once, for
+// different records.
+typedef struct {
+    // Threads to render on, the calling thread included. 0 uses one thread
+    // per processor.
+    size_t threads;
+    const mtpl_property_set* sets;
+    mtpl_result (*prepare)(
+        void* user,
+        size_t index,
+        mtpl_context* record_context
+    );
+    mtpl_result (*write)(
+        void* user,
+        size_t index,
+        const char* data,
+        size_t length
+    );
+    const mtpl_sink* sink;
+    void* user;
+} mtpl_batch;
+
+// Renders a compiled program once for each of `count` records, spread over a
+// pool of threads. Properties of `context` are shared by all records, and
+// should not be changed until the batch is done. Stops at the first error,
+// and returns it.
+mtpl_result mtpl_render_batch(
+    const mtpl_program* program,
+    mtpl_context* context,
+    size_t count,
+    const mtpl_batch* batch
+);
+
+// Statistics on a generator, collected while profiling. Macros are listed
+// apart from each other, under the name of their expansion as in `**> NAME`.
+typedef struct {
+    const char* name;
+    size_t calls;
+    // Time spent in the generator in nanoseconds, with and without the time
+    // spent in generators it invoked. Invocations nested in an invocation of
+    // the same generator count towards both of them.
+    uint64_t inclusive_ns;
+    uint64_t exclusive_ns;
+    // Bytes of output written, and of arguments handed to the generator.
+    size_t output_bytes;
+    size_t argument_bytes;
+} mtpl_generator_stats;
+
+typedef struct {
+    const mtpl_generator_stats* generators;
+    size_t count;
+} mtpl_stats;
+
+// Starts collecting statistics on each generator invoked while rendering with
+// the context, discarding any collected so far. Iterations of `pfor` and
+// records of mtpl_render_batch() rendered on other threads are included.
+mtpl_result mtpl_enable_profiling(mtpl_context* context);
+
+void mtpl_disable_profiling(mtpl_context* context);
+
+// Returns the statistics collected since profiling was enabled, in order of
+// first invocation, or none if it isn't. They remain valid until the next
+// render with the context.
+mtpl_stats mtpl_get_stats(const mtpl_context* context);
+
+// Starts recording the start and end of each generator invoked while
+// rendering with the context, discarding any recorded so far. Like profiling,
+// this includes other threads.
+mtpl_result mtpl_enable_tracing(mtpl_context* context);
+
+void mtpl_disable_tracing(mtpl_context* context);
+
+// Writes the events recorded since tracing was enabled as Chrome trace event
+// JSON, to be opened in Perfetto or chrome://tracing. The start of each
+// invocation carries the number of argument bytes, and for substitutions the
+// offset of the substitution in the text it was compiled from. Writes a trace
+// without events if tracing isn't enabled.
+mtpl_result mtpl_write_trace(
+    const mtpl_context* context,
+    const mtpl_sink* sink
+);
+
 #ifdef __cplusplus
 }
 #endif
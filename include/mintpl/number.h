@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest text produced by mtpl_number_format(), not counting the terminator.
+#define MTPL_NUMBER_MAXLEN 31
+
+// A number, as handled by the arithmetics, range and comparison generators.
+// Integers are kept exact for as long as every operand is an integer and the
+// results fit in 64 bits; anything else is a double.
+typedef struct {
+    union {
+        int64_t integer;
+        double real;
+    };
+    bool integral;
+} mtpl_number;
+
+// Parses a number at the start of `text`, skipping leading whitespace. Returns
+// the number of characters read, or 0 if there is no (representable) number.
+size_t mtpl_number_parse(const char* text, mtpl_number* out_number);
+
+double mtpl_number_real(const mtpl_number* number);
+
+// Formats integers in full, and other numbers with the fewest significant
+// digits that parse back to the same double. Those of at least 1e-5 and below
+// 1e21 in magnitude are written out positionally, as in 0.30000000000000004,
+// and others with an exponent, as in 1.5e+21 or 1e-7. Infinities and NaN are
+// written as "inf", "-inf" and "nan". `data` needs room for
+// MTPL_NUMBER_MAXLEN characters and a terminator. Returns the length.
+size_t mtpl_number_format(const mtpl_number* number, char* data);
+
+// Returns a negative value, zero or a positive value if `a` is less than,
+// equal to or greater than `b`.
+int mtpl_number_compare(const mtpl_number* a, const mtpl_number* b);
+
+#ifdef __cplusplus
+}
+#endif
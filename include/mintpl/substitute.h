@@ -2,12 +2,126 @@
 
 #include <mintpl/buffers.h>
 #include <mintpl/common.h>
+#include <mintpl/generators.h>
 #include <mintpl/hashtable.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// A single step of a compiled program. Literal text runs have no generator,
+// and refer to a slice of the program's text pool. Substitutions are followed
+// by the instructions making up their argument, up until (but not including)
+// the instruction at index `skip`.
+//
+// Substitutions of a generator with a list variant, whose first argument is a
+// property reference such as `[=> items]`, also have `list` set. The property
+// is then handed to the list variant as is. Likewise, substitutions whose
+// first argument is a `[range> ...]` substitution have `range` set, and are
+// handed the parsed range instead of the list of numbers.
+//
+// Substitutions also refer to the name of their generator in the text pool,
+// and keep the offset of their opening bracket in the text they were compiled
+// from as `source`.
+//
+// Literal text runs keep the templates that generators have compiled from
+// within them, such as the bodies of loops, in `quoted`, so that each is
+// compiled once for as long as the program is.
+typedef struct {
+    mtpl_generator generator;
+    size_t offset;
+    size_t length;
+    size_t skip;
+    mtpl_list_generator list;
+    mtpl_range_generator range;
+    size_t source;
+    struct mtpl_quoted* quoted;
+} mtpl_instruction;
+
+// An immutable, compiled template. Generator references are resolved when
+// compiling, so the generators table used for compilation should not have its
+// entries replaced for as long as the program is in use. The same goes for
+// the generators table of any render running the program, as templates
+// quoted within it are compiled with that table the first time they are run.
+typedef struct {
+    mtpl_instruction* instructions;
+    size_t num_instructions;
+    size_t cap_instructions;
+    mtpl_buffer* text;
+} mtpl_program;
+
+// Destination for streamed output. `write` is handed each chunk of output as
+// soon as it is final, and should return MTPL_SUCCESS, or an error (such as
+// MTPL_ERR_IO) to abort rendering.
+typedef struct {
+    mtpl_result (*write)(void* user, const char* data, size_t length);
+    void* user;
+} mtpl_sink;
+
+// Source of streamed template text. `read` fills in up to `size` bytes of
+// `data`, and stores the number of bytes read in `out_length`. A length of
+// zero marks the end of input.
+typedef struct {
+    mtpl_result (*read)(
+        void* user,
+        char* data,
+        size_t size,
+        size_t* out_length
+    );
+    void* user;
+} mtpl_reader;
+
+// Number of bytes requested from a reader at a time.
+#define MTPL_READ_CHUNK_SIZE (64 * 1024)
+
+mtpl_result mtpl_program_create(
+    const mtpl_allocators* allocators,
+    mtpl_program** out_program
+);
+
+// Compiles `source` into an existing program, replacing its previous contents
+// while reusing its storage.
+mtpl_result mtpl_compile_into(
+    const char* source,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_program* program
+);
+
+mtpl_result mtpl_compile(
+    const char* source,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_program** out_program
+);
+
+mtpl_result mtpl_run(
+    const mtpl_program* program,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out_buffer
+);
+
+// Renders a program like mtpl_run(), but streams the output to `sink`, using
+// `out_buffer` only for staging. Output written to the staging buffer, also by
+// generators running nested programs, is flushed once it grows past
+// MTPL_DEFAULT_BUFSIZE; generators must thus not modify what they have already
+// written to their output.
+mtpl_result mtpl_run_sink(
+    const mtpl_program* program,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    const mtpl_sink* sink,
+    mtpl_buffer* out_buffer
+);
+
+void mtpl_program_free(
+    const mtpl_allocators* allocators,
+    mtpl_program* program
+);
+
 mtpl_result mtpl_substitute(
     const char* source,
     const mtpl_allocators* allocators,
@@ -16,7 +130,18 @@ mtpl_result mtpl_substitute(
     mtpl_buffer* out_buffer
 );
 
+// Renders a template read from `reader` to `sink`. Top level text is passed
+// on as it is read, and only the text of one top level substitution or quote
+// at a time is kept in memory.
+mtpl_result mtpl_substitute_stream(
+    const mtpl_reader* reader,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    const mtpl_sink* sink,
+    mtpl_buffer* out_buffer
+);
+
 #ifdef __cplusplus
 }
 #endif
-
@@ -0,0 +1,153 @@
+#include <mintpl/allocators.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Precedes each block of an accounting allocator, keeping its size. Padded to
+// keep the block aligned for any type.
+typedef union {
+    size_t size;
+    max_align_t align;
+} mtpl__block_header;
+
+void* mtpl_std_malloc(void* user, size_t size) {
+    (void) user;
+    return malloc(size);
+}
+
+void* mtpl_std_realloc(void* user, void* addr, size_t size) {
+    (void) user;
+    return realloc(addr, size);
+}
+
+void mtpl_std_free(void* user, void* addr) {
+    (void) user;
+    free(addr);
+}
+
+const mtpl_allocators mtpl_std_allocators = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
+
+static void count(size_t* counter, size_t amount) {
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+static void add_live_bytes(mtpl_allocation_stats* stats, size_t size) {
+    const size_t live = __atomic_add_fetch(
+        &stats->live_bytes,
+        size,
+        __ATOMIC_RELAXED
+    );
+    size_t peak = __atomic_load_n(&stats->peak_live_bytes, __ATOMIC_RELAXED);
+    while (
+        live > peak
+        && !__atomic_compare_exchange_n(
+            &stats->peak_live_bytes,
+            &peak,
+            live,
+            true,
+            __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED
+        )
+    ) {
+    }
+}
+
+static void remove_live_bytes(mtpl_allocation_stats* stats, size_t size) {
+    __atomic_sub_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void* accounting_malloc(void* user, size_t size) {
+    mtpl_accounting_allocator* accounting = user;
+    mtpl__block_header* header = mtpl_allocate(
+        accounting->parent,
+        sizeof(mtpl__block_header) + size
+    );
+    if (!header) {
+        return NULL;
+    }
+    header->size = size;
+    count(&accounting->stats.allocations, 1);
+    count(&accounting->stats.bytes_allocated, size);
+    add_live_bytes(&accounting->stats, size);
+    return header + 1;
+}
+
+static void* accounting_realloc(void* user, void* addr, size_t size) {
+    mtpl_accounting_allocator* accounting = user;
+    if (!addr) {
+        return accounting_malloc(user, size);
+    }
+    mtpl__block_header* header = (mtpl__block_header*) addr - 1;
+    const size_t previous = header->size;
+    header = mtpl_reallocate(
+        accounting->parent,
+        header,
+        sizeof(mtpl__block_header) + size
+    );
+    if (!header) {
+        return NULL;
+    }
+    header->size = size;
+    count(&accounting->stats.reallocations, 1);
+    count(&accounting->stats.bytes_allocated, size);
+    if (size > previous) {
+        add_live_bytes(&accounting->stats, size - previous);
+    } else {
+        remove_live_bytes(&accounting->stats, previous - size);
+    }
+    return header + 1;
+}
+
+static void accounting_free(void* user, void* addr) {
+    mtpl_accounting_allocator* accounting = user;
+    if (!addr) {
+        return;
+    }
+    mtpl__block_header* header = (mtpl__block_header*) addr - 1;
+    remove_live_bytes(&accounting->stats, header->size);
+    mtpl_deallocate(accounting->parent, header);
+}
+
+void mtpl_accounting_init(
+    const mtpl_allocators* parent,
+    mtpl_accounting_allocator* accounting
+) {
+    accounting->allocators = (mtpl_allocators) {
+        accounting_malloc,
+        accounting_realloc,
+        accounting_free,
+        accounting
+    };
+    accounting->parent = parent;
+    accounting->stats = (mtpl_allocation_stats) { 0 };
+}
+
+mtpl_allocation_stats mtpl_accounting_stats(
+    const mtpl_accounting_allocator* accounting
+) {
+    const mtpl_allocation_stats* stats = &accounting->stats;
+    return (mtpl_allocation_stats) {
+        __atomic_load_n(&stats->allocations, __ATOMIC_RELAXED),
+        __atomic_load_n(&stats->reallocations, __ATOMIC_RELAXED),
+        __atomic_load_n(&stats->bytes_allocated, __ATOMIC_RELAXED),
+        __atomic_load_n(&stats->live_bytes, __ATOMIC_RELAXED),
+        __atomic_load_n(&stats->peak_live_bytes, __ATOMIC_RELAXED)
+    };
+}
+
+void mtpl_accounting_reset(mtpl_accounting_allocator* accounting) {
+    mtpl_allocation_stats* stats = &accounting->stats;
+    __atomic_store_n(&stats->allocations, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->reallocations, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->bytes_allocated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &stats->peak_live_bytes,
+        __atomic_load_n(&stats->live_bytes, __ATOMIC_RELAXED),
+        __ATOMIC_RELAXED
+    );
+}
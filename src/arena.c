@@ -0,0 +1,288 @@
+#include "arena.h"
+
+#include "stack.h"
+
+typedef mtpl_buffer* mtpl__buffer_ref;
+typedef mtpl_hashtable* mtpl__scope_ref;
+typedef mtpl_program* mtpl__program_ref;
+typedef mtpl_arena* mtpl__arena_ref;
+
+DESCRIBE_STACK(mtpl__buffer_ref);
+DESCRIBE_STACK(mtpl__scope_ref);
+DESCRIBE_STACK(mtpl__program_ref);
+DESCRIBE_STACK(mtpl__arena_ref);
+
+struct mtpl_arena {
+    const mtpl_allocators* allocators;
+    STACK(mtpl__buffer_ref)* buffers;
+    STACK(mtpl__scope_ref)* scopes;
+    STACK(mtpl__program_ref)* programs;
+    // Arenas of other threads taking part in renders with this one.
+    STACK(mtpl__arena_ref)* workers;
+};
+
+static _Thread_local mtpl_arena* active = NULL;
+
+// Returns the active arena if it may serve requests using `allocators`.
+static mtpl_arena* usable_arena(const mtpl_allocators* allocators) {
+    return active && active->allocators == allocators ? active : NULL;
+}
+
+mtpl_result mtpl_arena_create(
+    const mtpl_allocators* allocators,
+    mtpl_arena** out_arena
+) {
+    mtpl_arena* arena = mtpl_allocate(allocators, sizeof(mtpl_arena));
+    if (!arena) {
+        return MTPL_ERR_MEMORY;
+    }
+    arena->allocators = allocators;
+    arena->buffers = CREATE_STACK(mtpl__buffer_ref)(allocators);
+    if (!arena->buffers) {
+        goto cleanup_arena;
+    }
+    arena->scopes = CREATE_STACK(mtpl__scope_ref)(allocators);
+    if (!arena->scopes) {
+        goto cleanup_buffers;
+    }
+    arena->programs = CREATE_STACK(mtpl__program_ref)(allocators);
+    if (!arena->programs) {
+        goto cleanup_scopes;
+    }
+    arena->workers = CREATE_STACK(mtpl__arena_ref)(allocators);
+    if (!arena->workers) {
+        goto cleanup_programs;
+    }
+
+    *out_arena = arena;
+    return MTPL_SUCCESS;
+
+cleanup_programs:
+    FREE_STACK(mtpl__program_ref)(arena->programs);
+cleanup_scopes:
+    FREE_STACK(mtpl__scope_ref)(arena->scopes);
+cleanup_buffers:
+    FREE_STACK(mtpl__buffer_ref)(arena->buffers);
+cleanup_arena:
+    mtpl_deallocate(allocators, arena);
+    return MTPL_ERR_MEMORY;
+}
+
+void mtpl_arena_free(mtpl_arena* arena) {
+    const mtpl_allocators* allocators = arena->allocators;
+    for (size_t i = 0; i < arena->buffers->num_entries; ++i) {
+        mtpl_buffer_free(allocators, arena->buffers->entries[i]);
+    }
+    for (size_t i = 0; i < arena->scopes->num_entries; ++i) {
+        mtpl_htable_free(allocators, arena->scopes->entries[i]);
+    }
+    for (size_t i = 0; i < arena->programs->num_entries; ++i) {
+        mtpl_program_free(allocators, arena->programs->entries[i]);
+    }
+    for (size_t i = 0; i < arena->workers->num_entries; ++i) {
+        mtpl_arena_free(arena->workers->entries[i]);
+    }
+    FREE_STACK(mtpl__arena_ref)(arena->workers);
+    FREE_STACK(mtpl__program_ref)(arena->programs);
+    FREE_STACK(mtpl__scope_ref)(arena->scopes);
+    FREE_STACK(mtpl__buffer_ref)(arena->buffers);
+    mtpl_deallocate(allocators, arena);
+}
+
+// Programs and scope tables are held on to for as long as the storage they
+// have grown is within MTPL_ARENA_MAX_BUFSIZE, the same as buffers.
+static bool is_oversized_program(const mtpl_program* program) {
+    return program->text->size > MTPL_ARENA_MAX_BUFSIZE
+        || program->cap_instructions * sizeof(mtpl_instruction)
+            > MTPL_ARENA_MAX_BUFSIZE;
+}
+
+static bool is_oversized_scope(const mtpl_hashtable* scope) {
+    return scope->size * sizeof(mtpl_hashentry) > MTPL_ARENA_MAX_BUFSIZE;
+}
+
+void mtpl_arena_reset(mtpl_arena* arena) {
+    // Keep the pool itself for the next render, but don't hold on to the
+    // occasional huge buffer, program or scope.
+    size_t kept = 0;
+    for (size_t i = 0; i < arena->buffers->num_entries; ++i) {
+        mtpl_buffer* buffer = arena->buffers->entries[i];
+        if (buffer->size > MTPL_ARENA_MAX_BUFSIZE) {
+            mtpl_buffer_free(arena->allocators, buffer);
+        } else {
+            arena->buffers->entries[kept++] = buffer;
+        }
+    }
+    arena->buffers->num_entries = kept;
+
+    kept = 0;
+    for (size_t i = 0; i < arena->programs->num_entries; ++i) {
+        mtpl_program* program = arena->programs->entries[i];
+        if (is_oversized_program(program)) {
+            mtpl_program_free(arena->allocators, program);
+        } else {
+            arena->programs->entries[kept++] = program;
+        }
+    }
+    arena->programs->num_entries = kept;
+
+    kept = 0;
+    for (size_t i = 0; i < arena->scopes->num_entries; ++i) {
+        mtpl_hashtable* scope = arena->scopes->entries[i];
+        if (is_oversized_scope(scope)) {
+            mtpl_htable_free(arena->allocators, scope);
+        } else {
+            arena->scopes->entries[kept++] = scope;
+        }
+    }
+    arena->scopes->num_entries = kept;
+
+    for (size_t i = 0; i < arena->workers->num_entries; ++i) {
+        mtpl_arena_reset(arena->workers->entries[i]);
+    }
+}
+
+mtpl_arena* mtpl_arena_enter(mtpl_arena* arena) {
+    mtpl_arena* previous = active;
+    active = arena;
+    return previous;
+}
+
+void mtpl_arena_leave(mtpl_arena* previous) {
+    active = previous;
+}
+
+bool mtpl_arena_usable(const mtpl_allocators* allocators) {
+    return usable_arena(allocators) != NULL;
+}
+
+mtpl_result mtpl_arena_worker(
+    const mtpl_allocators* allocators,
+    mtpl_arena** out_arena
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    mtpl__arena_ref* pooled = arena
+        ? POP_BACK(mtpl__arena_ref)(arena->workers)
+        : NULL;
+    if (pooled) {
+        *out_arena = *pooled;
+        return MTPL_SUCCESS;
+    }
+    return mtpl_arena_create(allocators, out_arena);
+}
+
+void mtpl_arena_release_worker(
+    const mtpl_allocators* allocators,
+    mtpl_arena* worker
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    if (
+        !arena
+        || PUSH_BACK(mtpl__arena_ref)(arena->workers, &worker) != MTPL_SUCCESS
+    ) {
+        mtpl_arena_free(worker);
+    }
+}
+
+mtpl_result mtpl_arena_buffer(
+    const mtpl_allocators* allocators,
+    mtpl_buffer** out_buffer
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    mtpl__buffer_ref* pooled = arena
+        ? POP_BACK(mtpl__buffer_ref)(arena->buffers)
+        : NULL;
+    if (pooled) {
+        *out_buffer = *pooled;
+    } else {
+        mtpl_result result = mtpl_buffer_create(
+            allocators,
+            MTPL_DEFAULT_BUFSIZE,
+            out_buffer
+        );
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+    }
+    (*out_buffer)->cursor = 0;
+    (*out_buffer)->data[0] = '\0';
+    return MTPL_SUCCESS;
+}
+
+void mtpl_arena_release_buffer(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* buffer
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    if (
+        !arena
+        || PUSH_BACK(mtpl__buffer_ref)(arena->buffers, &buffer) != MTPL_SUCCESS
+    ) {
+        mtpl_buffer_free(allocators, buffer);
+    }
+}
+
+mtpl_result mtpl_arena_scope(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* parent,
+    mtpl_hashtable** out_scope
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    mtpl__scope_ref* pooled = arena
+        ? POP_BACK(mtpl__scope_ref)(arena->scopes)
+        : NULL;
+    if (pooled) {
+        *out_scope = *pooled;
+    } else {
+        mtpl_result result = mtpl_htable_create(allocators, out_scope);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+    }
+    (*out_scope)->next = parent;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_arena_release_scope(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* scope
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    scope->next = NULL;
+    mtpl_htable_clear(allocators, scope);
+    if (
+        !arena
+        || PUSH_BACK(mtpl__scope_ref)(arena->scopes, &scope) != MTPL_SUCCESS
+    ) {
+        mtpl_htable_free(allocators, scope);
+    }
+}
+
+mtpl_result mtpl_arena_program(
+    const mtpl_allocators* allocators,
+    mtpl_program** out_program
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    mtpl__program_ref* pooled = arena
+        ? POP_BACK(mtpl__program_ref)(arena->programs)
+        : NULL;
+    if (pooled) {
+        *out_program = *pooled;
+        return MTPL_SUCCESS;
+    }
+    return mtpl_program_create(allocators, out_program);
+}
+
+void mtpl_arena_release_program(
+    const mtpl_allocators* allocators,
+    mtpl_program* program
+) {
+    mtpl_arena* arena = usable_arena(allocators);
+    if (
+        !arena
+        || PUSH_BACK(mtpl__program_ref)(arena->programs, &program)
+            != MTPL_SUCCESS
+    ) {
+        mtpl_program_free(allocators, program);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <mintpl/buffers.h>
+#include <mintpl/common.h>
+#include <mintpl/hashtable.h>
+#include <mintpl/substitute.h>
+
+#include <stdbool.h>
+
+// Per-render pool of transient buffers, scope tables and programs.
+//
+// Storage released while an arena is active on the current thread is kept in
+// the arena rather than handed back to the allocators, and reused by the next
+// request for the same kind of object. Without an active arena (or when the
+// allocators differ from the arena's), acquiring and releasing falls back to
+// plain creation and freeing.
+typedef struct mtpl_arena mtpl_arena;
+
+// Buffers, program text and instructions, and scope tables grown beyond this
+// size are handed back when the arena is reset.
+#define MTPL_ARENA_MAX_BUFSIZE (64 * 1024)
+
+mtpl_result mtpl_arena_create(
+    const mtpl_allocators* allocators,
+    mtpl_arena** out_arena
+);
+
+void mtpl_arena_free(mtpl_arena* arena);
+
+// Releases oversized storage once a render has finished.
+void mtpl_arena_reset(mtpl_arena* arena);
+
+// Makes `arena` the active arena of the calling thread. Returns the previously
+// active arena, which should be restored using mtpl_arena_leave().
+mtpl_arena* mtpl_arena_enter(mtpl_arena* arena);
+
+void mtpl_arena_leave(mtpl_arena* previous);
+
+// Whether the active arena of the calling thread may serve requests using
+// `allocators`.
+bool mtpl_arena_usable(const mtpl_allocators* allocators);
+
+// Returns an arena for another thread to take part in the render of the
+// active arena with, such as the iterations of a parallel loop. The arenas
+// are kept by the active arena between uses, and should be handed back using
+// mtpl_arena_release_worker() by the thread that acquired them, once the
+// thread using them is done.
+mtpl_result mtpl_arena_worker(
+    const mtpl_allocators* allocators,
+    mtpl_arena** out_arena
+);
+
+void mtpl_arena_release_worker(
+    const mtpl_allocators* allocators,
+    mtpl_arena* arena
+);
+
+// Returns an empty, null terminated buffer.
+mtpl_result mtpl_arena_buffer(
+    const mtpl_allocators* allocators,
+    mtpl_buffer** out_buffer
+);
+
+void mtpl_arena_release_buffer(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* buffer
+);
+
+// Returns an empty scope table, chained to `parent`.
+mtpl_result mtpl_arena_scope(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* parent,
+    mtpl_hashtable** out_scope
+);
+
+void mtpl_arena_release_scope(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* scope
+);
+
+// Returns an empty program, to be filled in by mtpl_compile_into().
+mtpl_result mtpl_arena_program(
+    const mtpl_allocators* allocators,
+    mtpl_program** out_program
+);
+
+void mtpl_arena_release_program(
+    const mtpl_allocators* allocators,
+    mtpl_program* program
+);
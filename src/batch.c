@@ -0,0 +1,320 @@
+#include <mintpl/mintpl.h>
+
+#include "profile.h"
+#include "threads.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Chunks each thread is dealt at the start, as the unit of work stealing.
+// More chunks balance better, fewer keep records of a thread together.
+#define CHUNKS_PER_THREAD 8
+
+// Chunks dealt out to one thread, as chunk `thread + k * num_threads` for
+// every `k` in [front, back). The thread works from the front, and threads
+// that have run out of chunks steal from the back.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t front;
+    size_t back;
+} mtpl__deque;
+
+typedef struct {
+    const mtpl_program* program;
+    const mtpl_context* context;
+    const mtpl_batch* batch;
+    size_t count;
+    size_t chunk_size;
+    size_t num_threads;
+    mtpl__deque* deques;
+    size_t joined;
+    bool failed;
+    mtpl_result result;
+    // Profiles and traces of the threads, if the batch's context is being
+    // profiled or traced.
+    mtpl_profile* profiles;
+    mtpl_trace* traces;
+
+    // Records rendered ahead of their turn, when writing to the sink in
+    // record order. `next_write` is the next record due.
+    pthread_mutex_t order_lock;
+    mtpl_buffer** pending;
+    size_t next_write;
+} mtpl__batch_run;
+
+static void fail(mtpl__batch_run* run, mtpl_result result) {
+    pthread_mutex_lock(&run->order_lock);
+    if (!run->failed) {
+        run->result = result;
+        __atomic_store_n(&run->failed, true, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&run->order_lock);
+}
+
+// Takes the next chunk of thread `self`, or steals one from another thread.
+// Returns false once no chunks are left anywhere.
+static bool take_chunk(mtpl__batch_run* run, size_t self, size_t* out_chunk) {
+    for (size_t i = 0; i < run->num_threads; ++i) {
+        const size_t victim = (self + i) % run->num_threads;
+        mtpl__deque* deque = &run->deques[victim];
+        pthread_mutex_lock(&deque->lock);
+        bool found = deque->front < deque->back;
+        if (found) {
+            const size_t k = (victim == self) ? deque->front++ : --deque->back;
+            *out_chunk = victim + k * run->num_threads;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (found) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static mtpl_result set_properties(
+    const mtpl_property_set* set,
+    mtpl_context* context
+) {
+    for (size_t i = 0; i < set->count; ++i) {
+        mtpl_result result = mtpl_set_property_slice(
+            set->properties[i].name,
+            &set->properties[i].value,
+            context
+        );
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+    }
+    return MTPL_SUCCESS;
+}
+
+static mtpl_result write_buffer(
+    const mtpl_sink* sink,
+    const mtpl_buffer* buffer
+) {
+    return sink->write(sink->user, buffer->data, buffer->cursor);
+}
+
+// Passes the output of a record on to the sink if it is due, along with any
+// records rendered ahead of it that are due next. Otherwise the output is
+// kept until it is due, and the context gets a new output buffer.
+static mtpl_result write_in_order(
+    mtpl__batch_run* run,
+    size_t index,
+    mtpl_context* record_context
+) {
+    const mtpl_allocators* allocators = record_context->allocators;
+    const mtpl_sink* sink = run->batch->sink;
+    mtpl_result result = MTPL_SUCCESS;
+    pthread_mutex_lock(&run->order_lock);
+    if (index != run->next_write) {
+        run->pending[index] = record_context->output;
+        result = mtpl_buffer_create(
+            allocators,
+            MTPL_DEFAULT_BUFSIZE,
+            &record_context->output
+        );
+        if (result != MTPL_SUCCESS) {
+            record_context->output = run->pending[index];
+            run->pending[index] = NULL;
+        }
+        pthread_mutex_unlock(&run->order_lock);
+        return result;
+    }
+
+    result = write_buffer(sink, record_context->output);
+    run->next_write++;
+    while (
+        result == MTPL_SUCCESS
+        && run->next_write < run->count
+        && run->pending[run->next_write]
+    ) {
+        mtpl_buffer* pending = run->pending[run->next_write];
+        run->pending[run->next_write] = NULL;
+        result = write_buffer(sink, pending);
+        mtpl_buffer_free(allocators, pending);
+        run->next_write++;
+    }
+    pthread_mutex_unlock(&run->order_lock);
+    return result;
+}
+
+static mtpl_result render_record(
+    mtpl__batch_run* run,
+    size_t index,
+    mtpl_context* record_context
+) {
+    const mtpl_batch* batch = run->batch;
+    mtpl_clear_properties(record_context);
+    mtpl_result result = batch->prepare
+        ? batch->prepare(batch->user, index, record_context)
+        : set_properties(&batch->sets[index], record_context);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_run_template(run->program, record_context);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    if (batch->write) {
+        return batch->write(
+            batch->user,
+            index,
+            record_context->output->data,
+            record_context->output->cursor
+        );
+    } else if (batch->sink) {
+        return write_in_order(run, index, record_context);
+    }
+    return MTPL_SUCCESS;
+}
+
+static void render_records(void* data) {
+    mtpl__batch_run* run = data;
+    const size_t self = __atomic_fetch_add(&run->joined, 1, __ATOMIC_RELAXED);
+
+    mtpl_context* record_context;
+    mtpl_result result = mtpl_init_overlay(run->context, &record_context);
+    if (result == MTPL_SUCCESS && run->context->profile) {
+        result = mtpl_enable_profiling(record_context);
+        if (result != MTPL_SUCCESS) {
+            mtpl_free(record_context);
+        }
+    }
+    if (result == MTPL_SUCCESS && run->context->trace) {
+        result = mtpl_trace_create_thread(
+            run->context->trace,
+            &record_context->trace
+        );
+        if (result != MTPL_SUCCESS) {
+            mtpl_free(record_context);
+        }
+    }
+    if (result != MTPL_SUCCESS) {
+        fail(run, result);
+        return;
+    }
+    size_t chunk;
+    while (
+        !__atomic_load_n(&run->failed, __ATOMIC_RELAXED)
+        && take_chunk(run, self, &chunk)
+    ) {
+        const size_t begin = chunk * run->chunk_size;
+        const size_t end = (begin + run->chunk_size < run->count)
+            ? begin + run->chunk_size
+            : run->count;
+        for (size_t i = begin; i < end; ++i) {
+            result = render_record(run, i, record_context);
+            if (result != MTPL_SUCCESS) {
+                fail(run, result);
+                break;
+            }
+        }
+    }
+    if (record_context->profile) {
+        mtpl_profile_collect(&run->profiles, record_context->profile);
+        record_context->profile = NULL;
+    }
+    if (record_context->trace) {
+        mtpl_trace_collect(&run->traces, record_context->trace);
+        record_context->trace = NULL;
+    }
+    mtpl_free(record_context);
+}
+
+mtpl_result mtpl_render_batch(
+    const mtpl_program* program,
+    mtpl_context* context,
+    size_t count,
+    const mtpl_batch* batch
+) {
+    const mtpl_allocators* allocators = context->allocators;
+    if (!count) {
+        return MTPL_SUCCESS;
+    }
+    size_t threads = batch->threads ? batch->threads : mtpl_threads_available();
+    if (threads > count) {
+        threads = count;
+    }
+    size_t chunk_size = count / (threads * CHUNKS_PER_THREAD);
+    if (!chunk_size) {
+        chunk_size = 1;
+    }
+    const size_t num_chunks = (count + chunk_size - 1) / chunk_size;
+
+    mtpl__batch_run run = {
+        .program = program,
+        .context = context,
+        .batch = batch,
+        .count = count,
+        .chunk_size = chunk_size,
+        .num_threads = threads,
+        .deques = mtpl_allocate(allocators, sizeof(mtpl__deque) * threads),
+        .joined = 0,
+        .failed = false,
+        .result = MTPL_SUCCESS,
+        .profiles = NULL,
+        .traces = NULL,
+        .pending = NULL,
+        .next_write = 0
+    };
+    if (!run.deques) {
+        return MTPL_ERR_MEMORY;
+    }
+    if (!batch->write && batch->sink) {
+        run.pending = mtpl_allocate(allocators, sizeof(mtpl_buffer*) * count);
+        if (!run.pending) {
+            mtpl_deallocate(allocators, run.deques);
+            return MTPL_ERR_MEMORY;
+        }
+        memset(run.pending, 0, sizeof(mtpl_buffer*) * count);
+    }
+    pthread_mutex_init(&run.order_lock, NULL);
+    // Deal the chunks out in turn, so that every thread starts out near the
+    // beginning of the batch.
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_mutex_init(&run.deques[i].lock, NULL);
+        run.deques[i].front = 0;
+        run.deques[i].back = (num_chunks - i + threads - 1) / threads;
+    }
+
+    mtpl_threads_run(
+        context->pool,
+        allocators,
+        threads,
+        render_records,
+        &run
+    );
+
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_mutex_destroy(&run.deques[i].lock);
+    }
+    pthread_mutex_destroy(&run.order_lock);
+    if (run.profiles) {
+        const mtpl_result merged = mtpl_profile_merge(
+            context->profile,
+            run.profiles
+        );
+        if (run.result == MTPL_SUCCESS) {
+            run.result = merged;
+        }
+    }
+    if (run.traces) {
+        const mtpl_result merged = mtpl_trace_merge(context->trace, run.traces);
+        if (run.result == MTPL_SUCCESS) {
+            run.result = merged;
+        }
+    }
+    if (run.pending) {
+        // Records rendered ahead of a failed one are left over.
+        for (size_t i = run.next_write; i < count; ++i) {
+            if (run.pending[i]) {
+                mtpl_buffer_free(allocators, run.pending[i]);
+            }
+        }
+        mtpl_deallocate(allocators, run.pending);
+    }
+    mtpl_deallocate(allocators, run.deques);
+    return run.result;
+}
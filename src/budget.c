@@ -0,0 +1,48 @@
+#include "budget.h"
+
+#include <time.h>
+
+_Thread_local mtpl_budget* mtpl_active_budget = NULL;
+_Thread_local size_t mtpl_budget_depth = 0;
+_Thread_local size_t mtpl_budget_stack = 0;
+
+static uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+bool mtpl_budget_init(mtpl_budget* budget, const mtpl_limits* limits) {
+    *budget = (mtpl_budget) {
+        .limits = *limits,
+        .deadline = limits->max_time_ms
+            ? now() + limits->max_time_ms * 1000000u
+            : 0
+    };
+    return limits->max_depth
+        || limits->max_stack
+        || limits->max_steps
+        || limits->max_output
+        || limits->max_time_ms;
+}
+
+void mtpl_budget_enter(
+    mtpl_budget* budget,
+    size_t depth,
+    mtpl_budget** out_previous,
+    size_t* out_previous_depth
+) {
+    *out_previous = mtpl_active_budget;
+    *out_previous_depth = mtpl_budget_depth;
+    mtpl_active_budget = budget;
+    mtpl_budget_depth = depth;
+}
+
+void mtpl_budget_leave(mtpl_budget* previous, size_t previous_depth) {
+    mtpl_active_budget = previous;
+    mtpl_budget_depth = previous_depth;
+}
+
+mtpl_result mtpl_budget_check_time(const mtpl_budget* budget) {
+    return now() > budget->deadline ? MTPL_ERR_TIME_LIMIT : MTPL_SUCCESS;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <mintpl/common.h>
+#include <mintpl/mintpl.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Limits of the render running on a thread, and how much of them it has used
+// up so far.
+
+// Generator invocations between looking at the clock, if time is limited.
+#define MTPL_BUDGET_CLOCK_STEPS 64
+
+typedef struct {
+    mtpl_limits limits;
+    // Time the render has to be done by in nanoseconds, or 0.
+    uint64_t deadline;
+    // Generator invocations and loop iterations, counted by all threads of
+    // the render.
+    size_t steps;
+    // Output passed on to sinks.
+    size_t streamed;
+} mtpl_budget;
+
+// Budget of the render running on this thread, or NULL if it has no limits,
+// and the nesting of the generator invocations it is in.
+extern _Thread_local mtpl_budget* mtpl_active_budget;
+extern _Thread_local size_t mtpl_budget_depth;
+// Stack taken by evaluations nested within each other on this thread, of any
+// render.
+extern _Thread_local size_t mtpl_budget_stack;
+
+// Sets up a budget for a render with the given limits. Returns false if there
+// are none to enforce.
+bool mtpl_budget_init(mtpl_budget* budget, const mtpl_limits* limits);
+
+// Makes `budget`, which may be NULL, active on the calling thread at nesting
+// `depth`. Returns the previously active budget and nesting, which should be
+// restored using mtpl_budget_leave().
+void mtpl_budget_enter(
+    mtpl_budget* budget,
+    size_t depth,
+    mtpl_budget** out_previous,
+    size_t* out_previous_depth
+);
+
+void mtpl_budget_leave(mtpl_budget* previous, size_t previous_depth);
+
+mtpl_result mtpl_budget_check_time(const mtpl_budget* budget);
+
+// Counts a step of the render, looking at the clock every so often if time
+// is limited.
+static inline mtpl_result mtpl_budget_count(mtpl_budget* budget) {
+    const mtpl_limits* limits = &budget->limits;
+    if (!limits->max_steps && !budget->deadline) {
+        return MTPL_SUCCESS;
+    }
+    const size_t steps = __atomic_add_fetch(
+        &budget->steps,
+        1,
+        __ATOMIC_RELAXED
+    );
+    if (limits->max_steps && steps > limits->max_steps) {
+        return MTPL_ERR_STEP_LIMIT;
+    }
+    if (budget->deadline && steps % MTPL_BUDGET_CLOCK_STEPS == 0) {
+        return mtpl_budget_check_time(budget);
+    }
+    return MTPL_SUCCESS;
+}
+
+// Counts an iteration of a loop, which takes a step like a generator
+// invocation does, so that loops over huge ranges run out of budget even if
+// their bodies invoke nothing.
+static inline mtpl_result mtpl_budget_iterate(void) {
+    mtpl_budget* budget = mtpl_active_budget;
+    return budget ? mtpl_budget_count(budget) : MTPL_SUCCESS;
+}
+
+// Starts a generator invocation, if it is within budget. Every successful
+// call should be matched by a call to mtpl_budget_return().
+static inline mtpl_result mtpl_budget_call(void) {
+    mtpl_budget* budget = mtpl_active_budget;
+    if (!budget) {
+        return MTPL_SUCCESS;
+    }
+    const size_t max_depth = budget->limits.max_depth;
+    if (max_depth && mtpl_budget_depth >= max_depth) {
+        return MTPL_ERR_DEPTH_LIMIT;
+    }
+    const mtpl_result result = mtpl_budget_count(budget);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_budget_depth++;
+    return MTPL_SUCCESS;
+}
+
+// Ends a generator invocation that wrote `output` bytes in all to its output
+// buffer. Returns `result`, or an error if the output is over budget.
+static inline mtpl_result mtpl_budget_return(
+    size_t output,
+    mtpl_result result
+) {
+    mtpl_budget* budget = mtpl_active_budget;
+    if (!budget) {
+        return result;
+    }
+    mtpl_budget_depth--;
+    const size_t max_output = budget->limits.max_output;
+    if (result == MTPL_SUCCESS && max_output && output > max_output) {
+        return MTPL_ERR_OUTPUT_LIMIT;
+    }
+    return result;
+}
+
+// Starts an evaluation of a template on the C stack, if there is room for it.
+// Every successful call should be matched by a call to mtpl_budget_ascend().
+static inline mtpl_result mtpl_budget_descend(void) {
+    const mtpl_budget* budget = mtpl_active_budget;
+    const size_t max_stack = budget ? budget->limits.max_stack : 0;
+    const size_t stack = mtpl_budget_stack + MTPL_STACK_PER_DEPTH;
+    if (max_stack && stack > max_stack) {
+        return MTPL_ERR_DEPTH_LIMIT;
+    }
+    mtpl_budget_stack = stack;
+    return MTPL_SUCCESS;
+}
+
+static inline void mtpl_budget_ascend(void) {
+    mtpl_budget_stack -= MTPL_STACK_PER_DEPTH;
+}
+
+// Checks that a buffer may grow to hold `length` bytes.
+static inline mtpl_result mtpl_budget_grow(size_t length) {
+    const mtpl_budget* budget = mtpl_active_budget;
+    if (!budget) {
+        return MTPL_SUCCESS;
+    }
+    if (budget->limits.max_output && length > budget->limits.max_output) {
+        return MTPL_ERR_OUTPUT_LIMIT;
+    }
+    return budget->deadline
+        ? mtpl_budget_check_time(budget)
+        : MTPL_SUCCESS;
+}
+
+// Counts output passed on to a sink.
+static inline mtpl_result mtpl_budget_stream(size_t length) {
+    mtpl_budget* budget = mtpl_active_budget;
+    if (!budget || !budget->limits.max_output) {
+        return MTPL_SUCCESS;
+    }
+    budget->streamed += length;
+    return budget->streamed > budget->limits.max_output
+        ? MTPL_ERR_OUTPUT_LIMIT
+        : MTPL_SUCCESS;
+}
@@ -1,5 +1,8 @@
 #include <mintpl/buffers.h>
 
+#include "budget.h"
+#include "scan.h"
+
 #include <stdbool.h>
 #include <string.h>
 
@@ -44,11 +47,11 @@ mtpl_result mtpl_buffer_create(
     size_t size,
     mtpl_buffer** buffer
 ) {
-    *buffer = allocators->malloc(sizeof(mtpl_buffer));
+    *buffer = mtpl_allocate(allocators, sizeof(mtpl_buffer));
     if (!*buffer) {
         return MTPL_ERR_MEMORY;
     }
-    (*buffer)->data = allocators->malloc(size);
+    (*buffer)->data = mtpl_allocate(allocators, size);
     if (!(*buffer)->data) {
         return MTPL_ERR_MEMORY;
     }
@@ -62,8 +65,9 @@ mtpl_result mtpl_buffer_free(
     const mtpl_allocators* allocators,
     mtpl_buffer* buffer
 ) {
-    allocators->free(buffer->data);
-    allocators->free(buffer);
+    mtpl_deallocate(allocators, buffer->data);
+    mtpl_deallocate(allocators, buffer);
+    return MTPL_SUCCESS;
 }
 
 mtpl_result mtpl_buffer_print(
@@ -81,17 +85,35 @@ mtpl_result mtpl_buffer_nprint(
     mtpl_buffer* output,
     size_t len
 ) {
+    const mtpl_slice slice = { &input->data[input->cursor], len };
+    return mtpl_buffer_write(&slice, allocators, output);
+}
+
+mtpl_result mtpl_buffer_write(
+    const mtpl_slice* input,
+    const mtpl_allocators* allocators,
+    mtpl_buffer* output
+) {
+    const size_t len = input->length;
     if (output->cursor + len >= output->size) {
+        const mtpl_result result = mtpl_budget_grow(output->cursor + len);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+        size_t size = output->size;
+        do {
+            size *= 2;
+        } while (output->cursor + len >= size);
         MTPL_REALLOC_CHECKED(
             allocators,
             output->data,
-            output->size * 2,
+            size,
             return MTPL_ERR_MEMORY
         );
-        output->size *= 2;
+        output->size = size;
     }
 
-    memcpy(&output->data[output->cursor], &input->data[input->cursor], len);
+    memcpy(&output->data[output->cursor], input->data, len);
     output->cursor += len;
     output->data[output->cursor] = '\0';
     return MTPL_SUCCESS;
@@ -106,11 +128,15 @@ mtpl_result mtpl_buffer_extract(
     trim_whitespace(input);
 
     size_t len = extract_length(input, delimiter);
-    if (out->size < out->cursor + len) {
+    if (out->size <= out->cursor + len) {
+        const mtpl_result result = mtpl_budget_grow(out->cursor + len);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
         size_t size = out->size;
         do {
             size *= 2;
-        } while (size < out->cursor + len);
+        } while (size <= out->cursor + len);
         MTPL_REALLOC_CHECKED(
             allocators,
             out->data,
@@ -148,33 +174,37 @@ mtpl_result mtpl_buffer_extract_sub(
 
     size_t level = 0;
     do {
-        const char c = input->data[input->cursor];
-        if (c == opener) {
+        const char* text = &input->data[input->cursor];
+        mtpl_slice copied = { text, 1 };
+        size_t consumed = 1;
+        if (*text == opener) {
             level++;
-            if (!include_outer && level == 1) {
-                input->cursor++;
-                continue;
-            }
-        } else if (c == closer) {
+            copied.length = include_outer || level > 1;
+        } else if (*text == closer) {
             level--;
-        } else if (c == '\\') {
+            if (!include_outer && !level) {
+                break;
+            }
+        } else if (*text == '\\') {
             // Escape next character if not 0.
-            if (!input->data[++(input->cursor)]) {
+            if (!text[1]) {
                 return MTPL_ERR_SYNTAX;
             }
+            copied.data++;
+            consumed++;
+        } else if (*text) {
+            // Copy plain text up to the next special character at once.
+            const size_t length = mtpl_scan_text(text);
+            copied.length = length ? length : 1;
+            consumed = copied.length;
+        } else {
+            break;
         }
-        if (out->cursor >= out->size) {
-            MTPL_REALLOC_CHECKED(
-                allocators,
-                out->data,
-                out->size * 2,
-                return MTPL_ERR_MEMORY
-            );
-            out->size *= 2;
-        }
-        if (include_outer || level > 0) {
-            out->data[out->cursor++] = input->data[input->cursor++];
+        const mtpl_result result = mtpl_buffer_write(&copied, allocators, out);
+        if (result != MTPL_SUCCESS) {
+            return result;
         }
+        input->cursor += consumed;
     } while (level && input->data[input->cursor]);
 
     out->data[out->cursor] = '\0';
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <mintpl/buffers.h>
+#include <mintpl/common.h>
+#include <mintpl/generators.h>
+#include <mintpl/hashtable.h>
+#include <mintpl/substitute.h>
+
+#include "profile.h"
+
+// Templates that a generator renders as part of its invocation, such as the
+// body of a loop or a macro, handed over to the evaluator that called it.
+// The evaluator runs them on its own stack of frames once the generator has
+// returned, so that templates nested through generators take up no more of
+// the C stack than nested substitutions do.
+typedef struct mtpl_continuation mtpl_continuation;
+
+struct mtpl_continuation {
+    // Template to run next, the properties to run it with and the buffer to
+    // run it into. `program` is cleared once the template has run.
+    const mtpl_program* program;
+    mtpl_hashtable* properties;
+    mtpl_buffer* out;
+    // Called whenever `program` is clear, including before the first
+    // template if none is set up yet, to set up the next one. The
+    // continuation is done once `program` is still clear after that, or right
+    // away if `resume` is NULL.
+    mtpl_result (*resume)(
+        mtpl_continuation* continuation,
+        const mtpl_allocators* allocators,
+        mtpl_hashtable* generators
+    );
+    // Called once the continuation is done, or has failed with `result`, to
+    // release what it holds on to. Returns the result of the invocation.
+    mtpl_result (*finish)(
+        mtpl_continuation* continuation,
+        const mtpl_allocators* allocators,
+        mtpl_result result
+    );
+    // Invocation of the generator, kept open by the evaluator until the
+    // continuation is finished.
+    mtpl_profile_frame call;
+    mtpl_buffer* storage;
+};
+
+// Returns zeroed storage of `size` bytes for a continuation, which is placed
+// at its start. The storage stays in place until the continuation is
+// finished.
+mtpl_result mtpl_continuation_create(
+    const mtpl_allocators* allocators,
+    size_t size,
+    mtpl_continuation** out_continuation
+);
+
+// Hands `continuation` over to the evaluator, if it is calling `generator`
+// on this thread. Otherwise, as when `generator` is called by another
+// generator, the continuation is run to completion right away. Either way,
+// `finish` is called once it is done. The generator should then return the
+// result without writing any more output.
+mtpl_result mtpl_continue(
+    mtpl_generator generator,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_continuation* continuation
+);
+
+// Template that a generator runs from its arguments, such as the body of a
+// loop, along with the program it is compiled into. `owned` is set if the
+// program was compiled for this invocation alone.
+typedef struct {
+    const mtpl_program* program;
+    mtpl_program* owned;
+} mtpl_template;
+
+// Compiles the rest of `arg`, from its cursor on. If it was quoted in the
+// program that the evaluator is running, the template is compiled the first
+// time only, and kept by the program for later invocations. Otherwise it is
+// compiled from the arena. Either way it should be released using
+// mtpl_template_release().
+mtpl_result mtpl_template_compile_rest(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    const mtpl_buffer* arg,
+    mtpl_template* out_template
+);
+
+// Takes the substitution or word at the cursor of `arg`, as
+// mtpl_buffer_extract_sub() does, and compiles it like
+// mtpl_template_compile_rest(). Quoted templates are only scanned the first
+// time, also when they are skipped by passing NULL for `out_template`.
+mtpl_result mtpl_template_extract(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_buffer* arg,
+    mtpl_template* out_template
+);
+
+void mtpl_template_release(
+    const mtpl_allocators* allocators,
+    mtpl_template* body
+);
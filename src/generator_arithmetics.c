@@ -1,16 +1,17 @@
 #include <mintpl/generators.h>
+#include <mintpl/number.h>
 
-#include "stack.h"
-
-#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define TMP_BUF_SIZE 32
+// Expressions of up to this many tokens are evaluated without allocating, and
+// have their parsed form cached.
+#define MAX_CACHED_TOKENS 64
+// Number of parsed expressions cached per thread. Always a power of two.
+#define EXPR_CACHE_SIZE 32
 
 typedef enum {
     MTPL_OP_INVALID,
@@ -38,22 +39,40 @@ static const uint8_t mtpl__precedence[] = {
     [MTPL_OP_RPAREN] = 0
 };
 
-typedef enum {
-    MTPL_TOK_VALUE,
-    MTPL_TOK_OP
-} mtpl__token_type;
+// A step of an expression in reverse Polish notation: either an operation,
+// or (for MTPL_OP_INVALID) pushing the value of slot `slot`.
+typedef struct {
+    mtpl__operator operation;
+    uint32_t slot;
+} mtpl__step;
 
+// Storage of an expression being evaluated. The shape holds the operator of
+// each token, or MTPL_OP_INVALID for values, which are kept in order in the
+// value slots.
 typedef struct {
-    union {
-        double value;
-        mtpl__operator operation;
-    };
-    mtpl__token_type type;
-} mtpl__token;
+    size_t num_tokens;
+    size_t num_values;
+    size_t num_steps;
+    uint8_t* shape;
+    mtpl_number* values;
+    mtpl__step* steps;
+    // Storage for the operator stack when parsing, and the value stack when
+    // evaluating.
+    uint8_t* ops;
+    mtpl_number* stack;
+} mtpl__expr;
+
+// Parsed expressions are keyed by their shape rather than by their text, so
+// that an expression is parsed once, whatever values are substituted into it.
+typedef struct {
+    uint32_t hash;
+    uint8_t num_tokens;
+    uint8_t num_steps;
+    uint8_t shape[MAX_CACHED_TOKENS];
+    mtpl__step steps[MAX_CACHED_TOKENS];
+} mtpl__cached_expr;
 
-DESCRIBE_STACK(double);
-DESCRIBE_STACK(mtpl__operator);
-DESCRIBE_STACK(mtpl__token);
+static _Thread_local mtpl__cached_expr expr_cache[EXPR_CACHE_SIZE];
 
 static bool mtpl__is_space(const mtpl_buffer* buf) {
     switch (buf->data[buf->cursor]) {
@@ -65,18 +84,15 @@ static bool mtpl__is_space(const mtpl_buffer* buf) {
 
 static mtpl__operator mtpl__get_operator(
     const mtpl_buffer* buf,
-    const mtpl__token* previous
+    mtpl__operator previous
 ) {
     const char c = buf->data[buf->cursor];
     switch (c) {
     case '+': return MTPL_OP_ADD;
     case '-': 
-        // If the previous token was an operator, this must be a unary minus,
-        // except if the "operator" was a right paren.
-        if (
-            previous->type == MTPL_TOK_OP
-            && previous->operation != MTPL_OP_RPAREN
-        ) {
+        // If the previous token was an operator (or there was none), this must
+        // be a unary minus, except if the "operator" was a right paren.
+        if (previous != MTPL_OP_RPAREN) {
             return MTPL_OP_NEGATE;
         }
         return MTPL_OP_SUBTRACT;
@@ -91,46 +107,76 @@ static mtpl__operator mtpl__get_operator(
     }
 }
 
-static mtpl_result mtpl__extract_number(mtpl_buffer* buf, double* out) {
-    char* end = NULL;
-    errno = 0;
-    *out = strtod(&buf->data[buf->cursor], &end);
-    if (errno != 0 || end == &buf->data[buf->cursor]) {
+static mtpl_result mtpl__extract_number(mtpl_buffer* buf, mtpl_number* out) {
+    const size_t length = mtpl_number_parse(&buf->data[buf->cursor], out);
+    if (!length) {
         return MTPL_ERR_SYNTAX;
     }
 
-    buf->cursor += (uintptr_t) end - (uintptr_t) &buf->data[buf->cursor];
+    buf->cursor += length;
+
+    return MTPL_SUCCESS;
+}
+
+// Splits the expression into its shape and values.
+static mtpl_result mtpl__tokenize(mtpl_buffer* buf, mtpl__expr* expr) {
+    // Special state: The beginning of the expression is an "invisible"
+    // operator, to be able to correctly parse a unary minus at the start of
+    // an expression. Values are marked the same way as right parens, as
+    // neither can be followed by a unary minus.
+    mtpl__operator previous = MTPL_OP_INVALID;
+    while (buf->data[buf->cursor]) {
+        if (mtpl__is_space(buf)) {
+            buf->cursor++;
+            continue;
+        }
 
+        const mtpl__operator op = mtpl__get_operator(buf, previous);
+        if (op == MTPL_OP_INVALID) {
+            const mtpl_result res = mtpl__extract_number(
+                buf,
+                &expr->values[expr->num_values++]
+            );
+            if (res != MTPL_SUCCESS) {
+                return res;
+            }
+            previous = MTPL_OP_RPAREN;
+        } else {
+            buf->cursor++;
+            previous = op;
+        }
+        expr->shape[expr->num_tokens++] = op;
+    }
     return MTPL_SUCCESS;
 }
 
+// Moves operators of higher or equal precedence than `op` over from the
+// operator stack to the steps, and then pushes `op`.
 static mtpl_result mtpl__dump_ops(
-    STACK(mtpl__token)* expr,
-    STACK(mtpl__operator)* ops,
+    mtpl__expr* expr,
+    size_t* num_ops,
     mtpl__operator op
 ) {
-    mtpl__token token = { 0, MTPL_TOK_OP };
-    mtpl__operator* top;
+    const uint8_t* top = NULL;
     if (op != MTPL_OP_LPAREN) {
         while (
-            (top = PEEK_BACK(mtpl__operator)(ops))
+            *num_ops
+            && (top = &expr->ops[*num_ops - 1])
             && (
                 (op == MTPL_OP_RPAREN)
                 || (mtpl__precedence[op] <= mtpl__precedence[*top])
             )
         ) { 
             if (op == MTPL_OP_RPAREN && *top == MTPL_OP_LPAREN) {
-                ops->num_entries--;
+                (*num_ops)--;
                 break;
             } else if (op != MTPL_OP_RPAREN && *top == MTPL_OP_LPAREN) {
                 return MTPL_ERR_SYNTAX;
             }
-            token.operation = *top;
-            const mtpl_result res = PUSH_BACK(mtpl__token)(expr, &token);
-            if (res != MTPL_SUCCESS) {
-                return res;
-            }
-            ops->num_entries--;
+            const mtpl__step step = { *top, 0 };
+            expr->steps[expr->num_steps++] = step;
+            (*num_ops)--;
+            top = NULL;
         }
     }
     if (op == MTPL_OP_INVALID) {
@@ -139,177 +185,223 @@ static mtpl_result mtpl__dump_ops(
     if (op == MTPL_OP_RPAREN) {
         return (top && *top == MTPL_OP_LPAREN) ? MTPL_SUCCESS : MTPL_ERR_SYNTAX;
     }
-    return PUSH_BACK(mtpl__operator)(ops, &op); 
+    expr->ops[(*num_ops)++] = op;
+    return MTPL_SUCCESS;
 }
 
-static mtpl_result mtpl__parse_expr(
-    const mtpl_allocators* allocators,
-    mtpl_buffer* buf,
-    STACK(mtpl__token)** out_expr
-) {
-    mtpl_result res = MTPL_SUCCESS;
-    STACK(mtpl__operator)* ops = CREATE_STACK(mtpl__operator)(allocators);
-    if (!ops) {
-        return MTPL_ERR_MEMORY;
-    }
-    STACK(mtpl__token)* expr = CREATE_STACK(mtpl__token)(allocators);
-    if (!expr) {
-        res = MTPL_ERR_MEMORY;
-        goto cleanup_ops;
-    }
-
-    // Special state: The beginning of the expression is an "invisible" token
-    // describing an invalid operation, to be able to correctly parse a unary
-    // minus at the start of an expression.
-    mtpl__token token = { .operation = MTPL_OP_INVALID, true };
-    while (buf->data[buf->cursor]) {
-        if (mtpl__is_space(buf)) {
-            buf->cursor++;
+// Orders the tokens of the expression into steps, using the shunting-yard
+// algorithm.
+static mtpl_result mtpl__parse_expr(mtpl__expr* expr) {
+    size_t num_ops = 0;
+    uint32_t slot = 0;
+    for (size_t i = 0; i < expr->num_tokens; ++i) {
+        const mtpl__operator op = expr->shape[i];
+        if (op == MTPL_OP_INVALID) {
+            const mtpl__step step = { MTPL_OP_INVALID, slot++ };
+            expr->steps[expr->num_steps++] = step;
             continue;
         }
-
-        const mtpl__operator op = mtpl__get_operator(buf, &token);
-        token.type = (op != MTPL_OP_INVALID) ? MTPL_TOK_OP : MTPL_TOK_VALUE;
-        switch (token.type) {
-        case MTPL_TOK_VALUE:
-            res = mtpl__extract_number(buf, &token.value);
-            if (res == MTPL_SUCCESS) {
-                res = PUSH_BACK(mtpl__token)(expr, &token);
-            }
-            break;
-        case MTPL_TOK_OP:
-            res = mtpl__dump_ops(expr, ops, op);
-            if (res != MTPL_SUCCESS) {
-                goto err_cleanup_expr;
-            }
-            buf->cursor++;
-            break;
-        }
-
+        const mtpl_result res = mtpl__dump_ops(expr, &num_ops, op);
         if (res != MTPL_SUCCESS) {
-            goto err_cleanup_expr;
+            return res;
         }
     }
+    return mtpl__dump_ops(expr, &num_ops, MTPL_OP_INVALID);
+}
 
-    res = mtpl__dump_ops(expr, ops, MTPL_OP_INVALID);
-    if (res != MTPL_SUCCESS) {
-        goto err_cleanup_expr;
+// FNV-1a hash of the expression's shape.
+static uint32_t mtpl__hash_shape(const mtpl__expr* expr) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < expr->num_tokens; ++i) {
+        hash ^= expr->shape[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    *out_expr = expr;
+// Fills in the steps of the expression, from the cache if its shape has been
+// seen before.
+static mtpl_result mtpl__lookup_expr(mtpl__expr* expr) {
+    if (expr->num_tokens > MAX_CACHED_TOKENS) {
+        return mtpl__parse_expr(expr);
+    }
+    const uint32_t hash = mtpl__hash_shape(expr);
+    mtpl__cached_expr* cached = &expr_cache[hash & (EXPR_CACHE_SIZE - 1)];
+    if (
+        cached->hash == hash
+        && cached->num_tokens == expr->num_tokens
+        && memcmp(cached->shape, expr->shape, expr->num_tokens) == 0
+    ) {
+        expr->steps = cached->steps;
+        expr->num_steps = cached->num_steps;
+        return MTPL_SUCCESS;
+    }
 
-cleanup_ops:
-    FREE_STACK(mtpl__operator)(ops);
-    return res;
+    const mtpl_result res = mtpl__parse_expr(expr);
+    if (res != MTPL_SUCCESS) {
+        return res;
+    }
+    cached->hash = hash;
+    cached->num_tokens = expr->num_tokens;
+    cached->num_steps = expr->num_steps;
+    memcpy(cached->shape, expr->shape, expr->num_tokens);
+    memcpy(cached->steps, expr->steps, sizeof(mtpl__step) * expr->num_steps);
+    return MTPL_SUCCESS;
+}
 
-err_cleanup_expr:
-    FREE_STACK(mtpl__token)(expr);
-    goto cleanup_ops;
+// Integer power by squaring. Returns false on overflow.
+static bool mtpl__int_power(int64_t base, int64_t exponent, int64_t* out) {
+    int64_t result = 1;
+    while (exponent) {
+        if (exponent & 1 && __builtin_mul_overflow(result, base, &result)) {
+            return false;
+        }
+        exponent >>= 1;
+        if (exponent && __builtin_mul_overflow(base, base, &base)) {
+            return false;
+        }
+    }
+    *out = result;
+    return true;
 }
 
-static mtpl_result mtpl__eval_valstack(
-    STACK(double)* stack,
-    mtpl__operator operation
+// Applies an operation exactly to integer operands. Returns false if the
+// result is not an integer, or does not fit.
+static bool mtpl__eval_integer(
+    mtpl__operator operation,
+    int64_t a,
+    int64_t b,
+    int64_t* out
 ) {
-    double a;
-    double b;
     switch (operation) {
     case MTPL_OP_ADD:
+        return !__builtin_add_overflow(a, b, out);
     case MTPL_OP_SUBTRACT:
+        return !__builtin_sub_overflow(a, b, out);
     case MTPL_OP_MULTIPLY:
+        return !__builtin_mul_overflow(a, b, out);
     case MTPL_OP_DIVIDE:
+        if (!b || (a == INT64_MIN && b == -1) || a % b) {
+            return false;
+        }
+        *out = a / b;
+        return true;
     case MTPL_OP_MODULO:
-    case MTPL_OP_POWER:
-        if (stack->num_entries < 2) {
-            return MTPL_ERR_SYNTAX;
+        if (!b || (a == INT64_MIN && b == -1)) {
+            return false;
         }
-        b = *POP_BACK(double)(stack);
-        a = *POP_BACK(double)(stack);
-        break;
+        *out = a % b;
+        return true;
+    case MTPL_OP_POWER:
+        return b >= 0 && mtpl__int_power(a, b, out);
     case MTPL_OP_NEGATE:
-        if (!stack->num_entries) {
-            return MTPL_ERR_SYNTAX;
-        }
-        a = *POP_BACK(double)(stack);
-        break;
+        return !__builtin_sub_overflow(0, a, out);
     default:
-        return MTPL_ERR_SYNTAX;
+        return false;
     }
+}
 
-    double value;
+static double mtpl__eval_real(mtpl__operator operation, double a, double b) {
     switch (operation) {
     case MTPL_OP_ADD:
-        value = a + b;
-        break;
+        return a + b;
     case MTPL_OP_SUBTRACT:
-        value = a - b;
-        break;
+        return a - b;
     case MTPL_OP_MULTIPLY:
-        value = a * b;
-        break;
+        return a * b;
     case MTPL_OP_DIVIDE:
-        value = a / b;
-        break;
+        return a / b;
     case MTPL_OP_MODULO:
-        value = fmod(a, b);
-        break;
+        return fmod(a, b);
     case MTPL_OP_POWER:
-        value = pow(a, b);
+        return pow(a, b);
+    default:
+        return -a;
+    }
+}
+
+static mtpl_result mtpl__eval_step(
+    mtpl_number* stack,
+    size_t* num_entries,
+    mtpl__operator operation
+) {
+    mtpl_number a;
+    mtpl_number b = { .integer = 0, .integral = true };
+    switch (operation) {
+    case MTPL_OP_ADD:
+    case MTPL_OP_SUBTRACT:
+    case MTPL_OP_MULTIPLY:
+    case MTPL_OP_DIVIDE:
+    case MTPL_OP_MODULO:
+    case MTPL_OP_POWER:
+        if (*num_entries < 2) {
+            return MTPL_ERR_SYNTAX;
+        }
+        b = stack[--(*num_entries)];
+        a = stack[--(*num_entries)];
         break;
     case MTPL_OP_NEGATE:
-        value = -a;
+        if (!*num_entries) {
+            return MTPL_ERR_SYNTAX;
+        }
+        a = stack[--(*num_entries)];
         break;
     default:
         return MTPL_ERR_SYNTAX;
     }
-    return PUSH_BACK(double)(stack, &value);
+
+    mtpl_number* value = &stack[(*num_entries)++];
+    if (
+        a.integral
+        && b.integral
+        && mtpl__eval_integer(operation, a.integer, b.integer, &value->integer)
+    ) {
+        value->integral = true;
+        return MTPL_SUCCESS;
+    }
+    value->real = mtpl__eval_real(
+        operation,
+        mtpl_number_real(&a),
+        mtpl_number_real(&b)
+    );
+    value->integral = false;
+    return MTPL_SUCCESS;
 }
 
 static mtpl_result mtpl__eval_expr(
     const mtpl_allocators* allocators,
-    const STACK(mtpl__token)* expr,
+    const mtpl__expr* expr,
     mtpl_buffer* out
 ) {
-    char tmp_data[TMP_BUF_SIZE];
-    mtpl_result res = MTPL_SUCCESS;
-    STACK(double)* valstack = CREATE_STACK(double)(allocators);
-    if (!valstack) {
-        return MTPL_ERR_MEMORY;
-    }
-
-    const mtpl__token* cursor = &expr->entries[0];
-    for (size_t i = 0; i < expr->num_entries; ++i, cursor = &expr->entries[i]) {
-        switch (cursor->type) {
-        case MTPL_TOK_VALUE:
-            PUSH_BACK(double)(valstack, &cursor->value);
-            break;
-        case MTPL_TOK_OP:
-            res = mtpl__eval_valstack(valstack, cursor->operation);
-            if (res != MTPL_SUCCESS) {
-                goto cleanup_valstack;
-            }
-            break;
+    // Only values are pushed, so the stack never holds more entries than
+    // there are values.
+    size_t num_entries = 0;
+    for (size_t i = 0; i < expr->num_steps; ++i) {
+        const mtpl__step* step = &expr->steps[i];
+        if (step->operation == MTPL_OP_INVALID) {
+            expr->stack[num_entries++] = expr->values[step->slot];
+            continue;
+        }
+        const mtpl_result res = mtpl__eval_step(
+            expr->stack,
+            &num_entries,
+            step->operation
+        );
+        if (res != MTPL_SUCCESS) {
+            return res;
         }
     }
 
-    if (valstack->num_entries != 1) {
-        res = MTPL_ERR_SYNTAX;
-        goto cleanup_valstack;
-    }
-
-    const size_t len = snprintf(tmp_data, 0, "%g", valstack->entries[0]) + 1;
-    if (len > TMP_BUF_SIZE) {
-        res = MTPL_ERR_MALFORMED_NAME;
-        goto cleanup_valstack;
+    if (num_entries != 1) {
+        return MTPL_ERR_SYNTAX;
     }
-    mtpl_buffer tmp_buf = { tmp_data };
-    snprintf(tmp_data, len, "%g", valstack->entries[0]);
-    res = mtpl_buffer_print(&tmp_buf, allocators, out);
-
-cleanup_valstack:
-    FREE_STACK(double)(valstack);
 
-    return res;
+    char tmp_data[MTPL_NUMBER_MAXLEN + 1];
+    const mtpl_slice result = {
+        tmp_data,
+        mtpl_number_format(&expr->stack[0], tmp_data)
+    };
+    return mtpl_buffer_write(&result, allocators, out);
 }
 
 mtpl_result mtpl_generator_arithmetics(
@@ -319,13 +411,44 @@ mtpl_result mtpl_generator_arithmetics(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    STACK(mtpl__token)* expr;
-    mtpl_result res = mtpl__parse_expr(allocators, arg, &expr);
+    uint8_t shape[MAX_CACHED_TOKENS];
+    mtpl_number values[MAX_CACHED_TOKENS];
+    mtpl__step steps[MAX_CACHED_TOKENS];
+    uint8_t ops[MAX_CACHED_TOKENS];
+    mtpl_number stack[MAX_CACHED_TOKENS];
+    mtpl__expr expr = { 0, 0, 0, shape, values, steps, ops, stack };
+
+    // Every token takes up at least one character, so longer expressions
+    // can't have more tokens than characters.
+    void* storage = NULL;
+    const size_t len = strlen(&arg->data[arg->cursor]);
+    if (len > MAX_CACHED_TOKENS) {
+        storage = mtpl_allocate(
+            allocators,
+            len * (
+                2 * sizeof(mtpl_number)
+                + sizeof(mtpl__step)
+                + 2 * sizeof(uint8_t)
+            )
+        );
+        if (!storage) {
+            return MTPL_ERR_MEMORY;
+        }
+        expr.values = storage;
+        expr.stack = &expr.values[len];
+        expr.steps = (mtpl__step*) &expr.stack[len];
+        expr.shape = (uint8_t*) &expr.steps[len];
+        expr.ops = &expr.shape[len];
+    }
+
+    mtpl_result res = mtpl__tokenize(arg, &expr);
     if (res == MTPL_SUCCESS) {
-        res = mtpl__eval_expr(allocators, expr, out);
-        FREE_STACK(mtpl__token)(expr);
+        res = mtpl__lookup_expr(&expr);
     }
+    if (res == MTPL_SUCCESS) {
+        res = mtpl__eval_expr(allocators, &expr, out);
+    }
+    mtpl_deallocate(allocators, storage);
     
     return res;
 }
-
@@ -0,0 +1,432 @@
+#include <mintpl/generators.h>
+#include <mintpl/substitute.h>
+
+#include "arena.h"
+#include "budget.h"
+#include "continuation.h"
+#include "profile.h"
+#include "threads.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// Set on threads running iterations of a parallel loop. Loops nested in those
+// run on the thread they're on, rather than starting threads of their own.
+static _Thread_local bool in_parallel_loop = false;
+
+// Output of an iteration, taken from the arena of the thread that ran it, or
+// from that of the thread running the loop if `arena` is NULL.
+typedef struct {
+    mtpl_buffer* output;
+    mtpl_arena* arena;
+    mtpl_result result;
+} mtpl__iteration;
+
+// A loop shared between the threads running its iterations. Iterations are
+// handed out in list order, and each renders into an output of its own.
+typedef struct {
+    const mtpl_allocators* allocators;
+    mtpl_hashtable* generators;
+    mtpl_hashtable* properties;
+    const mtpl_program* body;
+    const char* variable;
+    // Items as consecutive null terminated strings. Item `i` starts at
+    // `bounds[i]`, and its terminator precedes `bounds[i + 1]`.
+    const char* items;
+    const size_t* bounds;
+    size_t count;
+    mtpl__iteration* iterations;
+    size_t next;
+    bool failed;
+    // Arenas for the threads that have none of their own, taken in turn.
+    mtpl_arena** arenas;
+    size_t num_arenas;
+    size_t next_arena;
+    // Profile and trace of the thread running the loop, if profiling or
+    // tracing. Other threads keep their own, and add them to `profiles` and
+    // `traces`.
+    mtpl_profile* profile;
+    mtpl_profile* profiles;
+    mtpl_trace* trace;
+    mtpl_trace* traces;
+    // Budget of the render, which iterations on every thread draw from, and
+    // the nesting of the loop within it.
+    mtpl_budget* budget;
+    size_t depth;
+} mtpl__parallel_loop;
+
+static mtpl_result run_iteration(
+    const mtpl__parallel_loop* loop,
+    size_t i,
+    mtpl_buffer* out
+) {
+    mtpl_hashtable* scope;
+    mtpl_result result = mtpl_arena_scope(
+        loop->allocators,
+        loop->properties,
+        &scope
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    const mtpl_slice binding = {
+        &loop->items[loop->bounds[i]],
+        loop->bounds[i + 1] - loop->bounds[i] - 1
+    };
+    result = mtpl_htable_insert_string(
+        loop->variable,
+        &binding,
+        loop->allocators,
+        scope
+    );
+    if (result == MTPL_SUCCESS) {
+        result = mtpl_run(
+            loop->body,
+            loop->allocators,
+            loop->generators,
+            scope,
+            out
+        );
+    }
+    mtpl_arena_release_scope(loop->allocators, scope);
+    return result;
+}
+
+// Runs iterations until there are none left, or one of them has failed. Any
+// iteration preceding a failed one has been handed out already, and is run to
+// completion.
+static void run_iterations(void* data) {
+    mtpl__parallel_loop* loop = data;
+    const mtpl_allocators* allocators = loop->allocators;
+
+    // Each thread keeps transient storage of its own. The thread running the
+    // loop goes on using the arena of its render, if it has one.
+    mtpl_arena* previous = NULL;
+    mtpl_arena* arena = NULL;
+    if (!mtpl_arena_usable(allocators)) {
+        const size_t slot = __atomic_fetch_add(
+            &loop->next_arena,
+            1,
+            __ATOMIC_RELAXED
+        );
+        if (slot < loop->num_arenas) {
+            arena = loop->arenas[slot];
+            previous = mtpl_arena_enter(arena);
+        }
+    }
+    mtpl_profile* profile = NULL;
+    mtpl_trace* trace = NULL;
+    mtpl_profile* previous_profile;
+    mtpl_trace* previous_trace;
+    const bool other_thread = loop->profile != mtpl_active_profile
+        || loop->trace != mtpl_active_trace;
+    if (
+        other_thread
+        && loop->profile
+        && mtpl_profile_create(allocators, &profile) != MTPL_SUCCESS
+    ) {
+        profile = NULL;
+    }
+    if (
+        other_thread
+        && loop->trace
+        && mtpl_trace_create_thread(loop->trace, &trace) != MTPL_SUCCESS
+    ) {
+        trace = NULL;
+    }
+    if (other_thread) {
+        mtpl_profile_enter(profile, trace, &previous_profile, &previous_trace);
+    }
+    mtpl_budget* previous_budget;
+    size_t previous_depth;
+    mtpl_budget_enter(
+        loop->budget,
+        loop->depth,
+        &previous_budget,
+        &previous_depth
+    );
+    const bool was_parallel = in_parallel_loop;
+    in_parallel_loop = true;
+
+    while (!__atomic_load_n(&loop->failed, __ATOMIC_RELAXED)) {
+        const size_t i = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED);
+        if (i >= loop->count) {
+            break;
+        }
+        mtpl__iteration* iteration = &loop->iterations[i];
+        mtpl_result result = mtpl_budget_iterate();
+        if (result == MTPL_SUCCESS) {
+            result = mtpl_arena_buffer(allocators, &iteration->output);
+        }
+        if (result == MTPL_SUCCESS) {
+            iteration->arena = arena;
+            result = run_iteration(loop, i, iteration->output);
+        }
+        iteration->result = result;
+        if (result != MTPL_SUCCESS) {
+            __atomic_store_n(&loop->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+
+    in_parallel_loop = was_parallel;
+    mtpl_budget_leave(previous_budget, previous_depth);
+    if (other_thread) {
+        mtpl_profile_leave(previous_profile, previous_trace);
+    }
+    if (profile) {
+        mtpl_profile_collect(&loop->profiles, profile);
+    }
+    if (trace) {
+        mtpl_trace_collect(&loop->traces, trace);
+    }
+    if (arena) {
+        mtpl_arena_leave(previous);
+    }
+}
+
+// Hands the output of an iteration back to the arena it was taken from.
+static void release_output(
+    const mtpl_allocators* allocators,
+    const mtpl__iteration* iteration
+) {
+    if (!iteration->arena) {
+        mtpl_arena_release_buffer(allocators, iteration->output);
+        return;
+    }
+    mtpl_arena* previous = mtpl_arena_enter(iteration->arena);
+    mtpl_arena_release_buffer(allocators, iteration->output);
+    mtpl_arena_leave(previous);
+}
+
+// Returns zeroed storage for `count` iterations.
+static mtpl_result create_iterations(
+    const mtpl_allocators* allocators,
+    size_t count,
+    mtpl_buffer** out_storage
+) {
+    const size_t size = sizeof(mtpl__iteration) * count;
+    mtpl_buffer* storage;
+    mtpl_result result = mtpl_arena_buffer(allocators, &storage);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    if (storage->size < size) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            storage->data,
+            size,
+            {
+                mtpl_arena_release_buffer(allocators, storage);
+                return MTPL_ERR_MEMORY;
+            }
+        );
+        storage->size = size;
+    }
+    memset(storage->data, 0, size);
+    *out_storage = storage;
+    return MTPL_SUCCESS;
+}
+
+// Splits the list into null terminated items, recording where each starts.
+static mtpl_result split_items(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* list,
+    mtpl_buffer* items,
+    size_t** out_bounds,
+    size_t* out_count
+) {
+    size_t capacity = MTPL_INITIAL_DESCRIPTORS;
+    size_t* bounds = mtpl_allocate(allocators, sizeof(size_t) * capacity);
+    if (!bounds) {
+        return MTPL_ERR_MEMORY;
+    }
+    size_t count = 0;
+    bounds[0] = 0;
+    while (list->data[list->cursor]) {
+        mtpl_result result = mtpl_buffer_extract(';', allocators, list, items);
+        if (result != MTPL_SUCCESS) {
+            mtpl_deallocate(allocators, bounds);
+            return result;
+        }
+        // Keep the terminator, separating this item from the next one.
+        items->cursor++;
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            MTPL_REALLOC_CHECKED(
+                allocators,
+                bounds,
+                sizeof(size_t) * capacity,
+                {
+                    mtpl_deallocate(allocators, bounds);
+                    return MTPL_ERR_MEMORY;
+                }
+            );
+        }
+        bounds[++count] = items->cursor;
+    }
+    *out_bounds = bounds;
+    *out_count = count;
+    return MTPL_SUCCESS;
+}
+
+mtpl_result mtpl_generator_pfor(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    mtpl_buffer* variable;
+    mtpl_buffer* items;
+    mtpl_buffer* list;
+    mtpl_result result = mtpl_arena_buffer(allocators, &variable);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_arena_buffer(allocators, &items);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_variable;
+    }
+    result = mtpl_arena_buffer(allocators, &list);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_items;
+    }
+
+    result = mtpl_buffer_extract(0, allocators, arg, list);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_list;
+    }
+    list->cursor = 0;
+    result = mtpl_buffer_extract(0, allocators, arg, variable);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_list;
+    }
+
+    size_t* bounds;
+    size_t count;
+    result = split_items(allocators, list, items, &bounds, &count);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_list;
+    }
+    if (!count) {
+        goto cleanup_bounds;
+    }
+
+    mtpl_template body;
+    result = mtpl_template_compile_rest(allocators, generators, arg, &body);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_bounds;
+    }
+
+    mtpl_buffer* storage;
+    result = create_iterations(allocators, count, &storage);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_body;
+    }
+    mtpl__parallel_loop loop = {
+        .allocators = allocators,
+        .generators = generators,
+        .properties = properties,
+        .body = body.program,
+        .variable = variable->data,
+        .items = items->data,
+        .bounds = bounds,
+        .count = count,
+        .iterations = (mtpl__iteration*) storage->data,
+        .next = 0,
+        .failed = false,
+        .arenas = NULL,
+        .num_arenas = 0,
+        .next_arena = 0,
+        .profile = mtpl_active_profile,
+        .profiles = NULL,
+        .trace = mtpl_active_trace,
+        .traces = NULL,
+        .budget = mtpl_active_budget,
+        .depth = mtpl_budget_depth
+    };
+
+    size_t threads = in_parallel_loop ? 1 : mtpl_threads_wanted();
+    if (threads > count) {
+        threads = count;
+    }
+    // Threads other than this one, and this one as well if not rendering
+    // with an arena, are handed arenas kept by that of the render.
+    const size_t num_arenas = mtpl_arena_usable(allocators)
+        ? threads - 1
+        : threads;
+    if (num_arenas) {
+        loop.arenas = mtpl_allocate(
+            allocators,
+            sizeof(mtpl_arena*) * num_arenas
+        );
+        if (!loop.arenas) {
+            result = MTPL_ERR_MEMORY;
+            goto cleanup_iterations;
+        }
+    }
+    while (loop.num_arenas < num_arenas) {
+        if (
+            mtpl_arena_worker(allocators, &loop.arenas[loop.num_arenas])
+                != MTPL_SUCCESS
+        ) {
+            // Threads left without an arena allocate as they go.
+            break;
+        }
+        loop.num_arenas++;
+    }
+    mtpl_threads_run(
+        mtpl_threads_pool(),
+        allocators,
+        threads,
+        run_iterations,
+        &loop
+    );
+    if (loop.profiles) {
+        result = mtpl_profile_merge(loop.profile, loop.profiles);
+    }
+    if (loop.traces) {
+        const mtpl_result merged = mtpl_trace_merge(loop.trace, loop.traces);
+        if (result == MTPL_SUCCESS) {
+            result = merged;
+        }
+    }
+
+    // Pass output on in list order, up until the first failed iteration.
+    for (size_t i = 0; i < count && result == MTPL_SUCCESS; ++i) {
+        const mtpl__iteration* iteration = &loop.iterations[i];
+        result = iteration->result;
+        if (result == MTPL_SUCCESS) {
+            const mtpl_slice output = {
+                iteration->output->data,
+                iteration->output->cursor
+            };
+            result = mtpl_buffer_write(&output, allocators, out);
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (loop.iterations[i].output) {
+            release_output(allocators, &loop.iterations[i]);
+        }
+    }
+    for (size_t i = 0; i < loop.num_arenas; ++i) {
+        mtpl_arena_release_worker(allocators, loop.arenas[i]);
+    }
+
+    if (loop.arenas) {
+        mtpl_deallocate(allocators, loop.arenas);
+    }
+cleanup_iterations:
+    mtpl_arena_release_buffer(allocators, storage);
+cleanup_body:
+    mtpl_template_release(allocators, &body);
+cleanup_bounds:
+    mtpl_deallocate(allocators, bounds);
+cleanup_list:
+    mtpl_arena_release_buffer(allocators, list);
+cleanup_items:
+    mtpl_arena_release_buffer(allocators, items);
+cleanup_variable:
+    mtpl_arena_release_buffer(allocators, variable);
+    return result;
+}
@@ -1,9 +1,14 @@
 #include <mintpl/generators.h>
+#include <mintpl/number.h>
 #include <mintpl/substitute.h>
 
+#include "arena.h"
+#include "budget.h"
+#include "continuation.h"
+#include "profile.h"
+
 #include <errno.h>
 #include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,6 +16,22 @@ inline static bool is_whitespace(char c) {
     return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
+// Advances `i` by the step of the range. Returns false once it passes the end
+// of the range, or can't be represented.
+static bool range_next(const mtpl_range* range, mtpl_number* i) {
+    if (range->step.integral) {
+        if (
+            __builtin_add_overflow(i->integer, range->step.integer, &i->integer)
+        ) {
+            return false;
+        }
+    } else {
+        i->real += range->step.real;
+    }
+    const int order = mtpl_number_compare(i, &range->end);
+    return (mtpl_number_real(&range->step) > 0) ? order < 0 : order > 0;
+}
+
 mtpl_result mtpl_generator_nop(
     const mtpl_allocators* allocators,
     mtpl_buffer* arg,
@@ -66,12 +87,12 @@ mtpl_result mtpl_generator_replace(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    const mtpl_buffer value = { mtpl_htable_search(arg->data, properties) };
+    const mtpl_slice value = mtpl_htable_search_string(arg->data, properties);
     if (!value.data) {
         return MTPL_ERR_UNKNOWN_KEY;
     }
     
-    return mtpl_buffer_print(&value, allocators, out);
+    return mtpl_buffer_write(&value, allocators, out);
 }
 
 mtpl_result mtpl_generator_has_prop(
@@ -120,6 +141,7 @@ mtpl_result mtpl_generator_escape(
             break;
         }
     } while (arg->data[arg->cursor]);
+    out->data[out->cursor] = '\0';
 
     return MTPL_SUCCESS;
 }
@@ -136,11 +158,11 @@ static mtpl_result let_prop(
     mtpl_buffer* variable;
     mtpl_buffer* value;
     
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &variable);
+    result = mtpl_arena_buffer(allocators, &variable);
     if (result != MTPL_SUCCESS) {
         return result;
     }
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &value);
+    result = mtpl_arena_buffer(allocators, &value);
     if (result != MTPL_SUCCESS) {
         goto cleanup_variable;
     }
@@ -155,36 +177,50 @@ static mtpl_result let_prop(
         goto cleanup_value;
     }
 
-    result = mtpl_htable_insert(
+    const mtpl_slice slice = { value->data, value->cursor };
+    result = mtpl_htable_insert_string(
         variable->data,
-        value->data,
-        strlen(value->data) + 1,
+        &slice,
         allocators,
         properties
     );
 
 cleanup_value:
-    mtpl_buffer_free(allocators, value);
+    mtpl_arena_release_buffer(allocators, value);
 cleanup_variable:
-    mtpl_buffer_free(allocators, variable);
+    mtpl_arena_release_buffer(allocators, variable);
 
     return result;
 }
 
-static mtpl_result do_subst(
+// Continuation of `let`, rendering the value of the property into `out`
+// before setting it.
+typedef struct {
+    mtpl_continuation continuation;
+    mtpl_template body;
+    mtpl_buffer* variable;
+} mtpl__binding;
+
+static mtpl_result finish_binding(
+    mtpl_continuation* continuation,
     const mtpl_allocators* allocators,
-    mtpl_buffer* arg,
-    mtpl_hashtable* generators,
-    mtpl_hashtable* properties,
-    mtpl_buffer* out
+    mtpl_result result
 ) {
-    return mtpl_substitute(
-        &arg->data[arg->cursor],
-        allocators,
-        generators,
-        properties,
-        out
-    );
+    mtpl__binding* binding = (mtpl__binding*) continuation;
+    mtpl_buffer* value = continuation->out;
+    if (result == MTPL_SUCCESS) {
+        const mtpl_slice slice = { value->data, value->cursor };
+        result = mtpl_htable_insert_string(
+            binding->variable->data,
+            &slice,
+            allocators,
+            continuation->properties
+        );
+    }
+    mtpl_template_release(allocators, &binding->body);
+    mtpl_arena_release_buffer(allocators, value);
+    mtpl_arena_release_buffer(allocators, binding->variable);
+    return result;
 }
 
 mtpl_result mtpl_generator_let(
@@ -194,7 +230,60 @@ mtpl_result mtpl_generator_let(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return let_prop(allocators, do_subst, arg, generators, properties, out);
+    mtpl_result result;
+    mtpl_buffer* variable;
+    mtpl_buffer* value;
+    mtpl_template body;
+
+    result = mtpl_arena_buffer(allocators, &variable);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_arena_buffer(allocators, &value);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_variable;
+    }
+
+    result = mtpl_buffer_extract(0, allocators, arg, variable);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_value;
+    }
+    result = mtpl_template_compile_rest(allocators, generators, arg, &body);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_value;
+    }
+
+    mtpl_continuation* continuation;
+    result = mtpl_continuation_create(
+        allocators,
+        sizeof(mtpl__binding),
+        &continuation
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_body;
+    }
+    mtpl__binding* binding = (mtpl__binding*) continuation;
+    binding->body = body;
+    binding->variable = variable;
+    continuation->program = body.program;
+    continuation->properties = properties;
+    continuation->out = value;
+    continuation->finish = finish_binding;
+    return mtpl_continue(
+        mtpl_generator_let,
+        allocators,
+        generators,
+        continuation
+    );
+
+cleanup_body:
+    mtpl_template_release(allocators, &body);
+cleanup_value:
+    mtpl_arena_release_buffer(allocators, value);
+cleanup_variable:
+    mtpl_arena_release_buffer(allocators, variable);
+
+    return result;
 }
 
 mtpl_result mtpl_generator_macro(
@@ -214,6 +303,114 @@ mtpl_result mtpl_generator_macro(
     );
 }
 
+// Parsed form of a macro definition, cached on the property holding it. The
+// parameter names are kept as consecutive null terminated strings.
+typedef struct {
+    mtpl_hashcache header;
+    size_t num_params;
+    mtpl_buffer* params;
+    mtpl_program* body;
+} mtpl__macro;
+
+static void free_macro(
+    const mtpl_allocators* allocators,
+    mtpl_hashcache* cache
+) {
+    mtpl__macro* macro = (mtpl__macro*) cache;
+    if (macro->body) {
+        mtpl_program_free(allocators, macro->body);
+    }
+    mtpl_buffer_free(allocators, macro->params);
+    mtpl_deallocate(allocators, macro);
+}
+
+static mtpl_result compile_macro(
+    const mtpl_allocators* allocators,
+    char* definition,
+    mtpl_hashtable* generators,
+    mtpl__macro** out_macro
+) {
+    mtpl_result res;
+    mtpl_buffer* arglist;
+    mtpl__macro* macro = mtpl_allocate(allocators, sizeof(mtpl__macro));
+    if (!macro) {
+        return MTPL_ERR_MEMORY;
+    }
+    macro->header.free = free_macro;
+    macro->num_params = 0;
+    macro->body = NULL;
+    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &macro->params);
+    if (res != MTPL_SUCCESS) {
+        goto cleanup_macro;
+    }
+    res = mtpl_arena_buffer(allocators, &arglist);
+    if (res != MTPL_SUCCESS) {
+        goto cleanup_params;
+    }
+
+    mtpl_buffer def = { definition };
+    res = mtpl_buffer_extract(0, allocators, &def, arglist);
+    if (res != MTPL_SUCCESS) {
+        goto cleanup_arglist;
+    }
+    arglist->cursor = 0;
+    while (arglist->data[arglist->cursor]) {
+        res = mtpl_buffer_extract(';', allocators, arglist, macro->params);
+        if (res != MTPL_SUCCESS) {
+            goto cleanup_arglist;
+        }
+        // Keep the terminator, separating this name from the next one.
+        macro->params->cursor++;
+        macro->num_params++;
+    }
+
+    res = mtpl_compile(
+        &def.data[def.cursor],
+        allocators,
+        generators,
+        &macro->body
+    );
+    if (res != MTPL_SUCCESS) {
+        goto cleanup_arglist;
+    }
+    mtpl_arena_release_buffer(allocators, arglist);
+    *out_macro = macro;
+    return MTPL_SUCCESS;
+
+cleanup_arglist:
+    mtpl_arena_release_buffer(allocators, arglist);
+cleanup_params:
+    mtpl_buffer_free(allocators, macro->params);
+cleanup_macro:
+    mtpl_deallocate(allocators, macro);
+    return res;
+}
+
+// Continuation of a macro expansion, running the body of the macro with its
+// parameters bound in `scope`.
+typedef struct {
+    mtpl_continuation continuation;
+    mtpl_buffer* name;
+    mtpl_hashtable* scope;
+    mtpl_profile_frame expansion;
+} mtpl__expansion;
+
+static mtpl_result finish_expansion(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_result result
+) {
+    mtpl__expansion* expansion = (mtpl__expansion*) continuation;
+    result = mtpl_profile_end(
+        &expansion->expansion,
+        continuation->out,
+        result
+    );
+    mtpl_arena_release_scope(allocators, expansion->scope);
+    mtpl_arena_release_buffer(allocators, expansion->name);
+    return result;
+}
+
 mtpl_result mtpl_generator_expand(
     const mtpl_allocators* allocators,
     mtpl_buffer* arg,
@@ -223,102 +420,186 @@ mtpl_result mtpl_generator_expand(
 ) {
     mtpl_result res;
     mtpl_buffer* name;
-    mtpl_buffer* arglist;
-    mtpl_buffer* body;
-    mtpl_buffer* param;
     mtpl_buffer* value;
     
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &name);
-    if (res!= MTPL_SUCCESS) {
-        return res;
-    }
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &arglist);
-    if (res!= MTPL_SUCCESS) {
-        goto cleanup_name;
-    }
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &body);
+    res = mtpl_arena_buffer(allocators, &name);
     if (res != MTPL_SUCCESS) {
-        goto cleanup_arglist;
-    }
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &param);
-    if (res != MTPL_SUCCESS) {
-        goto cleanup_body;
+        return res;
     }
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &value);
+    res = mtpl_arena_buffer(allocators, &value);
     if (res != MTPL_SUCCESS) {
-        goto cleanup_param;
+        goto cleanup_name;
     }
 
     res = mtpl_buffer_extract(0, allocators, arg, name);
     if (res != MTPL_SUCCESS) {
         goto cleanup_value;
     }
-    mtpl_buffer def = { mtpl_htable_search(name->data, properties) };
-    if (!def.data) {
+    mtpl_hashentry* def = mtpl_htable_lookup(name->data, properties);
+    if (!def) {
         goto cleanup_value;
     }
 
-    res = mtpl_buffer_extract(0, allocators, &def, arglist);
-    if (res != MTPL_SUCCESS) {
-        goto cleanup_value;
+    // Parse the definition on first expansion, and keep it around until the
+    // property is redefined.
+    mtpl__macro* macro = (mtpl__macro*) mtpl_htable_find_cache(
+        def,
+        free_macro
+    );
+    if (!macro) {
+        res = compile_macro(allocators, def->data, generators, &macro);
+        if (res != MTPL_SUCCESS) {
+            goto cleanup_value;
+        }
+        macro = (mtpl__macro*) mtpl_htable_attach_cache(
+            def,
+            &macro->header,
+            allocators
+        );
     }
     
-    mtpl_hashtable* scope = NULL;
-    res = mtpl_htable_create(allocators, &scope);
+    mtpl_hashtable* scope;
+    res = mtpl_arena_scope(allocators, properties, &scope);
     if (res != MTPL_SUCCESS) {
         goto cleanup_value;
     }
-    scope->next = properties;
-    arglist->cursor = 0;
-    while (arglist->data[arglist->cursor]) {
-        res = mtpl_buffer_extract(';', allocators, arglist, param);
-        if (res != MTPL_SUCCESS) {
-            goto cleanup_scope;
-        }
+    const char* param = macro->params->data;
+    size_t arg_length = 0;
+    for (size_t i = 0; i < macro->num_params; ++i) {
+        value->cursor = 0;
         res = mtpl_buffer_extract(0, allocators, arg, value);
         if (res != MTPL_SUCCESS) {
             goto cleanup_scope;
         }
-        size_t len = strlen(value->data) + 1;
-        res = mtpl_htable_insert(
-           param->data,
-           value->data,
-           len,
-           allocators,
-           scope
-        );
-        param->cursor = 0;
-        value->cursor = 0;
+        const mtpl_slice binding = { value->data, value->cursor };
+        res = mtpl_htable_insert_string(param, &binding, allocators, scope);
         if (res != MTPL_SUCCESS) {
             goto cleanup_scope;
         }
+        param += strlen(param) + 1;
+        arg_length += value->cursor;
     }
 
-    res = mtpl_substitute(
-        &def.data[def.cursor],
+    mtpl_continuation* continuation;
+    res = mtpl_continuation_create(
         allocators,
-        generators,
-        scope,
+        sizeof(mtpl__expansion),
+        &continuation
+    );
+    if (res != MTPL_SUCCESS) {
+        goto cleanup_scope;
+    }
+    mtpl_arena_release_buffer(allocators, value);
+    mtpl__expansion* expansion = (mtpl__expansion*) continuation;
+    expansion->name = name;
+    expansion->scope = scope;
+    continuation->program = macro->body;
+    continuation->properties = scope;
+    continuation->out = out;
+    continuation->finish = finish_expansion;
+
+    // Profile each macro on its own, as a generator of its own would be.
+    mtpl_profile_begin(
+        &expansion->expansion,
+        "**> ",
+        name->data,
+        MTPL_NO_SOURCE,
+        arg_length,
         out
     );
-    scope->next = NULL;
+    return mtpl_continue(
+        mtpl_generator_expand,
+        allocators,
+        generators,
+        continuation
+    );
 
 cleanup_scope:
-    mtpl_htable_free(allocators, scope);
+    mtpl_arena_release_scope(allocators, scope);
 cleanup_value:
-    mtpl_buffer_free(allocators, value);
-cleanup_param:
-    mtpl_buffer_free(allocators, param);
-cleanup_body:
-    mtpl_buffer_free(allocators, body);
-cleanup_arglist:
-    mtpl_buffer_free(allocators, arglist);
+    mtpl_arena_release_buffer(allocators, value);
 cleanup_name:
-    mtpl_buffer_free(allocators, name);
+    mtpl_arena_release_buffer(allocators, name);
 
     return res;
 }
 
+// Continuation of a loop, running its body with the variable bound to each
+// item of `list` in turn, or to each number of `range` if there is no list.
+typedef struct {
+    mtpl_continuation continuation;
+    mtpl_template body;
+    mtpl_buffer* variable;
+    mtpl_buffer* list;
+    mtpl_buffer* item;
+    mtpl_range range;
+    mtpl_number number;
+    bool started;
+} mtpl__loop;
+
+static mtpl_result resume_loop(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators
+) {
+    mtpl__loop* loop = (mtpl__loop*) continuation;
+    if (loop->list) {
+        if (!loop->list->data[loop->list->cursor]) {
+            return MTPL_SUCCESS;
+        }
+    } else if (loop->started && !range_next(&loop->range, &loop->number)) {
+        return MTPL_SUCCESS;
+    }
+    loop->started = true;
+    mtpl_result result = mtpl_budget_iterate();
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+
+    char num_data[MTPL_NUMBER_MAXLEN + 1];
+    mtpl_slice binding;
+    if (loop->list) {
+        loop->item->cursor = 0;
+        result = mtpl_buffer_extract(';', allocators, loop->list, loop->item);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+        binding = (mtpl_slice) { loop->item->data, loop->item->cursor };
+    } else {
+        binding = (mtpl_slice) {
+            num_data,
+            mtpl_number_format(&loop->number, num_data)
+        };
+    }
+    result = mtpl_htable_insert_string(
+        loop->variable->data,
+        &binding,
+        allocators,
+        continuation->properties
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    continuation->program = loop->body.program;
+    return MTPL_SUCCESS;
+}
+
+static mtpl_result finish_loop(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_result result
+) {
+    mtpl__loop* loop = (mtpl__loop*) continuation;
+    mtpl_template_release(allocators, &loop->body);
+    mtpl_arena_release_scope(allocators, continuation->properties);
+    if (loop->list) {
+        mtpl_arena_release_buffer(allocators, loop->list);
+        mtpl_arena_release_buffer(allocators, loop->item);
+    }
+    mtpl_arena_release_buffer(allocators, loop->variable);
+    return result;
+}
+
 mtpl_result mtpl_generator_for(
     const mtpl_allocators* allocators,
     mtpl_buffer* arg,
@@ -329,19 +610,15 @@ mtpl_result mtpl_generator_for(
     mtpl_buffer* variable;
     mtpl_buffer* item;
     mtpl_buffer* list;
-    mtpl_result result = mtpl_buffer_create(
-        allocators,
-        MTPL_DEFAULT_BUFSIZE,
-        &variable
-    );
+    mtpl_result result = mtpl_arena_buffer(allocators, &variable);
     if (result != MTPL_SUCCESS) {
         return result;
     }
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &item);
+    result = mtpl_arena_buffer(allocators, &item);
     if (result != MTPL_SUCCESS) {
         goto cleanup_variable;
     }
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &list);
+    result = mtpl_arena_buffer(allocators, &list);
     if (result != MTPL_SUCCESS) {
         goto cleanup_item;
     }
@@ -356,51 +633,138 @@ mtpl_result mtpl_generator_for(
         goto cleanup_list;
     }
     variable->cursor = 0;
+    // The body is only compiled if there are items to run it for.
+    if (!list->data[0]) {
+        goto cleanup_list;
+    }
 
-    mtpl_hashtable* scope = NULL;
-    result = mtpl_htable_create(allocators, &scope);
+    mtpl_hashtable* scope;
+    result = mtpl_arena_scope(allocators, properties, &scope);
     if (result != MTPL_SUCCESS) {
         goto cleanup_list;
     }
-    scope->next = properties;
-    while (list->data[list->cursor]) {
-        result = mtpl_buffer_extract(';', allocators, list, item);
-        if (result != MTPL_SUCCESS) {
-            break;
-        }
-        size_t len = strlen(item->data) + 1;
-        result = mtpl_htable_insert(
-           variable->data,
-           item->data,
-           len,
-           allocators,
-           scope
-        );
-        item->cursor = 0;
-        if (result != MTPL_SUCCESS) {
-            break;
-        }
+    mtpl_template body;
+    result = mtpl_template_compile_rest(allocators, generators, arg, &body);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_scope;
+    }
 
-        result = mtpl_substitute(
-            &arg->data[arg->cursor],
-            allocators,
-            generators,
-            scope,
-            out
-        );
-        if (result != MTPL_SUCCESS) {
-            break;
-        }
+    mtpl_continuation* continuation;
+    result = mtpl_continuation_create(
+        allocators,
+        sizeof(mtpl__loop),
+        &continuation
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_body;
     }
-    scope->next = NULL;
+    mtpl__loop* loop = (mtpl__loop*) continuation;
+    loop->body = body;
+    loop->variable = variable;
+    loop->list = list;
+    loop->item = item;
+    continuation->properties = scope;
+    continuation->out = out;
+    continuation->resume = resume_loop;
+    continuation->finish = finish_loop;
+    return mtpl_continue(
+        mtpl_generator_for,
+        allocators,
+        generators,
+        continuation
+    );
 
-    mtpl_htable_free(allocators, scope);
+cleanup_body:
+    mtpl_template_release(allocators, &body);
+cleanup_scope:
+    mtpl_arena_release_scope(allocators, scope);
 cleanup_list:
-    mtpl_buffer_free(allocators, list);
+    mtpl_arena_release_buffer(allocators, list);
 cleanup_item:
-    mtpl_buffer_free(allocators, item);
+    mtpl_arena_release_buffer(allocators, item);
 cleanup_variable:
-    mtpl_buffer_free(allocators, variable);
+    mtpl_arena_release_buffer(allocators, variable);
+    return result;
+}
+
+mtpl_result mtpl_generator_for_range(
+    const mtpl_allocators* allocators,
+    const mtpl_range* range,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    mtpl_buffer* variable;
+    mtpl_result result = mtpl_arena_buffer(allocators, &variable);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_buffer_extract(0, allocators, arg, variable);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_variable;
+    }
+
+    mtpl_hashtable* scope;
+    result = mtpl_arena_scope(allocators, properties, &scope);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_variable;
+    }
+    mtpl_template body;
+    result = mtpl_template_compile_rest(allocators, generators, arg, &body);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_scope;
+    }
+
+    mtpl_continuation* continuation;
+    result = mtpl_continuation_create(
+        allocators,
+        sizeof(mtpl__loop),
+        &continuation
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_body;
+    }
+    // Like the range generator, the start value is always included.
+    mtpl__loop* loop = (mtpl__loop*) continuation;
+    loop->body = body;
+    loop->variable = variable;
+    loop->range = *range;
+    loop->number = range->start;
+    continuation->properties = scope;
+    continuation->out = out;
+    continuation->resume = resume_loop;
+    continuation->finish = finish_loop;
+    return mtpl_continue(
+        mtpl_generator_for,
+        allocators,
+        generators,
+        continuation
+    );
+
+cleanup_body:
+    mtpl_template_release(allocators, &body);
+cleanup_scope:
+    mtpl_arena_release_scope(allocators, scope);
+cleanup_variable:
+    mtpl_arena_release_buffer(allocators, variable);
+    return result;
+}
+
+// Continuation running a single template compiled by the generator, such as
+// the branch taken by `if`.
+typedef struct {
+    mtpl_continuation continuation;
+    mtpl_template body;
+} mtpl__template;
+
+static mtpl_result finish_template(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_result result
+) {
+    mtpl__template* branch = (mtpl__template*) continuation;
+    mtpl_template_release(allocators, &branch->body);
     return result;
 }
 
@@ -416,44 +780,50 @@ mtpl_result mtpl_generator_if(
         return MTPL_ERR_SYNTAX;
     }
 
-    mtpl_buffer* expr;
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &expr);
-    if (res != MTPL_SUCCESS) {
-        return res;
-    }
     arg->cursor = 3;
-    res = mtpl_buffer_extract_sub(allocators, true, arg, expr);
-    if (res != MTPL_SUCCESS) {
-        goto cleanup;
-    }
-
+    mtpl_template body;
     switch (arg->data[1]) {
     case 't':
+        res = mtpl_template_extract(allocators, generators, arg, &body);
         break;
     case 'f':
-        expr->cursor = 0;
-        res = mtpl_buffer_extract_sub(allocators, true, arg, expr);
+        res = mtpl_template_extract(allocators, generators, arg, NULL);
         if (res != MTPL_SUCCESS) {
-            res = MTPL_SUCCESS;
-            goto cleanup;
+            return res;
+        }
+        res = mtpl_template_extract(allocators, generators, arg, &body);
+        if (res == MTPL_ERR_SYNTAX) {
+            return MTPL_SUCCESS;
         }
         break;
     default:
-        res = MTPL_ERR_SYNTAX;
-        goto cleanup;
+        return MTPL_ERR_SYNTAX;
     }
-    res = mtpl_substitute(
-        expr->data,
+    if (res != MTPL_SUCCESS) {
+        return res;
+    }
+
+    mtpl_continuation* continuation;
+    res = mtpl_continuation_create(
+        allocators,
+        sizeof(mtpl__template),
+        &continuation
+    );
+    if (res != MTPL_SUCCESS) {
+        mtpl_template_release(allocators, &body);
+        return res;
+    }
+    ((mtpl__template*) continuation)->body = body;
+    continuation->program = body.program;
+    continuation->properties = properties;
+    continuation->out = out;
+    continuation->finish = finish_template;
+    return mtpl_continue(
+        mtpl_generator_if,
         allocators,
         generators,
-        properties,
-        out
+        continuation
     );
-
-cleanup:
-    mtpl_buffer_free(allocators, expr);
-
-    return res;
 }
 
 mtpl_result mtpl_generator_not(
@@ -467,34 +837,72 @@ mtpl_result mtpl_generator_not(
         return MTPL_ERR_SYNTAX;
     }
 
-    if (out->size < 2) {
-        MTPL_REALLOC_CHECKED(
-            allocators,
-            out->data,
-            2,
-            return MTPL_ERR_MEMORY
-        );
-        out->size = 2;
-    }
-
+    mtpl_buffer state;
     switch (arg->data[1]) {
     case 't':
-        out->data[1] = 'f';
+        state.data = "#f";
         break;
     case 'f':
-        out->data[1] = 't';
+        state.data = "#t";
         break;
     default:
         return MTPL_ERR_SYNTAX;
     }
+    state.cursor = 0;
 
-    out->data[0] = '#';
-    out->data[2] = '\0';
+    return mtpl_buffer_nprint(&state, allocators, out, 2);
+}
 
+// Continuation of a comparison, rendering each of its operands into
+// `values` in turn, before comparing them.
+typedef struct {
+    mtpl_continuation continuation;
+    bool(*compare)(const mtpl_buffer* a, const mtpl_buffer* b);
+    mtpl_template operands[2];
+    mtpl_buffer* values[2];
+    size_t next;
+    mtpl_buffer* out;
+} mtpl__comparison;
+
+static mtpl_result resume_comparison(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators
+) {
+    mtpl__comparison* comparison = (mtpl__comparison*) continuation;
+    if (comparison->next == 2) {
+        return MTPL_SUCCESS;
+    }
+    const size_t i = comparison->next++;
+    continuation->program = comparison->operands[i].program;
+    continuation->out = comparison->values[i];
     return MTPL_SUCCESS;
 }
 
+static mtpl_result finish_comparison(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_result result
+) {
+    mtpl__comparison* comparison = (mtpl__comparison*) continuation;
+    if (result == MTPL_SUCCESS) {
+        mtpl_buffer** values = comparison->values;
+        values[0]->data[values[0]->cursor] = '\0';
+        values[1]->data[values[1]->cursor] = '\0';
+        mtpl_buffer state = {
+            comparison->compare(values[0], values[1]) ? "#t" : "#f"
+        };
+        result = mtpl_buffer_print(&state, allocators, comparison->out);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        mtpl_template_release(allocators, &comparison->operands[i]);
+        mtpl_arena_release_buffer(allocators, comparison->values[i]);
+    }
+    return result;
+}
+
 static mtpl_result generator_cmp(
+    mtpl_generator generator,
     const mtpl_allocators* allocators,
     bool(*compare)(const mtpl_buffer* a, const mtpl_buffer* b),
     mtpl_buffer* arg,
@@ -503,84 +911,109 @@ static mtpl_result generator_cmp(
     mtpl_buffer* out
 ) {
     mtpl_result result;
-    mtpl_buffer state = { "#f" };
-    mtpl_buffer* sub;
-    mtpl_buffer* sub_gen[2];
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &sub);
+    mtpl_buffer* values[2];
+    mtpl_template operands[2];
+    size_t compiled = 0;
+    result = mtpl_arena_buffer(allocators, &values[0]);
     if (result != MTPL_SUCCESS) {
         return result;
     }
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &sub_gen[0]);
-    if (result != MTPL_SUCCESS) {
-        goto cleanup_sub;
-    }
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &sub_gen[1]);
+    result = mtpl_arena_buffer(allocators, &values[1]);
     if (result != MTPL_SUCCESS) {
-        goto cleanup_sub_gen_0;
+        goto cleanup_values_0;
     }
-    
-    result = mtpl_buffer_extract_sub(allocators, true, arg, sub);
-    if (result != MTPL_SUCCESS) {
-        goto cleanup_sub_gen_1;
+
+    for (; compiled < 2; ++compiled) {
+        result = mtpl_template_extract(
+            allocators,
+            generators,
+            arg,
+            &operands[compiled]
+        );
+        if (result != MTPL_SUCCESS) {
+            goto cleanup_operands;
+        }
     }
-    result = mtpl_substitute(
-        sub->data,
+
+    mtpl_continuation* continuation;
+    result = mtpl_continuation_create(
         allocators,
-        generators,
-        properties,
-        sub_gen[0]
+        sizeof(mtpl__comparison),
+        &continuation
     );
     if (result != MTPL_SUCCESS) {
-        goto cleanup_sub_gen_1;
+        goto cleanup_operands;
     }
-    sub_gen[0]->data[sub_gen[0]->cursor] = '\0';
-    sub->cursor = 0;
-    result = mtpl_buffer_extract_sub(allocators, true, arg, sub);
-    if (result != MTPL_SUCCESS) {
-        goto cleanup_sub_gen_1;
+    mtpl__comparison* comparison = (mtpl__comparison*) continuation;
+    comparison->compare = compare;
+    for (size_t i = 0; i < 2; ++i) {
+        comparison->operands[i] = operands[i];
+        comparison->values[i] = values[i];
     }
-    result = mtpl_substitute(
-        sub->data,
-        allocators,
-        generators,
-        properties,
-        sub_gen[1]
-    );
-    if (result != MTPL_SUCCESS) {
-        goto cleanup_sub_gen_1;
+    comparison->out = out;
+    continuation->properties = properties;
+    continuation->resume = resume_comparison;
+    continuation->finish = finish_comparison;
+    return mtpl_continue(generator, allocators, generators, continuation);
+
+cleanup_operands:
+    for (size_t i = 0; i < compiled; ++i) {
+        mtpl_template_release(allocators, &operands[i]);
     }
-    sub_gen[1]->data[sub_gen[1]->cursor] = '\0';
+    mtpl_arena_release_buffer(allocators, values[1]);
+cleanup_values_0:
+    mtpl_arena_release_buffer(allocators, values[0]);
+    return result;
+}
 
-    state.data = compare(sub_gen[0], sub_gen[1]) ? "#t" : "#f";
-    result = mtpl_buffer_print(&state, allocators, out);
+static bool parse_whole_number(const mtpl_buffer* buffer, mtpl_number* out) {
+    const size_t length = mtpl_number_parse(buffer->data, out);
+    if (!length) {
+        return false;
+    }
+    for (size_t i = length; i < buffer->cursor; ++i) {
+        if (!is_whitespace(buffer->data[i])) {
+            return false;
+        }
+    }
+    return length <= buffer->cursor;
+}
 
-cleanup_sub_gen_1:
-    mtpl_buffer_free(allocators, sub_gen[1]);
-cleanup_sub_gen_0:
-    mtpl_buffer_free(allocators, sub_gen[0]);
-cleanup_sub:
-    mtpl_buffer_free(allocators, sub);
-    return result;
+// Orders buffers numerically if both hold numbers, and otherwise by their
+// contents up until their cursors.
+static int compare_buffers(const mtpl_buffer* a, const mtpl_buffer* b) {
+    mtpl_number x;
+    mtpl_number y;
+    if (parse_whole_number(a, &x) && parse_whole_number(b, &y)) {
+        return mtpl_number_compare(&x, &y);
+    }
+
+    const size_t len = a->cursor < b->cursor ? a->cursor : b->cursor;
+    const int order = memcmp(a->data, b->data, len);
+    if (order || a->cursor == b->cursor) {
+        return order;
+    }
+    return a->cursor < b->cursor ? -1 : 1;
 }
 
 static bool equals(const mtpl_buffer* a, const mtpl_buffer* b) {
-    return strcmp(a->data, b->data) == 0;
+    return a->cursor == b->cursor && memcmp(a->data, b->data, a->cursor) == 0;
 }
 
 static bool greater(const mtpl_buffer* a, const mtpl_buffer* b) {
-    return strcmp(a->data, b->data) > 0;
+    return compare_buffers(a, b) > 0;
 }
 
 static bool less(const mtpl_buffer* a, const mtpl_buffer* b) {
-    return strcmp(a->data, b->data) < 0;
+    return compare_buffers(a, b) < 0;
 }
 
 static bool gteq(const mtpl_buffer* a, const mtpl_buffer* b) {
-    return strcmp(a->data, b->data) >= 0;
+    return compare_buffers(a, b) >= 0;
 }
 
 static bool lteq(const mtpl_buffer* a, const mtpl_buffer* b) {
-    return strcmp(a->data, b->data) <= 0;
+    return compare_buffers(a, b) <= 0;
 }
 
 mtpl_result mtpl_generator_equals(
@@ -590,7 +1023,15 @@ mtpl_result mtpl_generator_equals(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return generator_cmp(allocators, equals, arg, generators, properties, out); 
+    return generator_cmp(
+        mtpl_generator_equals,
+        allocators,
+        equals,
+        arg,
+        generators,
+        properties,
+        out
+    );
 }
 
 mtpl_result mtpl_generator_greater(
@@ -600,7 +1041,15 @@ mtpl_result mtpl_generator_greater(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return generator_cmp(allocators, greater, arg, generators, properties, out); 
+    return generator_cmp(
+        mtpl_generator_greater,
+        allocators,
+        greater,
+        arg,
+        generators,
+        properties,
+        out
+    );
 }
 
 mtpl_result mtpl_generator_less(
@@ -610,7 +1059,15 @@ mtpl_result mtpl_generator_less(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return generator_cmp(allocators, less, arg, generators, properties, out); 
+    return generator_cmp(
+        mtpl_generator_less,
+        allocators,
+        less,
+        arg,
+        generators,
+        properties,
+        out
+    );
 }
 
 mtpl_result mtpl_generator_gteq(
@@ -620,7 +1077,15 @@ mtpl_result mtpl_generator_gteq(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return generator_cmp(allocators, gteq, arg, generators, properties, out); 
+    return generator_cmp(
+        mtpl_generator_gteq,
+        allocators,
+        gteq,
+        arg,
+        generators,
+        properties,
+        out
+    );
 }
 
 mtpl_result mtpl_generator_lteq(
@@ -630,7 +1095,15 @@ mtpl_result mtpl_generator_lteq(
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    return generator_cmp(allocators, lteq, arg, generators, properties, out); 
+    return generator_cmp(
+        mtpl_generator_lteq,
+        allocators,
+        lteq,
+        arg,
+        generators,
+        properties,
+        out
+    );
 }
 
 static mtpl_result gen_strcmp(
@@ -643,7 +1116,7 @@ static mtpl_result gen_strcmp(
 ) {
     mtpl_result res;
     mtpl_buffer* comparand;
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &comparand);
+    res = mtpl_arena_buffer(allocators, &comparand);
     if (res != MTPL_SUCCESS) {
         return res;
     }
@@ -663,17 +1136,17 @@ static mtpl_result gen_strcmp(
     out->cursor += 2;
 
 cleanup:
-    mtpl_buffer_free(allocators, comparand);
+    mtpl_arena_release_buffer(allocators, comparand);
 
     return res;
 }
 
 static bool startsw(const mtpl_buffer* a, const char* b) {
-    return strncmp(a->data, b, strlen(a->data)) == 0;
+    return strncmp(a->data, b, a->cursor) == 0;
 }
 
 static bool endsw(const mtpl_buffer* a, const char* b) {
-    const size_t alen = strlen(a->data);
+    const size_t alen = a->cursor;
     const size_t blen = strlen(b);
     if (blen < alen) {
         return false;
@@ -715,46 +1188,175 @@ mtpl_result mtpl_generator_contains(
     return gen_strcmp(allocators, contains, arg, generators, properties, out);
 }
 
-mtpl_result mtpl_generator_range(
+// Offsets of the elements of a `;` separated list, cached on the property
+// holding the list. Element `i` spans from `bounds[i]` up until the separator
+// preceding `bounds[i + 1]`.
+//
+// The offsets are only used for plain lists, which are not empty and have no
+// whitespace or escapes. Those are handled as the generators taking the list as text do,
+// which tell elements apart only after having removed escapes, and stop at
+// the first whitespace.
+typedef struct {
+    mtpl_hashcache header;
+    size_t count;
+    size_t* bounds;
+    bool plain;
+} mtpl__list;
+
+static void free_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashcache* cache
+) {
+    mtpl__list* list = (mtpl__list*) cache;
+    mtpl_deallocate(allocators, list->bounds);
+    mtpl_deallocate(allocators, list);
+}
+
+// Returns the index of a list property, indexing it on first use.
+static mtpl_result index_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* entry,
+    const mtpl__list** out_list
+) {
+    mtpl__list* list = (mtpl__list*) mtpl_htable_find_cache(entry, free_list);
+    if (list) {
+        *out_list = list;
+        return MTPL_SUCCESS;
+    }
+
+    const mtpl_slice value = mtpl_htable_entry_string(entry);
+    const char* data = value.data;
+    const size_t length = value.length;
+    size_t count = length ? 1 : 0;
+    bool plain = length > 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == ';') {
+            count++;
+        } else if (data[i] == '\\' || !data[i] || is_whitespace(data[i])) {
+            plain = false;
+        }
+    }
+
+    list = mtpl_allocate(allocators, sizeof(mtpl__list));
+    if (!list) {
+        return MTPL_ERR_MEMORY;
+    }
+    list->header.free = free_list;
+    list->count = count;
+    list->plain = plain;
+    list->bounds = mtpl_allocate(allocators, sizeof(size_t) * (count + 1));
+    if (!list->bounds) {
+        mtpl_deallocate(allocators, list);
+        return MTPL_ERR_MEMORY;
+    }
+    size_t element = 0;
+    list->bounds[element++] = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == ';') {
+            list->bounds[element++] = i + 1;
+        }
+    }
+    // The end of the list stands in for a final separator.
+    list->bounds[count] = length + 1;
+
+    *out_list = (mtpl__list*) mtpl_htable_attach_cache(
+        entry,
+        &list->header,
+        allocators
+    );
+    return MTPL_SUCCESS;
+}
+
+// Calls `generator` with the value of `list` followed by `arg`, as it would
+// have been called if not for the list variant.
+static mtpl_result call_with_list_text(
+    mtpl_generator generator,
     const mtpl_allocators* allocators,
+    const mtpl_hashentry* list,
     mtpl_buffer* arg,
     mtpl_hashtable* generators,
     mtpl_hashtable* properties,
     mtpl_buffer* out
 ) {
-    errno = 0;
-    char* start_cursor;
-    char* end_cursor;
-    char* step_cursor;
-    double start = strtod(arg->data, &start_cursor);
-    if (arg->data == start_cursor || errno) {
-        return MTPL_ERR_SYNTAX;
+    mtpl_buffer* text;
+    mtpl_result res = mtpl_arena_buffer(allocators, &text);
+    if (res != MTPL_SUCCESS) {
+        return res;
     }
-    double end = strtod(start_cursor, &end_cursor);
-    if (start_cursor == end_cursor || errno) {
-        return MTPL_ERR_SYNTAX;
+    const mtpl_slice value = mtpl_htable_entry_string(list);
+    res = mtpl_buffer_write(&value, allocators, text);
+    if (res == MTPL_SUCCESS) {
+        res = mtpl_buffer_print(arg, allocators, text);
     }
-    double step = 1;
-    if (*end_cursor) {
-        step = strtod(end_cursor, &step_cursor);
-        if (end_cursor == step_cursor || errno) {
-            return MTPL_ERR_SYNTAX;
+    if (res == MTPL_SUCCESS) {
+        text->cursor = 0;
+        res = generator(allocators, text, generators, properties, out);
+    }
+    mtpl_arena_release_buffer(allocators, text);
+    return res;
+}
+
+mtpl_result mtpl_range_parse(const char* text, mtpl_range* out_range) {
+    mtpl_number* numbers[] = {
+        &out_range->start,
+        &out_range->end,
+        &out_range->step
+    };
+    out_range->step = (mtpl_number) { .integer = 1, .integral = true };
+    for (size_t i = 0; i < 3; ++i) {
+        // The step is optional.
+        if (i == 2 && !*text) {
+            break;
         }
-        if (!step) {
+        const size_t length = mtpl_number_parse(text, numbers[i]);
+        if (!length) {
             return MTPL_ERR_SYNTAX;
         }
+        text += length;
+    }
+    if (!mtpl_number_real(&out_range->step)) {
+        return MTPL_ERR_SYNTAX;
+    }
+
+    // Count using doubles unless every number is an integer.
+    if (
+        !out_range->start.integral
+        || !out_range->end.integral
+        || !out_range->step.integral
+    ) {
+        for (size_t i = 0; i < 3; ++i) {
+            numbers[i]->real = mtpl_number_real(numbers[i]);
+            numbers[i]->integral = false;
+        }
+    }
+    return MTPL_SUCCESS;
+}
+
+mtpl_result mtpl_generator_range(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    mtpl_range range;
+    mtpl_result res = mtpl_range_parse(arg->data, &range);
+    if (res != MTPL_SUCCESS) {
+        return res;
     }
 
-    char num_data[32] = { 0 };
-    mtpl_buffer num = { num_data };
-    snprintf(num_data, 32, "%g", start);
-    mtpl_result res = mtpl_buffer_print(&num, allocators, out);
+    char num_data[MTPL_NUMBER_MAXLEN + 2];
+    mtpl_slice num = { num_data };
+    mtpl_number i = range.start;
+    num.length = mtpl_number_format(&i, num_data);
+    res = mtpl_buffer_write(&num, allocators, out);
     if (res != MTPL_SUCCESS) {
         return res;
     }
-    for (double i = start + step; (step > 0) ? i < end : i > end; i += step) {
-        snprintf(num_data, 32, ";%g", i);
-        mtpl_buffer_print(&num, allocators, out);
+    num_data[0] = ';';
+    while (range_next(&range, &i)) {
+        num.length = mtpl_number_format(&i, &num_data[1]) + 1;
+        res = mtpl_buffer_write(&num, allocators, out);
         if (res != MTPL_SUCCESS) {
             return res;
         }
@@ -763,6 +1365,17 @@ mtpl_result mtpl_generator_range(
     return MTPL_SUCCESS;
 }
 
+static mtpl_result write_count(
+    size_t count,
+    const mtpl_allocators* allocators,
+    mtpl_buffer* out
+) {
+    char num_data[MTPL_NUMBER_MAXLEN + 1];
+    const mtpl_number number = { .integer = count, .integral = true };
+    const mtpl_slice num = { num_data, mtpl_number_format(&number, num_data) };
+    return mtpl_buffer_write(&num, allocators, out);
+}
+
 mtpl_result mtpl_generator_len(
     const mtpl_allocators* allocators,
     mtpl_buffer* arg,
@@ -783,10 +1396,7 @@ mtpl_result mtpl_generator_len(
         }
     }
     
-    char num_data[32] = { 0 };
-    mtpl_buffer num = { num_data };
-    snprintf(num_data, 32, "%ld", count);
-    return mtpl_buffer_print(&num, allocators, out);
+    return write_count(count, allocators, out);
 }
 
 mtpl_result mtpl_generator_element(
@@ -799,11 +1409,11 @@ mtpl_result mtpl_generator_element(
     mtpl_result res; 
     mtpl_buffer* list;
     mtpl_buffer* value;
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &list);
+    res = mtpl_arena_buffer(allocators, &list);
     if (res != MTPL_SUCCESS) {
         return res;
     }
-    res = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &value);
+    res = mtpl_arena_buffer(allocators, &value);
     if (res != MTPL_SUCCESS) {
         goto cleanup_list;
     }
@@ -813,6 +1423,7 @@ mtpl_result mtpl_generator_element(
         goto cleanup_value;
     }
 
+    errno = 0;
     char* index_cursor;
     size_t index = strtol(&arg->data[arg->cursor], &index_cursor, 10);
     if (&arg->data[arg->cursor] == index_cursor || errno) {
@@ -841,15 +1452,101 @@ mtpl_result mtpl_generator_element(
     if (res != MTPL_SUCCESS) {
         goto cleanup_value;
     }
-    value->cursor = 0;
-
-    res = mtpl_buffer_print(value, allocators, out);
+    const mtpl_slice element = { value->data, value->cursor };
+    res = mtpl_buffer_write(&element, allocators, out);
 
 cleanup_value:
-    mtpl_buffer_free(allocators, value);
+    mtpl_arena_release_buffer(allocators, value);
 cleanup_list:
-    mtpl_buffer_free(allocators, list);
+    mtpl_arena_release_buffer(allocators, list);
 
     return res;
 }
 
+
+mtpl_result mtpl_generator_len_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* list,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    const mtpl__list* index;
+    mtpl_result res = index_list(allocators, list, &index);
+    if (res != MTPL_SUCCESS) {
+        return res;
+    }
+    if (!index->plain || arg->data[arg->cursor]) {
+        return call_with_list_text(
+            mtpl_generator_len,
+            allocators,
+            list,
+            arg,
+            generators,
+            properties,
+            out
+        );
+    }
+
+    return write_count(index->count, allocators, out);
+}
+
+mtpl_result mtpl_generator_element_list(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* list,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    const mtpl__list* index;
+    mtpl_result res = index_list(allocators, list, &index);
+    if (res != MTPL_SUCCESS) {
+        return res;
+    }
+    if (!index->plain) {
+        return call_with_list_text(
+            mtpl_generator_element,
+            allocators,
+            list,
+            arg,
+            generators,
+            properties,
+            out
+        );
+    }
+
+    errno = 0;
+    char* index_cursor;
+    const size_t element = strtol(&arg->data[arg->cursor], &index_cursor, 10);
+    if (&arg->data[arg->cursor] == index_cursor || errno) {
+        return MTPL_ERR_SYNTAX;
+    }
+    const size_t length = mtpl_htable_entry_string(list).length;
+    if (element >= index->count || index->bounds[element] >= length) {
+        return MTPL_ERR_UNKNOWN_KEY;
+    }
+
+    const mtpl_slice text = {
+        &((const char*) list->data)[index->bounds[element]],
+        index->bounds[element + 1] - 1 - index->bounds[element]
+    };
+    return mtpl_buffer_write(&text, allocators, out);
+}
+
+mtpl_list_generator mtpl_generator_list_variant(mtpl_generator generator) {
+    if (generator == mtpl_generator_len) {
+        return mtpl_generator_len_list;
+    } else if (generator == mtpl_generator_element) {
+        return mtpl_generator_element_list;
+    }
+    return NULL;
+}
+
+mtpl_range_generator mtpl_generator_range_variant(mtpl_generator generator) {
+    if (generator == mtpl_generator_for) {
+        return mtpl_generator_for_range;
+    }
+    return NULL;
+}
@@ -4,7 +4,7 @@
 #include <string.h>
 
 // Jenkins' one-at-a-time hash.
-static uint32_t calculate_hash(const char* key, uint32_t mod) {
+static uint32_t calculate_hash(const char* key) {
     uint32_t hash = 0;
     while (*key) {
         hash += *key++;
@@ -14,31 +14,260 @@ static uint32_t calculate_hash(const char* key, uint32_t mod) {
     hash += hash << 3;
     hash ^= hash >> 11;
     hash += hash << 15;
-    return hash % mod;
+    return hash;
+}
+
+// Small tables keep their entries packed in the inline slots, and are
+// searched linearly.
+inline static bool is_inline(const mtpl_hashtable* htable) {
+    return htable->entries == htable->slots;
+}
+
+static void reset_inline(mtpl_hashtable* htable) {
+    memset(htable->slots, 0, sizeof(htable->slots));
+    htable->entries = htable->slots;
+    htable->size = MTPL_HTABLE_INLINE_SLOTS;
+    htable->count = 0;
+}
+
+// Distance of the entry at `index` from the slot its hash maps to.
+inline static size_t probe_distance(
+    const mtpl_hashentry* entries,
+    size_t mask,
+    size_t index
+) {
+    return (index - (entries[index].hash & mask)) & mask;
+}
+
+// Finds `key` in this table only, without following the scope chain.
+static mtpl_hashentry* find_entry(
+    const char* key,
+    uint32_t hash,
+    const mtpl_hashtable* htable
+) {
+    mtpl_hashentry* entries = htable->entries;
+    if (is_inline(htable)) {
+        for (size_t i = 0; i < htable->count; ++i) {
+            if (entries[i].hash == hash && strcmp(entries[i].key, key) == 0) {
+                return &entries[i];
+            }
+        }
+        return NULL;
+    }
+
+    // Entries are ordered by probe distance, so the search can stop as soon
+    // as it passes an entry closer to its home slot than the key would be.
+    const size_t mask = htable->size - 1;
+    size_t index = hash & mask;
+    for (size_t distance = 0; entries[index].key; ++distance) {
+        if (probe_distance(entries, mask, index) < distance) {
+            return NULL;
+        }
+        if (
+            entries[index].hash == hash
+                && strcmp(entries[index].key, key) == 0
+        ) {
+            return &entries[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+// Robin Hood insertion of a new entry into a hashed array with free space.
+// Returns where the new entry ended up.
+static mtpl_hashentry* place_entry(
+    mtpl_hashentry* entries,
+    size_t size,
+    mtpl_hashentry entry
+) {
+    const size_t mask = size - 1;
+    mtpl_hashentry* placed = NULL;
+    size_t index = entry.hash & mask;
+    for (size_t distance = 0; entries[index].key; ++distance) {
+        const size_t existing = probe_distance(entries, mask, index);
+        if (existing < distance) {
+            // Take the slot from the entry closer to home, and carry on
+            // placing the displaced one.
+            const mtpl_hashentry displaced = entries[index];
+            entries[index] = entry;
+            entry = displaced;
+            distance = existing;
+            if (!placed) {
+                placed = &entries[index];
+            }
+        }
+        index = (index + 1) & mask;
+    }
+    entries[index] = entry;
+    return placed ? placed : &entries[index];
+}
+
+// Moves all entries over to a hashed array of `size` entries.
+static mtpl_result rehash(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable,
+    size_t size
+) {
+    mtpl_hashentry* entries = mtpl_allocate(
+        allocators,
+        sizeof(mtpl_hashentry) * size
+    );
+    if (!entries) {
+        return MTPL_ERR_MEMORY;
+    }
+    memset(entries, 0, sizeof(mtpl_hashentry) * size);
+    for (size_t i = 0; i < htable->size; ++i) {
+        if (htable->entries[i].key) {
+            place_entry(entries, size, htable->entries[i]);
+        }
+    }
+    if (!is_inline(htable)) {
+        mtpl_deallocate(allocators, htable->entries);
+    }
+    htable->entries = entries;
+    htable->size = size;
+    return MTPL_SUCCESS;
+}
+
+// Makes room for one more entry, keeping the load factor below 7/8.
+static mtpl_result reserve(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+) {
+    if (is_inline(htable)) {
+        if (htable->count < MTPL_HTABLE_INLINE_SLOTS) {
+            return MTPL_SUCCESS;
+        }
+        return rehash(allocators, htable, MTPL_HTABLE_MIN_SIZE);
+    }
+    if ((htable->count + 1) * 8 > htable->size * 7) {
+        return rehash(allocators, htable, htable->size * 2);
+    }
+    return MTPL_SUCCESS;
+}
+
+static void release_entry(
+    const mtpl_allocators* allocators,
+    mtpl_hashentry* entry
+) {
+    mtpl_htable_set_cache(entry, NULL, allocators);
+    mtpl_deallocate(allocators, entry->key);
+    mtpl_deallocate(allocators, entry->data);
+    entry->key = NULL;
+    entry->data = NULL;
+}
+
+// Copies `value_size` bytes of `value` into the entry's storage. The value is
+// always followed by a terminator, which is counted as part of the value only
+// if `terminate` is set.
+inline static void copy_value(
+    mtpl_hashentry* entry,
+    const void* value,
+    size_t value_size,
+    bool terminate
+) {
+    memmove(entry->data, value, value_size);
+    ((char*) entry->data)[value_size] = '\0';
+    entry->size = value_size + terminate;
+}
+
+// Replaces the value of an existing entry, reusing its storage when the new
+// value fits. `value` may point into the current value.
+static mtpl_result overwrite_entry(
+    mtpl_hashentry* entry,
+    const void* value,
+    size_t value_size,
+    bool terminate,
+    const mtpl_allocators* allocators
+) {
+    mtpl_htable_set_cache(entry, NULL, allocators);
+    const size_t size = value_size + 1;
+    if (size <= entry->capacity) {
+        copy_value(entry, value, value_size, terminate);
+        return MTPL_SUCCESS;
+    }
+
+    // Grow geometrically, so that repeatedly appending to a value stays
+    // linear overall.
+    size_t capacity = entry->capacity * 2;
+    if (capacity < size) {
+        capacity = size;
+    }
+    void* data = mtpl_allocate(allocators, capacity);
+    if (!data) {
+        return MTPL_ERR_MEMORY;
+    }
+    void* previous = entry->data;
+    entry->data = data;
+    entry->capacity = capacity;
+    copy_value(entry, value, value_size, terminate);
+    mtpl_deallocate(allocators, previous);
+    return MTPL_SUCCESS;
+}
+
+static mtpl_result insert_value(
+    const char* key,
+    const void* value,
+    size_t value_size,
+    bool terminate,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+) {
+    if (htable->frozen) {
+        return MTPL_ERR_FROZEN;
+    }
+    const uint32_t hash = calculate_hash(key);
+    mtpl_hashentry* entry = find_entry(key, hash, htable);
+    if (entry) {
+        return overwrite_entry(
+            entry,
+            value,
+            value_size,
+            terminate,
+            allocators
+        );
+    }
+
+    mtpl_result result = reserve(allocators, htable);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    const size_t len = strlen(key) + 1;
+    mtpl_hashentry new_entry = {
+        .key = mtpl_allocate(allocators, len),
+        .data = mtpl_allocate(allocators, value_size + 1),
+        .cache = NULL,
+        .capacity = value_size + 1,
+        .hash = hash
+    };
+    if (!new_entry.key || !new_entry.data) {
+        mtpl_deallocate(allocators, new_entry.key);
+        mtpl_deallocate(allocators, new_entry.data);
+        return MTPL_ERR_MEMORY;
+    }
+    memcpy(new_entry.key, key, len);
+    copy_value(&new_entry, value, value_size, terminate);
+    if (is_inline(htable)) {
+        htable->entries[htable->count] = new_entry;
+    } else {
+        place_entry(htable->entries, htable->size, new_entry);
+    }
+    htable->count++;
+    return MTPL_SUCCESS;
 }
 
 mtpl_result mtpl_htable_create(
     const mtpl_allocators* allocators,
     mtpl_hashtable** out_htable
 ) {
-    *out_htable = allocators->malloc(sizeof(mtpl_hashtable));
+    *out_htable = mtpl_allocate(allocators, sizeof(mtpl_hashtable));
     if (!*out_htable) {
         return MTPL_ERR_MEMORY;
     }
-    (*out_htable)->entries = allocators->malloc(
-        sizeof(mtpl_hashentry) * MTPL_HTABLE_SIZE
-    );
-    if (!(*out_htable)->entries) {
-        return MTPL_ERR_MEMORY;
-    }
-    memset(
-        (*out_htable)->entries,
-        0,
-        sizeof(mtpl_hashentry) * MTPL_HTABLE_SIZE
-    );
-    (*out_htable)->size = MTPL_HTABLE_SIZE;
-    (*out_htable)->count = 0;
+    reset_inline(*out_htable);
     (*out_htable)->next = NULL;
+    (*out_htable)->frozen = false;
     return MTPL_SUCCESS;
 }
 
@@ -46,32 +275,124 @@ void mtpl_htable_free(
     const mtpl_allocators* allocators,
     mtpl_hashtable* htable
 ) {
-    if (htable->next) {
-        mtpl_htable_free(allocators, htable->next);
-    }
+    mtpl_htable_clear(allocators, htable);
+    mtpl_deallocate(allocators, htable);
+}
+
+void mtpl_htable_clear(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+) {
     for (size_t i = 0; i < htable->size; ++i) {
-        allocators->free(htable->entries[i].key);
+        if (htable->entries[i].key) {
+            release_entry(allocators, &htable->entries[i]);
+        }
     }
-    allocators->free(htable->entries);
-    allocators->free(htable);
+    if (!is_inline(htable)) {
+        mtpl_deallocate(allocators, htable->entries);
+    }
+    reset_inline(htable);
 }
 
 void* mtpl_htable_search(const char* key, const mtpl_hashtable* htable) {
-    uint32_t index = calculate_hash(key, htable->size);
-    for (uint32_t i = 0; i < 16; ++i) {
-        if (
-            htable->entries[index + i].key
-                && strcmp(htable->entries[index + i].key, key) == 0
-        ) {
-            return htable->entries[index + i].data;
+    const mtpl_hashentry* entry = mtpl_htable_lookup(key, htable);
+    return entry ? entry->data : NULL;
+}
+
+mtpl_slice mtpl_htable_search_string(
+    const char* key,
+    const mtpl_hashtable* htable
+) {
+    const mtpl_hashentry* entry = mtpl_htable_lookup(key, htable);
+    if (!entry) {
+        return (mtpl_slice) { NULL, 0 };
+    }
+    return mtpl_htable_entry_string(entry);
+}
+
+mtpl_slice mtpl_htable_entry_string(const mtpl_hashentry* entry) {
+    const char* data = entry->data;
+    size_t length = entry->size;
+    if (length && !data[length - 1]) {
+        length--;
+    }
+    return (mtpl_slice) { data, length };
+}
+
+mtpl_hashentry* mtpl_htable_lookup(
+    const char* key,
+    const mtpl_hashtable* htable
+) {
+    const uint32_t hash = calculate_hash(key);
+    for (; htable; htable = htable->next) {
+        mtpl_hashentry* entry = find_entry(key, hash, htable);
+        if (entry) {
+            return entry;
         }
     }
-    if (htable->next) {
-        return mtpl_htable_search(key, htable->next);
+    return NULL;
+}
+
+void mtpl_htable_set_cache(
+    mtpl_hashentry* entry,
+    mtpl_hashcache* cache,
+    const mtpl_allocators* allocators
+) {
+    mtpl_hashcache* previous = entry->cache;
+    while (previous) {
+        mtpl_hashcache* next = previous->next;
+        previous->free(allocators, previous);
+        previous = next;
+    }
+    if (cache) {
+        cache->next = NULL;
+    }
+    entry->cache = cache;
+}
+
+mtpl_hashcache* mtpl_htable_find_cache(
+    const mtpl_hashentry* entry,
+    void (*free_cache)(const mtpl_allocators*, mtpl_hashcache*)
+) {
+    // Pairs with the release in mtpl_htable_attach_cache(), so that a cache
+    // attached by another thread is seen fully initialized.
+    mtpl_hashcache* cache = __atomic_load_n(&entry->cache, __ATOMIC_ACQUIRE);
+    for (; cache; cache = cache->next) {
+        if (cache->free == free_cache) {
+            return cache;
+        }
     }
     return NULL;
 }
 
+mtpl_hashcache* mtpl_htable_attach_cache(
+    mtpl_hashentry* entry,
+    mtpl_hashcache* cache,
+    const mtpl_allocators* allocators
+) {
+    // Caches are only ever added to the front of the list, so anything
+    // already in it stays valid while another thread pushes a new one.
+    cache->next = __atomic_load_n(&entry->cache, __ATOMIC_ACQUIRE);
+    do {
+        for (mtpl_hashcache* other = cache->next; other; other = other->next) {
+            if (other->free == cache->free) {
+                cache->free(allocators, cache);
+                return other;
+            }
+        }
+    } while (
+        !__atomic_compare_exchange_n(
+            &entry->cache,
+            &cache->next,
+            cache,
+            false,
+            __ATOMIC_RELEASE,
+            __ATOMIC_ACQUIRE
+        )
+    );
+    return cache;
+}
+
 mtpl_result mtpl_htable_insert(
     const char* key,
     const void* value,
@@ -79,34 +400,23 @@ mtpl_result mtpl_htable_insert(
     const mtpl_allocators* allocators,
     mtpl_hashtable* htable
 ) {
-    uint32_t index = calculate_hash(key, htable->size);
-    for (uint32_t i = 0; i < 16; ++i) {
-        mtpl_hashentry* entry = &(htable->entries[index + i]); 
-        if (!entry->key || strcmp(entry->key, key) == 0) {
-            size_t len = strlen(key) + 1;
-            entry->key = allocators->malloc(len);
-            if (!entry->key) {
-                return MTPL_ERR_MEMORY;
-            }
-            memcpy(entry->key, key, len);
-
-            entry->data = allocators->malloc(value_size);
-            if (!entry->data) {
-                return MTPL_ERR_MEMORY;
-            }
-            memcpy(entry->data, value, value_size);
+    return insert_value(key, value, value_size, false, allocators, htable);
+}
 
-            htable->count++;
-            return MTPL_SUCCESS;
-        }
-    }
-    if (!htable->next) {
-        mtpl_result result = mtpl_htable_create(allocators, &(htable->next));
-        if (result != MTPL_SUCCESS) {
-            return result;
-        }
-    }
-    return mtpl_htable_insert(key, value, value_size, allocators, htable->next);
+mtpl_result mtpl_htable_insert_string(
+    const char* key,
+    const mtpl_slice* value,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* htable
+) {
+    return insert_value(
+        key,
+        value->data,
+        value->length,
+        true,
+        allocators,
+        htable
+    );
 }
 
 mtpl_result mtpl_htable_delete(
@@ -114,19 +424,43 @@ mtpl_result mtpl_htable_delete(
     const mtpl_allocators* allocators,
     mtpl_hashtable* htable
 ) {
-    uint32_t index = calculate_hash(key, htable->size);
-    for (uint32_t i = 0; i < 16; ++i) {
-        char** entrykey = &(htable->entries[index + i].key); 
-        if (strcmp(*entrykey, key) == 0) {
-            allocators->free(*entrykey);
-            *entrykey = NULL;
-            htable->count--;
+    const uint32_t hash = calculate_hash(key);
+    for (; htable; htable = htable->next) {
+        mtpl_hashentry* entry = find_entry(key, hash, htable);
+        if (!entry) {
+            continue;
+        }
+        if (htable->frozen) {
+            return MTPL_ERR_FROZEN;
+        }
+        release_entry(allocators, entry);
+        htable->count--;
+        if (is_inline(htable)) {
+            // Keep the inline entries packed.
+            *entry = htable->entries[htable->count];
+            memset(&htable->entries[htable->count], 0, sizeof(*entry));
             return MTPL_SUCCESS;
         }
-    }
-    if (htable->next) {
-        return mtpl_htable_delete(key, allocators, htable->next);
+
+        // Shift the following entries of the probe sequence back one step,
+        // so that no tombstone is needed.
+        const size_t mask = htable->size - 1;
+        size_t index = entry - htable->entries;
+        size_t next = (index + 1) & mask;
+        while (
+            htable->entries[next].key
+                && probe_distance(htable->entries, mask, next) > 0
+        ) {
+            htable->entries[index] = htable->entries[next];
+            index = next;
+            next = (next + 1) & mask;
+        }
+        memset(&htable->entries[index], 0, sizeof(mtpl_hashentry));
+        return MTPL_SUCCESS;
     }
     return MTPL_ERR_UNKNOWN_KEY;
 }
 
+void mtpl_htable_freeze(mtpl_hashtable* htable) {
+    htable->frozen = true;
+}
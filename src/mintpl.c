@@ -1,10 +1,13 @@
 #include <mintpl/generators.h>
 #include <mintpl/mintpl.h>
 #include <mintpl/substitute.h>
-#include <stdlib.h>
-#include <string.h>
 
-static const mtpl_allocators allocators = { malloc, realloc, free };
+#include "arena.h"
+#include "budget.h"
+#include "profile.h"
+#include "threads.h"
+
+#include <string.h>
 
 static mtpl_result add_default_generators(
     const mtpl_allocators* allocators,
@@ -20,6 +23,7 @@ static mtpl_result add_default_generators(
     mtpl_generator macro = mtpl_generator_macro;
     mtpl_generator expand = mtpl_generator_expand;
     mtpl_generator genfor = mtpl_generator_for;
+    mtpl_generator pfor = mtpl_generator_pfor;
     mtpl_generator genif = mtpl_generator_if;
     mtpl_generator not = mtpl_generator_not;
     mtpl_generator eq = mtpl_generator_equals;
@@ -128,6 +132,16 @@ static mtpl_result add_default_generators(
     if (result != MTPL_SUCCESS) {
         return result;
     }
+    result = mtpl_htable_insert(
+        "pfor",
+        &pfor,
+        sizeof(mtpl_generator),
+        allocators,
+        generators
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
     result = mtpl_htable_insert(
         "if",
         &genif,
@@ -227,7 +241,7 @@ static mtpl_result add_default_generators(
 }
 
 mtpl_result mtpl_init(mtpl_context** context) {
-    return mtpl_init_custom_alloc(&allocators, context);
+    return mtpl_init_custom_alloc(&mtpl_std_allocators, context);
 }
 
 mtpl_result mtpl_init_custom_alloc(
@@ -235,11 +249,19 @@ mtpl_result mtpl_init_custom_alloc(
     mtpl_context** context
 ) {
     mtpl_result result = MTPL_SUCCESS;
-    *context = allocators->malloc(sizeof(mtpl_context));
+    *context = mtpl_allocate(allocators, sizeof(mtpl_context));
     if (!*context) {
         return MTPL_ERR_MEMORY;
     }
     (*context)->allocators = allocators;
+    (*context)->base = NULL;
+    (*context)->profile = NULL;
+    (*context)->trace = NULL;
+    (*context)->limits = (mtpl_limits) {
+        .max_depth = MTPL_DEFAULT_MAX_DEPTH,
+        .max_stack = MTPL_DEFAULT_STACK_SIZE
+    };
+    (*context)->pfor_threads = 0;
 
     result = mtpl_htable_create(allocators, &((*context)->generators));
     if (result != MTPL_SUCCESS) {
@@ -260,13 +282,27 @@ mtpl_result mtpl_init_custom_alloc(
         goto cleanup_properties;
     }
 
+    result = mtpl_arena_create(allocators, &((*context)->arena));
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_output;
+    }
+
+    result = mtpl_pool_create(allocators, &((*context)->pool));
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_arena;
+    }
+
     result = add_default_generators(allocators, (*context)->generators);
     if (result != MTPL_SUCCESS) {
-        goto cleanup_properties;
+        goto cleanup_pool;
     }
 
     return MTPL_SUCCESS;
 
+cleanup_pool:
+    mtpl_pool_free((*context)->pool);
+cleanup_arena:
+    mtpl_arena_free((*context)->arena);
 cleanup_output:
     mtpl_buffer_free(allocators, (*context)->output);
 cleanup_properties:
@@ -274,16 +310,92 @@ cleanup_properties:
 cleanup_generators:
     mtpl_htable_free(allocators, (*context)->generators);
 cleanup_context:
-    allocators->free(*context);
+    mtpl_deallocate(allocators, *context);
+
+    return result;
+}
+
+mtpl_result mtpl_init_overlay(
+    const mtpl_context* base,
+    mtpl_context** context
+) {
+    const mtpl_allocators* allocators = base->allocators;
+    mtpl_result result = MTPL_SUCCESS;
+    *context = mtpl_allocate(allocators, sizeof(mtpl_context));
+    if (!*context) {
+        return MTPL_ERR_MEMORY;
+    }
+    (*context)->allocators = allocators;
+    (*context)->base = base;
+    (*context)->profile = NULL;
+    (*context)->trace = NULL;
+    (*context)->limits = base->limits;
+    (*context)->pfor_threads = base->pfor_threads;
+    (*context)->generators = base->generators;
+
+    result = mtpl_htable_create(allocators, &((*context)->properties));
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_context;
+    }
+    (*context)->properties->next = base->properties;
+
+    result = mtpl_buffer_create(
+        allocators,
+        MTPL_DEFAULT_BUFSIZE,
+        &((*context)->output)
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_properties;
+    }
+
+    result = mtpl_arena_create(allocators, &((*context)->arena));
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_output;
+    }
+
+    result = mtpl_pool_create(allocators, &((*context)->pool));
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_arena;
+    }
+
+    return MTPL_SUCCESS;
+
+cleanup_arena:
+    mtpl_arena_free((*context)->arena);
+cleanup_output:
+    mtpl_buffer_free(allocators, (*context)->output);
+cleanup_properties:
+    mtpl_htable_free(allocators, (*context)->properties);
+cleanup_context:
+    mtpl_deallocate(allocators, *context);
 
     return result;
 }
 
 void mtpl_free(mtpl_context* context) {
+    mtpl_disable_profiling(context);
+    mtpl_disable_tracing(context);
+    mtpl_pool_free(context->pool);
+    mtpl_arena_free(context->arena);
     mtpl_buffer_free(context->allocators, context->output);
     mtpl_htable_free(context->allocators, context->properties);
-    mtpl_htable_free(context->allocators, context->generators);
-    context->allocators->free(context);
+    if (!context->base) {
+        mtpl_htable_free(context->allocators, context->generators);
+    }
+    mtpl_deallocate(context->allocators, context);
+}
+
+void mtpl_freeze(mtpl_context* context) {
+    mtpl_htable_freeze(context->properties);
+    if (!context->base) {
+        mtpl_htable_freeze(context->generators);
+    }
+}
+
+void mtpl_clear_properties(mtpl_context* context) {
+    if (!context->properties->frozen) {
+        mtpl_htable_clear(context->allocators, context->properties);
+    }
 }
 
 mtpl_result mtpl_set_generator(
@@ -291,6 +403,9 @@ mtpl_result mtpl_set_generator(
     mtpl_generator generator,
     mtpl_context* context
 ) {
+    if (context->base) {
+        return MTPL_ERR_FROZEN;
+    }
     return mtpl_htable_insert(
         name,
         &generator,
@@ -305,23 +420,241 @@ mtpl_result mtpl_set_property(
     const char* value,
     mtpl_context* context
 ) {
-    return mtpl_htable_insert(
+    const mtpl_slice slice = { value, strlen(value) };
+    return mtpl_set_property_slice(name, &slice, context);
+}
+
+mtpl_result mtpl_set_property_slice(
+    const char* name,
+    const mtpl_slice* value,
+    mtpl_context* context
+) {
+    return mtpl_htable_insert_string(
         name,
         value,
-        strlen(value), 
         context->allocators,
         context->properties
     );
 }
 
-mtpl_result mtpl_parse_template(const char* source, mtpl_context* context) {
+mtpl_result mtpl_compile_template(
+    const char* source,
+    mtpl_context* context,
+    mtpl_program** out_program
+) {
+    return mtpl_compile(
+        source,
+        context->allocators,
+        context->generators,
+        out_program
+    );
+}
+
+// Arena, profile, trace, budget, pool and thread count that were active on
+// this thread before a render.
+typedef struct {
+    mtpl_arena* arena;
+    mtpl_profile* profile;
+    mtpl_trace* trace;
+    mtpl_budget* budget;
+    size_t depth;
+    mtpl_pool* pool;
+    size_t threads;
+} mtpl__render;
+
+// Makes the context's arena, profile, trace, pool and thread count available
+// to the render about to start on this thread, along with a budget set up from its
+// limits.
+// Returns those to restore afterwards.
+static mtpl__render begin_render(mtpl_context* context, mtpl_budget* budget) {
     context->output->cursor = 0;
-    return mtpl_substitute(
+    mtpl__render previous = { mtpl_arena_enter(context->arena) };
+    mtpl_profile_enter(
+        context->profile,
+        context->trace,
+        &previous.profile,
+        &previous.trace
+    );
+    mtpl_budget_enter(
+        mtpl_budget_init(budget, &context->limits) ? budget : NULL,
+        0,
+        &previous.budget,
+        &previous.depth
+    );
+    mtpl_threads_enter(
+        context->pool,
+        context->pfor_threads,
+        &previous.pool,
+        &previous.threads
+    );
+    return previous;
+}
+
+static void end_render(mtpl_context* context, mtpl__render previous) {
+    mtpl_threads_leave(previous.pool, previous.threads);
+    mtpl_budget_leave(previous.budget, previous.depth);
+    mtpl_profile_leave(previous.profile, previous.trace);
+    mtpl_arena_leave(previous.arena);
+    if (previous.arena != context->arena) {
+        mtpl_arena_reset(context->arena);
+    }
+}
+
+mtpl_result mtpl_run_template(
+    const mtpl_program* program,
+    mtpl_context* context
+) {
+    mtpl_budget budget;
+    const mtpl__render previous = begin_render(context, &budget);
+    mtpl_result result = mtpl_run(
+        program,
+        context->allocators,
+        context->generators,
+        context->properties,
+        context->output
+    );
+    end_render(context, previous);
+    return result;
+}
+
+mtpl_result mtpl_run_template_sink(
+    const mtpl_program* program,
+    mtpl_context* context,
+    const mtpl_sink* sink
+) {
+    mtpl_budget budget;
+    const mtpl__render previous = begin_render(context, &budget);
+    mtpl_result result = mtpl_run_sink(
+        program,
+        context->allocators,
+        context->generators,
+        context->properties,
+        sink,
+        context->output
+    );
+    end_render(context, previous);
+    return result;
+}
+
+mtpl_result mtpl_parse_template(const char* source, mtpl_context* context) {
+    mtpl_budget budget;
+    const mtpl__render previous = begin_render(context, &budget);
+    mtpl_result result = mtpl_substitute(
+        source,
+        context->allocators,
+        context->generators,
+        context->properties,
+        context->output
+    );
+    end_render(context, previous);
+    return result;
+}
+
+mtpl_result mtpl_parse_template_sink(
+    const char* source,
+    mtpl_context* context,
+    const mtpl_sink* sink
+) {
+    mtpl_budget budget;
+    const mtpl__render previous = begin_render(context, &budget);
+    mtpl_program* program;
+    mtpl_result result = mtpl_arena_program(context->allocators, &program);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_render;
+    }
+    result = mtpl_compile_into(
         source,
         context->allocators,
         context->generators,
+        program
+    );
+    if (result == MTPL_SUCCESS) {
+        result = mtpl_run_sink(
+            program,
+            context->allocators,
+            context->generators,
+            context->properties,
+            sink,
+            context->output
+        );
+    }
+    mtpl_arena_release_program(context->allocators, program);
+cleanup_render:
+    end_render(context, previous);
+    return result;
+}
+
+mtpl_result mtpl_parse_stream(
+    const mtpl_reader* reader,
+    mtpl_context* context,
+    const mtpl_sink* sink
+) {
+    mtpl_budget budget;
+    const mtpl__render previous = begin_render(context, &budget);
+    mtpl_result result = mtpl_substitute_stream(
+        reader,
+        context->allocators,
+        context->generators,
         context->properties,
+        sink,
         context->output
     );
+    end_render(context, previous);
+    return result;
+}
+
+mtpl_result mtpl_enable_profiling(mtpl_context* context) {
+    mtpl_profile* profile;
+    mtpl_result result = mtpl_profile_create(context->allocators, &profile);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_disable_profiling(context);
+    context->profile = profile;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_disable_profiling(mtpl_context* context) {
+    if (context->profile) {
+        mtpl_profile_free(context->profile);
+        context->profile = NULL;
+    }
+}
+
+mtpl_stats mtpl_get_stats(const mtpl_context* context) {
+    mtpl_stats stats = { NULL, 0 };
+    if (context->profile) {
+        stats.generators = context->profile->stats;
+        stats.count = context->profile->count;
+    }
+    return stats;
 }
 
+mtpl_result mtpl_enable_tracing(mtpl_context* context) {
+    mtpl_trace* trace;
+    mtpl_result result = mtpl_trace_create(context->allocators, &trace);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_disable_tracing(context);
+    context->trace = trace;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_disable_tracing(mtpl_context* context) {
+    if (context->trace) {
+        mtpl_trace_free(context->trace);
+        context->trace = NULL;
+    }
+}
+
+mtpl_result mtpl_write_trace(
+    const mtpl_context* context,
+    const mtpl_sink* sink
+) {
+    if (!context->trace) {
+        static const char empty[] = "{\"traceEvents\":[]}\n";
+        return sink->write(sink->user, empty, sizeof(empty) - 1);
+    }
+    return mtpl_trace_write(context->trace, sink);
+}
@@ -0,0 +1,505 @@
+#include <mintpl/number.h>
+
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Powers of ten that are exactly representable as doubles.
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_EXACT_POWER 22
+// Integers up to this value are exactly representable as doubles.
+#define MAX_EXACT_INTEGER (1ull << 53)
+// Most significant digits in a shortest representation of a double.
+#define MAX_DIGITS 17
+// Numbers are printed in positional notation when their decimal exponent is
+// within this range, and in exponential notation otherwise.
+#define MIN_POSITIONAL_EXPONENT -5
+#define MAX_POSITIONAL_EXPONENT 21
+
+inline static bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Hands the number at the start of `text` over to strtod(), for anything the
+// fast paths don't cover. The text is copied with the decimal point replaced
+// by that of the current locale, which strtod() expects.
+static size_t parse_real(const char* text, mtpl_number* out_number) {
+    char copy[64];
+    const char* source = text;
+    const char* point = localeconv()->decimal_point;
+    if (strcmp(point, ".") != 0 && strlen(point) == 1) {
+        size_t i = 0;
+        for (; text[i] && i < sizeof(copy) - 1; ++i) {
+            copy[i] = (text[i] == '.') ? *point : text[i];
+        }
+        copy[i] = '\0';
+        source = copy;
+    }
+
+    char* end;
+    errno = 0;
+    out_number->real = strtod(source, &end);
+    out_number->integral = false;
+    // Underflow still yields the nearest (subnormal or zero) value, which is
+    // fine; only overflow to infinity is rejected.
+    if ((errno && isinf(out_number->real)) || end == source) {
+        return 0;
+    }
+    return end - source;
+}
+
+size_t mtpl_number_parse(const char* text, mtpl_number* out_number) {
+    size_t i = 0;
+    while (is_whitespace(text[i])) {
+        i++;
+    }
+    const bool negative = text[i] == '-';
+    if (text[i] == '-' || text[i] == '+') {
+        i++;
+    }
+    const bool hexadecimal = text[i] == '0'
+        && (text[i + 1] == 'x' || text[i + 1] == 'X');
+    if (
+        hexadecimal
+        || !(is_digit(text[i]) || (text[i] == '.' && is_digit(text[i + 1])))
+    ) {
+        // Leave anything else, such as "inf", to strtod().
+        return parse_real(text, out_number);
+    }
+
+    // Accumulate the integer part as a negative value, which has room for
+    // the full range of int64_t. Past that, keep the leading 19 digits of the
+    // significand, and count the rest towards the exponent.
+    int64_t integer = 0;
+    bool exact = true;
+    uint64_t significand = 0;
+    size_t num_digits = 0;
+    int exponent = 0;
+    for (; is_digit(text[i]); ++i) {
+        const int digit = text[i] - '0';
+        if (exact && integer < (INT64_MIN + digit) / 10) {
+            exact = false;
+        }
+        if (exact) {
+            integer = integer * 10 - digit;
+        }
+        if (num_digits < 19) {
+            significand = significand * 10 + digit;
+            num_digits += significand != 0;
+        } else {
+            exponent++;
+        }
+    }
+    const bool is_integer = text[i] != '.' && text[i] != 'e' && text[i] != 'E';
+    if (is_integer && exact && (negative || integer != INT64_MIN)) {
+        out_number->integer = negative ? integer : -integer;
+        out_number->integral = true;
+        return i;
+    }
+
+    if (text[i] == '.') {
+        for (++i; is_digit(text[i]); ++i) {
+            if (num_digits < 19) {
+                significand = significand * 10 + (text[i] - '0');
+                num_digits += significand != 0;
+                exponent--;
+            }
+        }
+    }
+    if (text[i] == 'e' || text[i] == 'E') {
+        // The exponent is only part of the number if it has digits.
+        size_t j = i + 1;
+        const bool negative_exponent = text[j] == '-';
+        if (text[j] == '-' || text[j] == '+') {
+            j++;
+        }
+        if (is_digit(text[j])) {
+            int written = 0;
+            for (; is_digit(text[j]); ++j) {
+                if (written < 100000) {
+                    written = written * 10 + (text[j] - '0');
+                }
+            }
+            exponent += negative_exponent ? -written : written;
+            i = j;
+        }
+    }
+
+    // Both the significand and the power of ten are exact, so a single
+    // multiplication or division rounds correctly.
+    if (
+        num_digits < 19
+        && significand <= MAX_EXACT_INTEGER
+        && exponent >= -MAX_EXACT_POWER
+        && exponent <= MAX_EXACT_POWER
+    ) {
+        double value = (double) significand;
+        if (exponent < 0) {
+            value /= exact_powers[-exponent];
+        } else {
+            value *= exact_powers[exponent];
+        }
+        out_number->real = negative ? -value : value;
+        out_number->integral = false;
+        return i;
+    }
+    return parse_real(text, out_number);
+}
+
+double mtpl_number_real(const mtpl_number* number) {
+    return number->integral ? (double) number->integer : number->real;
+}
+
+static size_t format_integer(int64_t value, char* data) {
+    char digits[20];
+    size_t count = 0;
+    // Work with the negative magnitude, to handle INT64_MIN.
+    int64_t rest = value < 0 ? value : -value;
+    do {
+        digits[count++] = '0' - rest % 10;
+        rest /= 10;
+    } while (rest);
+    size_t len = 0;
+    if (value < 0) {
+        data[len++] = '-';
+    }
+    while (count) {
+        data[len++] = digits[--count];
+    }
+    data[len] = '\0';
+    return len;
+}
+
+// Unsigned integers large enough for the scaled values used when generating
+// the digits of any double.
+#define BIG_LIMBS 40
+
+typedef struct {
+    uint32_t limbs[BIG_LIMBS];
+    size_t length;
+} mtpl__big;
+
+static void big_set(mtpl__big* big, uint64_t value) {
+    big->limbs[0] = (uint32_t) value;
+    big->limbs[1] = (uint32_t) (value >> 32);
+    big->length = big->limbs[1] ? 2 : (big->limbs[0] ? 1 : 0);
+}
+
+static void big_shift_left(mtpl__big* big, unsigned bits) {
+    if (!big->length) {
+        return;
+    }
+    const size_t limbs = bits / 32;
+    bits %= 32;
+    big->limbs[big->length + limbs] = 0;
+    for (size_t i = big->length; i--;) {
+        const uint64_t shifted = (uint64_t) big->limbs[i] << bits;
+        big->limbs[i + limbs + 1] |= (uint32_t) (shifted >> 32);
+        big->limbs[i + limbs] = (uint32_t) shifted;
+    }
+    memset(big->limbs, 0, sizeof(uint32_t) * limbs);
+    big->length += limbs + 1;
+    if (!big->limbs[big->length - 1]) {
+        big->length--;
+    }
+}
+
+static void big_multiply(mtpl__big* big, uint32_t factor) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < big->length; ++i) {
+        carry += (uint64_t) big->limbs[i] * factor;
+        big->limbs[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    if (carry) {
+        big->limbs[big->length++] = (uint32_t) carry;
+    }
+}
+
+static void big_multiply_pow10(mtpl__big* big, unsigned exponent) {
+    for (; exponent >= 9; exponent -= 9) {
+        big_multiply(big, 1000000000);
+    }
+    static const uint32_t powers[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+    };
+    big_multiply(big, powers[exponent]);
+}
+
+static int big_compare(const mtpl__big* a, const mtpl__big* b) {
+    if (a->length != b->length) {
+        return a->length < b->length ? -1 : 1;
+    }
+    for (size_t i = a->length; i--;) {
+        if (a->limbs[i] != b->limbs[i]) {
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void big_add(mtpl__big* out, const mtpl__big* a, const mtpl__big* b) {
+    if (a->length < b->length) {
+        const mtpl__big* swap = a;
+        a = b;
+        b = swap;
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a->length; ++i) {
+        carry += (uint64_t) a->limbs[i] + (i < b->length ? b->limbs[i] : 0);
+        out->limbs[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    out->length = a->length;
+    if (carry) {
+        out->limbs[out->length++] = (uint32_t) carry;
+    }
+}
+
+// Subtracts `b` from `a`, which must not be less than `b`.
+static void big_subtract(mtpl__big* a, const mtpl__big* b) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a->length; ++i) {
+        borrow += (int64_t) a->limbs[i] - (i < b->length ? b->limbs[i] : 0);
+        a->limbs[i] = (uint32_t) borrow;
+        borrow = borrow < 0 ? -1 : 0;
+    }
+    while (a->length && !a->limbs[a->length - 1]) {
+        a->length--;
+    }
+}
+
+// Compares r + m against s.
+static int big_compare_sum(
+    const mtpl__big* r,
+    const mtpl__big* m,
+    const mtpl__big* s
+) {
+    mtpl__big sum;
+    big_add(&sum, r, m);
+    return big_compare(&sum, s);
+}
+
+// Generates the shortest digits that read back as the (finite, positive)
+// value, and of those the closest, using Burger and Dybvig's free-format
+// algorithm on exact integers. Returns the number of digits, and stores the
+// decimal exponent such that value = 0.DIGITS * 10^exponent.
+static size_t shortest_digits(double value, char* digits, int* out_exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t fraction = bits & ((1ull << 52) - 1);
+    const int biased = (int) (bits >> 52) & 0x7ff;
+    const uint64_t f = biased ? fraction | (1ull << 52) : fraction;
+    const int e = biased ? biased - 1075 : -1074;
+    // Values are rounded to even, so the boundaries between neighbouring
+    // values read back as the value itself when its significand is even.
+    const bool even = !(f & 1);
+    // The gap to the next lower value is halved at powers of two.
+    const bool closer = !fraction && biased > 1;
+
+    // value = r / s, with the gaps to the neighbouring values being 2 m_low
+    // and 2 m_high.
+    mtpl__big r;
+    mtpl__big s;
+    mtpl__big m_low;
+    mtpl__big m_high;
+    big_set(&r, f);
+    big_set(&s, 1);
+    big_set(&m_low, 1);
+    big_set(&m_high, 1);
+    if (e >= 0) {
+        big_shift_left(&r, e + 1 + closer);
+        big_shift_left(&s, 1 + closer);
+        big_shift_left(&m_low, e);
+        big_shift_left(&m_high, e + closer);
+    } else {
+        big_shift_left(&r, 1 + closer);
+        big_shift_left(&s, 1 - e + closer);
+        big_shift_left(&m_high, closer);
+    }
+
+    // Estimate the exponent from the bit length, which is at most one too
+    // low, and then correct it.
+    const int bit_length = 64 - __builtin_clzll(f);
+    int exponent = (int) ceil((e + bit_length - 1) * 0.30102999566398114 - 1e-10);
+    if (exponent >= 0) {
+        big_multiply_pow10(&s, exponent);
+    } else {
+        big_multiply_pow10(&r, -exponent);
+        big_multiply_pow10(&m_low, -exponent);
+        big_multiply_pow10(&m_high, -exponent);
+    }
+    const int high = big_compare_sum(&r, &m_high, &s);
+    if (even ? high >= 0 : high > 0) {
+        big_multiply(&s, 10);
+        exponent++;
+    }
+
+    size_t count = 0;
+    while (true) {
+        big_multiply(&r, 10);
+        big_multiply(&m_low, 10);
+        big_multiply(&m_high, 10);
+        int digit = 0;
+        while (big_compare(&r, &s) >= 0) {
+            big_subtract(&r, &s);
+            digit++;
+        }
+        const int low = big_compare(&r, &m_low);
+        const int high = big_compare_sum(&r, &m_high, &s);
+        const bool low_done = even ? low <= 0 : low < 0;
+        const bool high_done = even ? high >= 0 : high > 0;
+        if (!low_done && !high_done) {
+            digits[count++] = '0' + digit;
+            continue;
+        }
+        if (low_done && high_done) {
+            // Round the last digit to whichever is closer, or to even on a
+            // tie.
+            mtpl__big twice = r;
+            big_multiply(&twice, 2);
+            const int half = big_compare(&twice, &s);
+            if (half > 0 || (half == 0 && digit % 2)) {
+                digit++;
+            }
+        } else if (high_done) {
+            digit++;
+        }
+        digits[count++] = '0' + digit;
+        break;
+    }
+    *out_exponent = exponent;
+    return count;
+}
+
+// Finds the digits of values that are exactly a short decimal fraction, such
+// as amounts of money, without resorting to exact arithmetic. Returns the
+// number of digits, or 0 if the value is not of that kind.
+static size_t short_digits(double value, char* digits, int* out_exponent) {
+    // The nearest candidate at each precision is the only one that can read
+    // back as the value, as long as the candidates are further apart than
+    // the values around it.
+    for (int places = 0; places <= 15; ++places) {
+        const double scaled = value * exact_powers[places];
+        if (scaled >= (double) (MAX_EXACT_INTEGER >> 1)) {
+            return 0;
+        }
+        const uint64_t candidate = (uint64_t) (scaled + 0.5);
+        if ((double) candidate / exact_powers[places] != value) {
+            continue;
+        }
+        if (!candidate) {
+            return 0;
+        }
+
+        char reversed[20];
+        size_t count = 0;
+        for (uint64_t rest = candidate; rest; rest /= 10) {
+            reversed[count++] = '0' + rest % 10;
+        }
+        *out_exponent = (int) count - places;
+        // Integral values may end in zeros, which are left out.
+        size_t skipped = 0;
+        while (reversed[skipped] == '0') {
+            skipped++;
+        }
+        size_t length = 0;
+        while (count > skipped) {
+            digits[length++] = reversed[--count];
+        }
+        return length;
+    }
+    return 0;
+}
+
+static size_t format_real(double value, char* data) {
+    size_t len = 0;
+    if (signbit(value)) {
+        data[len++] = '-';
+        value = -value;
+    }
+    if (isnan(value)) {
+        memcpy(data, "nan", 4);
+        return 3;
+    } else if (isinf(value)) {
+        memcpy(&data[len], "inf", 4);
+        return len + 3;
+    } else if (!value) {
+        memcpy(&data[len], "0", 2);
+        return len + 1;
+    }
+
+    char digits[MAX_DIGITS + 1];
+    int exponent;
+    size_t count = short_digits(value, digits, &exponent);
+    if (!count) {
+        count = shortest_digits(value, digits, &exponent);
+    }
+
+    if (
+        exponent > MIN_POSITIONAL_EXPONENT
+        && exponent <= MAX_POSITIONAL_EXPONENT
+    ) {
+        if (exponent <= 0) {
+            // 0.000DIGITS
+            data[len++] = '0';
+            data[len++] = '.';
+            memset(&data[len], '0', -exponent);
+            len += -exponent;
+            memcpy(&data[len], digits, count);
+            len += count;
+        } else if ((size_t) exponent >= count) {
+            // DIGITS000
+            memcpy(&data[len], digits, count);
+            memset(&data[len + count], '0', exponent - count);
+            len += exponent;
+        } else {
+            // DIG.ITS
+            memcpy(&data[len], digits, exponent);
+            len += exponent;
+            data[len++] = '.';
+            memcpy(&data[len], &digits[exponent], count - exponent);
+            len += count - exponent;
+        }
+        data[len] = '\0';
+        return len;
+    }
+
+    // D.IGITSe+X
+    data[len++] = digits[0];
+    if (count > 1) {
+        data[len++] = '.';
+        memcpy(&data[len], &digits[1], count - 1);
+        len += count - 1;
+    }
+    data[len++] = 'e';
+    const int shown = exponent - 1;
+    data[len++] = shown < 0 ? '-' : '+';
+    return len + format_integer(shown < 0 ? -shown : shown, &data[len]);
+}
+
+size_t mtpl_number_format(const mtpl_number* number, char* data) {
+    if (number->integral) {
+        return format_integer(number->integer, data);
+    }
+    return format_real(number->real, data);
+}
+
+int mtpl_number_compare(const mtpl_number* a, const mtpl_number* b) {
+    if (a->integral && b->integral) {
+        return (a->integer > b->integer) - (a->integer < b->integer);
+    }
+    const double x = mtpl_number_real(a);
+    const double y = mtpl_number_real(b);
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,531 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define INITIAL_STATS 16
+#define INITIAL_EVENTS 256
+
+_Thread_local mtpl_profile* mtpl_active_profile = NULL;
+_Thread_local mtpl_trace* mtpl_active_trace = NULL;
+
+static uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+mtpl_result mtpl_profile_create(
+    const mtpl_allocators* allocators,
+    mtpl_profile** out_profile
+) {
+    mtpl_result result;
+    mtpl_profile* profile = mtpl_allocate(allocators, sizeof(mtpl_profile));
+    if (!profile) {
+        return MTPL_ERR_MEMORY;
+    }
+    profile->allocators = allocators;
+    profile->count = 0;
+    profile->capacity = INITIAL_STATS;
+    profile->current = NULL;
+    profile->streamed = 0;
+    profile->next = NULL;
+    profile->stats = mtpl_allocate(
+        allocators,
+        sizeof(mtpl_generator_stats) * INITIAL_STATS
+    );
+    if (!profile->stats) {
+        result = MTPL_ERR_MEMORY;
+        goto cleanup_profile;
+    }
+    result = mtpl_htable_create(allocators, &profile->names);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_stats;
+    }
+    result = mtpl_buffer_create(
+        allocators,
+        MTPL_DEFAULT_BUFSIZE,
+        &profile->name
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_names;
+    }
+
+    *out_profile = profile;
+    return MTPL_SUCCESS;
+
+cleanup_names:
+    mtpl_htable_free(allocators, profile->names);
+cleanup_stats:
+    mtpl_deallocate(allocators, profile->stats);
+cleanup_profile:
+    mtpl_deallocate(allocators, profile);
+    return result;
+}
+
+void mtpl_profile_free(mtpl_profile* profile) {
+    const mtpl_allocators* allocators = profile->allocators;
+    mtpl_buffer_free(allocators, profile->name);
+    mtpl_htable_free(allocators, profile->names);
+    mtpl_deallocate(allocators, profile->stats);
+    mtpl_deallocate(allocators, profile);
+}
+
+void mtpl_profile_enter(
+    mtpl_profile* profile,
+    mtpl_trace* trace,
+    mtpl_profile** out_previous,
+    mtpl_trace** out_previous_trace
+) {
+    *out_previous = mtpl_active_profile;
+    *out_previous_trace = mtpl_active_trace;
+    mtpl_active_profile = profile;
+    mtpl_active_trace = trace;
+}
+
+void mtpl_profile_leave(mtpl_profile* previous, mtpl_trace* previous_trace) {
+    mtpl_active_profile = previous;
+    mtpl_active_trace = previous_trace;
+}
+
+// Returns the name of the generator of a frame, made up in `storage` if it
+// has a prefix.
+static mtpl_result frame_name(
+    const mtpl_allocators* allocators,
+    const mtpl_profile_frame* frame,
+    mtpl_buffer* storage,
+    const char** out_name
+) {
+    if (!frame->prefix) {
+        *out_name = frame->name;
+        return MTPL_SUCCESS;
+    }
+    storage->cursor = 0;
+    const mtpl_slice parts[] = {
+        { frame->prefix, strlen(frame->prefix) },
+        { frame->name, strlen(frame->name) }
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        mtpl_result result = mtpl_buffer_write(&parts[i], allocators, storage);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+    }
+    *out_name = storage->data;
+    return MTPL_SUCCESS;
+}
+
+// Returns the statistics kept under `name`, adding them if there are none
+// yet. Their name refers to the key of the index, which stays in place.
+static mtpl_result find_stats(
+    mtpl_profile* profile,
+    const char* name,
+    mtpl_generator_stats** out_stats
+) {
+    const size_t* index = mtpl_htable_search(name, profile->names);
+    if (index) {
+        *out_stats = &profile->stats[*index];
+        return MTPL_SUCCESS;
+    }
+
+    const mtpl_allocators* allocators = profile->allocators;
+    if (profile->count == profile->capacity) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            profile->stats,
+            sizeof(mtpl_generator_stats) * profile->capacity * 2,
+            return MTPL_ERR_MEMORY
+        );
+        profile->capacity *= 2;
+    }
+    const size_t added = profile->count;
+    mtpl_result result = mtpl_htable_insert(
+        name,
+        &added,
+        sizeof(size_t),
+        allocators,
+        profile->names
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    profile->stats[added] = (mtpl_generator_stats) {
+        .name = mtpl_htable_lookup(name, profile->names)->key
+    };
+    profile->count++;
+    *out_stats = &profile->stats[added];
+    return MTPL_SUCCESS;
+}
+
+void mtpl_profile_push(
+    mtpl_profile* profile,
+    mtpl_profile_frame* frame,
+    const mtpl_buffer* out
+) {
+    frame->parent = profile->current;
+    frame->nested = 0;
+    frame->output_start = out->cursor + profile->streamed;
+    profile->current = frame;
+    frame->start = now();
+}
+
+mtpl_result mtpl_profile_pop(
+    mtpl_profile* profile,
+    const mtpl_profile_frame* frame,
+    const mtpl_buffer* out
+) {
+    const uint64_t elapsed = now() - frame->start;
+    profile->current = frame->parent;
+    if (frame->parent) {
+        frame->parent->nested += elapsed;
+    }
+
+    const char* name;
+    mtpl_result result = frame_name(
+        profile->allocators,
+        frame,
+        profile->name,
+        &name
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_generator_stats* stats;
+    result = find_stats(profile, name, &stats);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    stats->calls++;
+    stats->inclusive_ns += elapsed;
+    stats->exclusive_ns += elapsed - frame->nested;
+    stats->output_bytes += out->cursor + profile->streamed
+        - frame->output_start;
+    stats->argument_bytes += frame->argument_bytes;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_profile_collect(mtpl_profile** list, mtpl_profile* profile) {
+    profile->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (
+        !__atomic_compare_exchange_n(
+            list,
+            &profile->next,
+            profile,
+            true,
+            __ATOMIC_RELEASE,
+            __ATOMIC_RELAXED
+        )
+    ) {
+    }
+}
+
+mtpl_result mtpl_profile_merge(mtpl_profile* into, mtpl_profile* list) {
+    mtpl_result result = MTPL_SUCCESS;
+    while (list) {
+        for (size_t i = 0; i < list->count && result == MTPL_SUCCESS; ++i) {
+            const mtpl_generator_stats* from = &list->stats[i];
+            mtpl_generator_stats* stats;
+            result = find_stats(into, from->name, &stats);
+            if (result == MTPL_SUCCESS) {
+                stats->calls += from->calls;
+                stats->inclusive_ns += from->inclusive_ns;
+                stats->exclusive_ns += from->exclusive_ns;
+                stats->output_bytes += from->output_bytes;
+                stats->argument_bytes += from->argument_bytes;
+            }
+        }
+        mtpl_profile* next = list->next;
+        mtpl_profile_free(list);
+        list = next;
+    }
+    return result;
+}
+
+mtpl_result mtpl_trace_create(
+    const mtpl_allocators* allocators,
+    mtpl_trace** out_trace
+) {
+    mtpl_result result = MTPL_ERR_MEMORY;
+    mtpl_trace* trace = mtpl_allocate(allocators, sizeof(mtpl_trace));
+    if (!trace) {
+        return MTPL_ERR_MEMORY;
+    }
+    *trace = (mtpl_trace) {
+        .allocators = allocators,
+        .capacity = INITIAL_EVENTS,
+        .cap_names = INITIAL_STATS,
+        .origin = now(),
+        .threads = &trace->num_threads,
+        .num_threads = 1
+    };
+    trace->events = mtpl_allocate(
+        allocators,
+        sizeof(mtpl_trace_event) * INITIAL_EVENTS
+    );
+    if (!trace->events) {
+        goto cleanup_trace;
+    }
+    trace->names = mtpl_allocate(allocators, sizeof(char*) * INITIAL_STATS);
+    if (!trace->names) {
+        goto cleanup_events;
+    }
+    result = mtpl_htable_create(allocators, &trace->index);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_names;
+    }
+    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &trace->name);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_index;
+    }
+
+    *out_trace = trace;
+    return MTPL_SUCCESS;
+
+cleanup_index:
+    mtpl_htable_free(allocators, trace->index);
+cleanup_names:
+    mtpl_deallocate(allocators, trace->names);
+cleanup_events:
+    mtpl_deallocate(allocators, trace->events);
+cleanup_trace:
+    mtpl_deallocate(allocators, trace);
+    return result;
+}
+
+mtpl_result mtpl_trace_create_thread(
+    mtpl_trace* parent,
+    mtpl_trace** out_trace
+) {
+    mtpl_result result = mtpl_trace_create(parent->allocators, out_trace);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    (*out_trace)->origin = parent->origin;
+    (*out_trace)->threads = parent->threads;
+    (*out_trace)->thread = __atomic_fetch_add(
+        parent->threads,
+        1,
+        __ATOMIC_RELAXED
+    );
+    return MTPL_SUCCESS;
+}
+
+void mtpl_trace_free(mtpl_trace* trace) {
+    const mtpl_allocators* allocators = trace->allocators;
+    mtpl_buffer_free(allocators, trace->name);
+    mtpl_htable_free(allocators, trace->index);
+    mtpl_deallocate(allocators, trace->names);
+    mtpl_deallocate(allocators, trace->events);
+    mtpl_deallocate(allocators, trace);
+}
+
+// Returns the index of `name` in the names of the trace, adding it if it's
+// not there yet.
+static mtpl_result find_name(
+    mtpl_trace* trace,
+    const char* name,
+    size_t* out_index
+) {
+    const size_t* index = mtpl_htable_search(name, trace->index);
+    if (index) {
+        *out_index = *index;
+        return MTPL_SUCCESS;
+    }
+
+    const mtpl_allocators* allocators = trace->allocators;
+    if (trace->num_names == trace->cap_names) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            trace->names,
+            sizeof(char*) * trace->cap_names * 2,
+            return MTPL_ERR_MEMORY
+        );
+        trace->cap_names *= 2;
+    }
+    const size_t added = trace->num_names;
+    mtpl_result result = mtpl_htable_insert(
+        name,
+        &added,
+        sizeof(size_t),
+        allocators,
+        trace->index
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    trace->names[trace->num_names++] = mtpl_htable_lookup(
+        name,
+        trace->index
+    )->key;
+    *out_index = added;
+    return MTPL_SUCCESS;
+}
+
+static mtpl_result add_event(mtpl_trace* trace, const mtpl_trace_event* event) {
+    if (trace->count == trace->capacity) {
+        MTPL_REALLOC_CHECKED(
+            trace->allocators,
+            trace->events,
+            sizeof(mtpl_trace_event) * trace->capacity * 2,
+            return MTPL_ERR_MEMORY
+        );
+        trace->capacity *= 2;
+    }
+    trace->events[trace->count++] = *event;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_trace_begin(mtpl_trace* trace, const mtpl_profile_frame* frame) {
+    if (trace->failed) {
+        return;
+    }
+    const char* name;
+    mtpl_trace_event event = {
+        .thread = trace->thread,
+        .source = frame->source,
+        .argument_bytes = frame->argument_bytes,
+        .begin = true
+    };
+    mtpl_result result = frame_name(
+        trace->allocators,
+        frame,
+        trace->name,
+        &name
+    );
+    if (result == MTPL_SUCCESS) {
+        result = find_name(trace, name, &event.name);
+    }
+    if (result == MTPL_SUCCESS) {
+        event.time = now();
+        result = add_event(trace, &event);
+    }
+    trace->failed = result != MTPL_SUCCESS;
+}
+
+void mtpl_trace_end(mtpl_trace* trace) {
+    if (trace->failed) {
+        return;
+    }
+    const mtpl_trace_event event = { .time = now(), .thread = trace->thread };
+    trace->failed = add_event(trace, &event) != MTPL_SUCCESS;
+}
+
+void mtpl_trace_collect(mtpl_trace** list, mtpl_trace* trace) {
+    trace->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (
+        !__atomic_compare_exchange_n(
+            list,
+            &trace->next,
+            trace,
+            true,
+            __ATOMIC_RELEASE,
+            __ATOMIC_RELAXED
+        )
+    ) {
+    }
+}
+
+mtpl_result mtpl_trace_merge(mtpl_trace* into, mtpl_trace* list) {
+    mtpl_result result = MTPL_SUCCESS;
+    while (list) {
+        into->failed |= list->failed;
+        for (size_t i = 0; i < list->count && !into->failed; ++i) {
+            mtpl_trace_event event = list->events[i];
+            if (event.begin) {
+                result = find_name(into, list->names[event.name], &event.name);
+            }
+            if (result == MTPL_SUCCESS) {
+                result = add_event(into, &event);
+            }
+            into->failed = result != MTPL_SUCCESS;
+        }
+        mtpl_trace* next = list->next;
+        mtpl_trace_free(list);
+        list = next;
+    }
+    return into->failed ? MTPL_ERR_MEMORY : MTPL_SUCCESS;
+}
+
+static mtpl_result write_text(const mtpl_sink* sink, const char* text) {
+    return sink->write(sink->user, text, strlen(text));
+}
+
+// Writes `text` as a JSON string, escaping quotes, backslashes and control
+// characters.
+static mtpl_result write_json_string(const mtpl_sink* sink, const char* text) {
+    mtpl_result result = write_text(sink, "\"");
+    while (result == MTPL_SUCCESS && *text) {
+        const size_t plain = strcspn(
+            text,
+            "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+            "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f"
+        );
+        result = sink->write(sink->user, text, plain);
+        text += plain;
+        if (result == MTPL_SUCCESS && *text) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *text++);
+            result = write_text(sink, escaped);
+        }
+    }
+    if (result == MTPL_SUCCESS) {
+        result = write_text(sink, "\"");
+    }
+    return result;
+}
+
+mtpl_result mtpl_trace_write(const mtpl_trace* trace, const mtpl_sink* sink) {
+    if (trace->failed) {
+        return MTPL_ERR_MEMORY;
+    }
+    mtpl_result result = write_text(sink, "{\"traceEvents\":[");
+    for (size_t i = 0; i < trace->count && result == MTPL_SUCCESS; ++i) {
+        const mtpl_trace_event* event = &trace->events[i];
+        char text[160];
+        const double time = (event->time - trace->origin) / 1e3;
+        if (!event->begin) {
+            snprintf(
+                text,
+                sizeof(text),
+                "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f}",
+                i ? "," : "",
+                event->thread,
+                time
+            );
+            result = write_text(sink, text);
+            continue;
+        }
+        snprintf(text, sizeof(text), "%s\n{\"name\":", i ? "," : "");
+        result = write_text(sink, text);
+        if (result == MTPL_SUCCESS) {
+            result = write_json_string(sink, trace->names[event->name]);
+        }
+        if (result != MTPL_SUCCESS) {
+            break;
+        }
+        int length = snprintf(
+            text,
+            sizeof(text),
+            ",\"ph\":\"B\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,"
+            "\"args\":{\"argument_bytes\":%zu",
+            event->thread,
+            time,
+            event->argument_bytes
+        );
+        if (event->source != MTPL_NO_SOURCE) {
+            length += snprintf(
+                &text[length],
+                sizeof(text) - length,
+                ",\"offset\":%zu",
+                event->source
+            );
+        }
+        snprintf(&text[length], sizeof(text) - length, "}}");
+        result = write_text(sink, text);
+    }
+    if (result == MTPL_SUCCESS) {
+        result = write_text(sink, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    }
+    return result;
+}
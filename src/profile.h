@@ -0,0 +1,226 @@
+#pragma once
+
+#include <mintpl/buffers.h>
+#include <mintpl/common.h>
+#include <mintpl/hashtable.h>
+#include <mintpl/mintpl.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Statistics on the generators invoked while rendering, kept per generator
+// name for contexts that have profiling enabled, and traces of each of their
+// invocations for contexts that have tracing enabled.
+
+// Source offset of invocations that don't stem from a substitution.
+#define MTPL_NO_SOURCE SIZE_MAX
+
+// An invocation being timed, of the generator called `prefix` followed by
+// `name`. Frames of the invocations it makes in turn are linked to it, and add
+// the time they take to `nested`.
+typedef struct mtpl_profile_frame {
+    struct mtpl_profile_frame* parent;
+    const char* prefix;
+    const char* name;
+    size_t source;
+    size_t argument_bytes;
+    uint64_t start;
+    uint64_t nested;
+    size_t output_start;
+} mtpl_profile_frame;
+
+typedef struct mtpl_profile {
+    const mtpl_allocators* allocators;
+    mtpl_generator_stats* stats;
+    size_t count;
+    size_t capacity;
+    // Index into `stats` by name.
+    mtpl_hashtable* names;
+    // Storage for names made up of a prefix and a name.
+    mtpl_buffer* name;
+    mtpl_profile_frame* current;
+    // Output passed on to sinks, which no longer shows in output buffers.
+    size_t streamed;
+    // Next profile in a list of profiles to merge.
+    struct mtpl_profile* next;
+} mtpl_profile;
+
+// The start or end of an invocation. Ends only have their time and thread
+// set.
+typedef struct {
+    uint64_t time;
+    size_t thread;
+    size_t name;
+    size_t source;
+    size_t argument_bytes;
+    bool begin;
+} mtpl_trace_event;
+
+typedef struct mtpl_trace {
+    const mtpl_allocators* allocators;
+    mtpl_trace_event* events;
+    size_t count;
+    size_t capacity;
+    // Names of generators in order of first invocation, and their index.
+    const char** names;
+    size_t num_names;
+    size_t cap_names;
+    mtpl_hashtable* index;
+    mtpl_buffer* name;
+    // Time the trace started, shared by the traces of all threads.
+    uint64_t origin;
+    // Thread the events were recorded on. Threads are numbered using the
+    // counter of the trace started first, `num_threads`.
+    size_t thread;
+    size_t* threads;
+    size_t num_threads;
+    // Set once an event could not be recorded, after which none are.
+    bool failed;
+    struct mtpl_trace* next;
+} mtpl_trace;
+
+// Profile and trace of the render running on this thread, or NULL if not
+// profiling or tracing.
+extern _Thread_local mtpl_profile* mtpl_active_profile;
+extern _Thread_local mtpl_trace* mtpl_active_trace;
+
+mtpl_result mtpl_profile_create(
+    const mtpl_allocators* allocators,
+    mtpl_profile** out_profile
+);
+
+void mtpl_profile_free(mtpl_profile* profile);
+
+// Makes `profile` and `trace`, either of which may be NULL, active on the
+// calling thread. Returns the previously active profile and trace, which
+// should be restored using mtpl_profile_leave().
+void mtpl_profile_enter(
+    mtpl_profile* profile,
+    mtpl_trace* trace,
+    mtpl_profile** out_previous,
+    mtpl_trace** out_previous_trace
+);
+
+void mtpl_profile_leave(mtpl_profile* previous, mtpl_trace* previous_trace);
+
+void mtpl_profile_push(
+    mtpl_profile* profile,
+    mtpl_profile_frame* frame,
+    const mtpl_buffer* out
+);
+
+// Ends the invocation of `frame`, and adds it to the statistics of its
+// generator.
+mtpl_result mtpl_profile_pop(
+    mtpl_profile* profile,
+    const mtpl_profile_frame* frame,
+    const mtpl_buffer* out
+);
+
+mtpl_result mtpl_trace_create(
+    const mtpl_allocators* allocators,
+    mtpl_trace** out_trace
+);
+
+// Creates a trace for another thread, to be merged into `parent`.
+mtpl_result mtpl_trace_create_thread(
+    mtpl_trace* parent,
+    mtpl_trace** out_trace
+);
+
+void mtpl_trace_free(mtpl_trace* trace);
+
+void mtpl_trace_begin(mtpl_trace* trace, const mtpl_profile_frame* frame);
+
+void mtpl_trace_end(mtpl_trace* trace);
+
+// Writes the events as Chrome trace event JSON.
+mtpl_result mtpl_trace_write(const mtpl_trace* trace, const mtpl_sink* sink);
+
+// Starts an invocation of the generator called `prefix` followed by `name`,
+// writing to `out`, if profiling or tracing. `prefix` may be NULL, and
+// `source` MTPL_NO_SOURCE.
+static inline void mtpl_profile_begin(
+    mtpl_profile_frame* frame,
+    const char* prefix,
+    const char* name,
+    size_t source,
+    size_t argument_bytes,
+    const mtpl_buffer* out
+) {
+    if (!mtpl_active_profile && !mtpl_active_trace) {
+        return;
+    }
+    frame->prefix = prefix;
+    frame->name = name;
+    frame->argument_bytes = argument_bytes;
+    frame->source = source;
+    if (mtpl_active_trace) {
+        mtpl_trace_begin(mtpl_active_trace, frame);
+    }
+    if (mtpl_active_profile) {
+        mtpl_profile_push(mtpl_active_profile, frame, out);
+    }
+}
+
+// Ends an invocation started by mtpl_profile_begin(). Returns `result`, or
+// an error if its statistics could not be kept.
+static inline mtpl_result mtpl_profile_end(
+    const mtpl_profile_frame* frame,
+    const mtpl_buffer* out,
+    mtpl_result result
+) {
+    if (mtpl_active_trace) {
+        mtpl_trace_end(mtpl_active_trace);
+    }
+    if (!mtpl_active_profile) {
+        return result;
+    }
+    const mtpl_result recorded = mtpl_profile_pop(
+        mtpl_active_profile,
+        frame,
+        out
+    );
+    return result == MTPL_SUCCESS ? recorded : result;
+}
+
+// Moves the frame of an invocation in progress to `to`, so that it may
+// outlast the function that started it. Frames of the invocations nested in
+// it are linked to the new place.
+static inline void mtpl_profile_move(
+    mtpl_profile_frame* from,
+    mtpl_profile_frame* to
+) {
+    if (!mtpl_active_profile && !mtpl_active_trace) {
+        return;
+    }
+    *to = *from;
+    if (mtpl_active_profile) {
+        mtpl_profile_frame** link = &mtpl_active_profile->current;
+        while (*link != from) {
+            link = &(*link)->parent;
+        }
+        *link = to;
+    }
+}
+
+// Counts output passed on to a sink, if profiling.
+static inline void mtpl_profile_stream(size_t length) {
+    if (mtpl_active_profile) {
+        mtpl_active_profile->streamed += length;
+    }
+}
+
+// Adds `profile` to a list of profiles kept on other threads, which may be
+// added to by several threads at once.
+void mtpl_profile_collect(mtpl_profile** list, mtpl_profile* profile);
+
+// Adds up the statistics of a list of profiles in `into`, and frees them.
+mtpl_result mtpl_profile_merge(mtpl_profile* into, mtpl_profile* list);
+
+// Like mtpl_profile_collect() and mtpl_profile_merge(), for traces. Events
+// of merged traces are added to those of `into`.
+void mtpl_trace_collect(mtpl_trace** list, mtpl_trace* trace);
+
+mtpl_result mtpl_trace_merge(mtpl_trace* into, mtpl_trace* list);
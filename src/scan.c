@@ -0,0 +1,101 @@
+#include "scan.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Reading whole aligned blocks may touch bytes past the terminator, which is
+// safe since it never crosses a page, but not something a sanitizer accepts.
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef NO_SANITIZE_ADDRESS
+#define NO_SANITIZE_ADDRESS
+#endif
+
+inline static bool is_special(char c) {
+    switch (c) {
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case '\\':
+    case '\0':
+        return true;
+    default:
+        return false;
+    }
+}
+
+#ifdef __SSE2__
+
+// Bit mask of the special characters within a block of 16 bytes. Setting bit
+// 5 folds '[' and ']' onto '{' and '}', leaving four comparisons.
+inline static unsigned special_mask(__m128i block) {
+    const __m128i folded = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    const __m128i found = _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+            _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))
+        ),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')),
+            _mm_cmpeq_epi8(block, _mm_setzero_si128())
+        )
+    );
+    return (unsigned) _mm_movemask_epi8(found);
+}
+
+NO_SANITIZE_ADDRESS size_t mtpl_scan_text(const char* data) {
+    // Start at the enclosing aligned block, ignoring the bytes before `data`.
+    const uintptr_t misalignment = (uintptr_t) data & 15;
+    const char* block = data - misalignment;
+    unsigned mask = special_mask(_mm_load_si128((const __m128i*) block))
+        >> misalignment << misalignment;
+    while (!mask) {
+        block += 16;
+        mask = special_mask(_mm_load_si128((const __m128i*) block));
+    }
+    return (size_t) (block - data) + __builtin_ctz(mask);
+}
+
+size_t mtpl_scan_text_n(const char* data, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const unsigned mask = special_mask(
+            _mm_loadu_si128((const __m128i*) &data[i])
+        );
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    while (i < length && !is_special(data[i])) {
+        i++;
+    }
+    return i;
+}
+
+#else
+
+size_t mtpl_scan_text(const char* data) {
+    // The null character is always part of the rejected set.
+    return strcspn(data, "[]{}\\");
+}
+
+size_t mtpl_scan_text_n(const char* data, size_t length) {
+    size_t i = 0;
+    while (i < length && !is_special(data[i])) {
+        i++;
+    }
+    return i;
+}
+
+#endif
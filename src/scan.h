@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+// Scanning for the characters that end a run of literal text: brackets,
+// braces, backslashes and null characters.
+
+// Length of the literal run at the start of the null terminated `data`.
+size_t mtpl_scan_text(const char* data);
+
+// Length of the literal run at the start of the `length` bytes at `data`,
+// which need not be terminated.
+size_t mtpl_scan_text_n(const char* data, size_t length);
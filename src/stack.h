@@ -19,16 +19,19 @@
 #define PEEK_BACK(TYPE) PEEK_BACK_SYM(STACK(TYPE))
 
 #define DEFINE_CREATE_STACK(TYPE)\
-    static STACK(TYPE)* CREATE_STACK(TYPE)(\
+    static inline STACK(TYPE)* CREATE_STACK(TYPE)(\
         const mtpl_allocators* allocators\
     ) {\
-        STACK(TYPE)* stack = allocators->malloc(sizeof(STACK(TYPE)));\
+        STACK(TYPE)* stack = mtpl_allocate(allocators, sizeof(STACK(TYPE)));\
         if (!stack) {\
             return NULL;\
         }\
-        stack->entries = allocators->malloc(sizeof(TYPE) * INITIAL_STACK);\
+        stack->entries = mtpl_allocate(\
+            allocators,\
+            sizeof(TYPE) * INITIAL_STACK\
+        );\
         if (!stack->entries) {\
-            allocators->free(stack);\
+            mtpl_deallocate(allocators, stack);\
             return NULL;\
         }\
         stack->allocators = allocators;\
@@ -38,13 +41,16 @@
     }
 
 #define DEFINE_FREE_STACK(TYPE)\
-    static void FREE_STACK(TYPE)(STACK(TYPE)* stack) {\
-        stack->allocators->free(stack->entries);\
-        stack->allocators->free(stack);\
+    static inline void FREE_STACK(TYPE)(STACK(TYPE)* stack) {\
+        mtpl_deallocate(stack->allocators, stack->entries);\
+        mtpl_deallocate(stack->allocators, stack);\
     }
 
 #define DEFINE_PUSH_BACK(TYPE)\
-    static mtpl_result PUSH_BACK(TYPE)(STACK(TYPE)* stack, const TYPE* value) {\
+    static inline mtpl_result PUSH_BACK(TYPE)(\
+        STACK(TYPE)* stack,\
+        const TYPE* value\
+    ) {\
         if (stack->num_entries == stack->cap_entries) {\
             MTPL_REALLOC_CHECKED(\
                 stack->allocators,\
@@ -59,7 +65,7 @@
     }
 
 #define DEFINE_POP_BACK(TYPE)\
-    static TYPE* POP_BACK(TYPE)(STACK(TYPE)* stack) {\
+    static inline TYPE* POP_BACK(TYPE)(STACK(TYPE)* stack) {\
         if (!stack->num_entries) {\
             return NULL;\
         }\
@@ -67,7 +73,7 @@
     }
 
 #define DEFINE_PEEK_BACK(TYPE)\
-    static TYPE* PEEK_BACK(TYPE)(STACK(TYPE)* stack) {\
+    static inline TYPE* PEEK_BACK(TYPE)(STACK(TYPE)* stack) {\
         if (!stack->num_entries) {\
             return NULL;\
         }\
@@ -2,42 +2,183 @@
 
 #include <mintpl/generators.h>
 
+#include "arena.h"
+#include "budget.h"
+#include "continuation.h"
+#include "profile.h"
+#include "scan.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define NO_TEXT_RUN SIZE_MAX
+#define NO_SUBSTITUTION SIZE_MAX
+
+// Literal text run at `index` of a program, written to a buffer at `at`.
+typedef struct {
+    size_t index;
+    size_t at;
+} mtpl__run;
+
+// Template compiled from bytes `offset` up until `offset + length` of the
+// text pool of a program, kept by the literal text run they are part of,
+// along with the storage of this entry. Templates are either those bytes
+// as they are, or if `extracted`, the substitution or word that
+// mtpl_buffer_extract_sub() takes from them.
+struct mtpl_quoted {
+    struct mtpl_quoted* next;
+    size_t offset;
+    size_t length;
+    bool extracted;
+    mtpl_program* program;
+    mtpl_buffer* storage;
+};
+
+// Sink of the render running on this thread, along with its staging buffer.
+typedef struct {
+    const mtpl_sink* sink;
+    mtpl_buffer* buffer;
+} mtpl__sink_state;
+
+static _Thread_local mtpl__sink_state active_sink = { NULL, NULL };
+
 inline static bool is_whitespace(char c) {
     return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
-static mtpl_result perform_substitution(
-    mtpl_generator generator,
+static mtpl_result push_instruction(
+    const mtpl_allocators* allocators,
+    mtpl_program* program,
+    const mtpl_instruction* instruction,
+    size_t* out_index
+) {
+    if (program->num_instructions == program->cap_instructions) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            program->instructions,
+            sizeof(mtpl_instruction) * program->cap_instructions * 2,
+            return MTPL_ERR_MEMORY
+        );
+        program->cap_instructions *= 2;
+    }
+    *out_index = program->num_instructions;
+    program->instructions[program->num_instructions++] = *instruction;
+    return MTPL_SUCCESS;
+}
+
+// Appends `length` bytes of literal text to the current text run, starting a
+// new run if needed.
+static mtpl_result append_text(
+    const mtpl_allocators* allocators,
+    mtpl_program* program,
+    size_t* run,
+    const char* data,
+    size_t length
+) {
+    mtpl_buffer* text = program->text;
+    if (*run == NO_TEXT_RUN) {
+        const mtpl_instruction literal = { NULL, text->cursor, 0, 0 };
+        mtpl_result result = push_instruction(
+            allocators,
+            program,
+            &literal,
+            run
+        );
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+    }
+    if (text->cursor + length >= text->size) {
+        size_t size = text->size * 2;
+        while (text->cursor + length >= size) {
+            size *= 2;
+        }
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            text->data,
+            size,
+            return MTPL_ERR_MEMORY
+        );
+        text->size = size;
+    }
+    memcpy(&text->data[text->cursor], data, length);
+    text->cursor += length;
+    text->data[text->cursor] = '\0';
+    program->instructions[*run].length += length;
+    return MTPL_SUCCESS;
+}
+
+// Whether the first argument of the substitution at `index` is made up by
+// the substitution at `index + 1` alone, rather than just starting with it.
+static bool is_sole_first_argument(const mtpl_program* program, size_t index) {
+    const mtpl_instruction* substitution = &program->instructions[index];
+    const size_t next = program->instructions[index + 1].skip;
+    if (next == substitution->skip) {
+        return true;
+    }
+    // Otherwise, it must be followed by whitespace.
+    const mtpl_instruction* rest = &program->instructions[next];
+    return !rest->generator
+        && rest->length
+        && is_whitespace(program->text->data[rest->offset]);
+}
+
+// Refers the substitution at `index` to the list or range variant of its
+// generator, if its first argument is nothing but a property reference or a
+// range.
+static void resolve_first_argument(mtpl_program* program, size_t index) {
+    mtpl_instruction* instructions = program->instructions;
+    mtpl_instruction* substitution = &instructions[index];
+    if (substitution->skip == index + 1 || !instructions[index + 1].generator) {
+        return;
+    }
+    const mtpl_instruction* argument = &instructions[index + 1];
+    if (argument->generator == mtpl_generator_replace) {
+        const mtpl_list_generator list = mtpl_generator_list_variant(
+            substitution->generator
+        );
+        if (
+            list
+            && argument->skip == index + 3
+            && !instructions[index + 2].generator
+            && is_sole_first_argument(program, index)
+        ) {
+            substitution->list = list;
+        }
+    } else if (argument->generator == mtpl_generator_range) {
+        const mtpl_range_generator range = mtpl_generator_range_variant(
+            substitution->generator
+        );
+        if (range && is_sole_first_argument(program, index)) {
+            substitution->range = range;
+        }
+    }
+}
+
+// Compiles the template without recursing into nested substitutions. Until
+// it is closed, a substitution has the index of the substitution enclosing it
+// as its `skip`, so that the open substitutions make up a stack of their own.
+static mtpl_result compile_template(
     const mtpl_allocators* allocators,
     mtpl_readbuffer* source,
     mtpl_hashtable* generators,
-    mtpl_hashtable* properties,
-    mtpl_buffer* out_buffer,
-    bool nested
+    mtpl_buffer* gen_name,
+    mtpl_program* program
 ) {
-    mtpl_generator sub_generator;
     mtpl_result result;
-    mtpl_buffer* gen_name;
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &gen_name);
-    if (result != MTPL_SUCCESS) {
-        return result;
-    }
-    mtpl_buffer* arg_buffer;
-    result = mtpl_buffer_create(allocators, MTPL_DEFAULT_BUFSIZE, &arg_buffer);
-    if (result != MTPL_SUCCESS) {
-        goto cleanup_gen_name;
-    }
-    memset(arg_buffer->data, 0, MTPL_DEFAULT_BUFSIZE);
+    size_t run = NO_TEXT_RUN;
+    size_t open = NO_SUBSTITUTION;
+    size_t index;
 
     while (true) {
         switch (source->data[source->cursor]) {
         case '[':
             source->cursor++;
-            // Lookup generator name and begin new substitution.
+            const size_t start = source->cursor - 1;
+            // Resolve generator name and open the nested substitution.
+            gen_name->cursor = 0;
             result = mtpl_buffer_extract(
                 '>',
                 allocators,
@@ -46,62 +187,94 @@ static mtpl_result perform_substitution(
             );
             const char c = source->data[source->cursor - 1];
             if (result != MTPL_SUCCESS) {
-                goto cleanup_arg_buffer;
+                return result;
             } else if (c != '>' && !is_whitespace(c)) {
-                result = MTPL_ERR_SYNTAX;
-                goto cleanup_arg_buffer;
+                return MTPL_ERR_SYNTAX;
             }
-            sub_generator = mtpl_htable_search(gen_name->data, generators);
+            const void* sub_generator = mtpl_htable_search(
+                gen_name->data,
+                generators
+            );
             if (!sub_generator) {
-                result = MTPL_ERR_UNKNOWN_KEY;
-                goto cleanup_arg_buffer;
+                return MTPL_ERR_UNKNOWN_KEY;
             }
-            gen_name->cursor = 0;
-            result = perform_substitution(
-                *(void**) sub_generator,
+            // Keep the name along with the text, for profiling.
+            const mtpl_instruction substitution = {
+                .generator = *(const mtpl_generator*) sub_generator,
+                .offset = program->text->cursor,
+                .length = gen_name->cursor,
+                .skip = open,
+                .source = start
+            };
+            const mtpl_slice name = { gen_name->data, gen_name->cursor };
+            result = mtpl_buffer_write(&name, allocators, program->text);
+            if (result != MTPL_SUCCESS) {
+                return result;
+            }
+            program->text->cursor++;
+            result = push_instruction(
                 allocators,
-                source,
-                generators,
-                properties,
-                arg_buffer,
-                true
+                program,
+                &substitution,
+                &index
             );
             if (result != MTPL_SUCCESS) {
-                goto cleanup_arg_buffer;
+                return result;
             }
+            open = index;
+            run = NO_TEXT_RUN;
             break;
         case '{':
+            if (run == NO_TEXT_RUN) {
+                const mtpl_instruction literal = {
+                    NULL,
+                    program->text->cursor,
+                    0,
+                    0
+                };
+                result = push_instruction(
+                    allocators,
+                    program,
+                    &literal,
+                    &run
+                );
+                if (result != MTPL_SUCCESS) {
+                    return result;
+                }
+            }
+            const size_t quote_start = program->text->cursor;
             result = mtpl_buffer_extract_sub(
                 allocators,
                 false,
                 (mtpl_buffer*) source,
-                arg_buffer
+                program->text
             );
             if (result != MTPL_SUCCESS) {
-                goto cleanup_arg_buffer;
+                return result;
             }
-            if (source->data[source->cursor] == '}') {
-                source->cursor++;
-            } else {
-                result = MTPL_ERR_SYNTAX;
-                goto cleanup_arg_buffer;
+            if (source->data[source->cursor] != '}') {
+                return MTPL_ERR_SYNTAX;
             }
-
+            source->cursor++;
+            program->instructions[run].length
+                += program->text->cursor - quote_start;
             break;
         case '}':
-            result = MTPL_ERR_SYNTAX;
-            goto cleanup_arg_buffer;
+            return MTPL_ERR_SYNTAX;
         case ']':
-            if (!nested) {
-                result = MTPL_ERR_SYNTAX;
-                goto cleanup_arg_buffer;
+            if (open == NO_SUBSTITUTION) {
+                return MTPL_ERR_SYNTAX;
             }
             source->cursor++;
-            nested = false;
-            // Fall through.
+            index = open;
+            open = program->instructions[index].skip;
+            program->instructions[index].skip = program->num_instructions;
+            resolve_first_argument(program, index);
+            run = NO_TEXT_RUN;
+            break;
         case '\0':
-            // End current substitution and return to parent.
-            goto finish_substitution;
+            // Reaching the end of input within a substitution is an error.
+            return open != NO_SUBSTITUTION ? MTPL_ERR_SYNTAX : MTPL_SUCCESS;
         case '\\':
             // If next character is whitespace, don't read it.
             if (is_whitespace(source->data[source->cursor + 1])) {
@@ -110,70 +283,1482 @@ static mtpl_result perform_substitution(
             }
             // Escape next character if not 0.
             if (!source->data[++(source->cursor)]) {
-                result = MTPL_ERR_SYNTAX;
-                goto cleanup_arg_buffer;
+                return MTPL_ERR_SYNTAX;
             }
-            // Fall through.
-        default:
-            // Read into the arg buffer.
-            if (arg_buffer->cursor >= arg_buffer->size) {
-                MTPL_REALLOC_CHECKED(
-                    allocators,
-                    arg_buffer->data,
-                    arg_buffer->size * 2, {
-                        result = MTPL_ERR_MEMORY;
-                        goto cleanup_arg_buffer;
-                    }
-                );
-                arg_buffer->size *= 2;
+            result = append_text(
+                allocators,
+                program,
+                &run,
+                &source->data[source->cursor++],
+                1
+            );
+            if (result != MTPL_SUCCESS) {
+                return result;
+            }
+            break;
+        default: {
+            // Copy the whole run of plain text up to the next special
+            // character at once.
+            const char* text = &source->data[source->cursor];
+            const size_t length = mtpl_scan_text(text);
+            result = append_text(allocators, program, &run, text, length);
+            if (result != MTPL_SUCCESS) {
+                return result;
             }
-            arg_buffer->data[arg_buffer->cursor++]
-                = source->data[source->cursor++];
+            source->cursor += length;
             break;
         }
+        }
+    }
+}
+
+// Hands staged output over to the sink if `out_buffer` is the staging buffer,
+// and it has grown large enough (or whenever `force` is set).
+static mtpl_result flush_output(mtpl_buffer* out_buffer, bool force) {
+    if (
+        out_buffer != active_sink.buffer
+        || !out_buffer->cursor
+        || (!force && out_buffer->cursor < MTPL_DEFAULT_BUFSIZE)
+    ) {
+        return MTPL_SUCCESS;
+    }
+    mtpl_result result = active_sink.sink->write(
+        active_sink.sink->user,
+        out_buffer->data,
+        out_buffer->cursor
+    );
+    mtpl_profile_stream(out_buffer->cursor);
+    if (result == MTPL_SUCCESS) {
+        result = mtpl_budget_stream(out_buffer->cursor);
+    }
+    out_buffer->cursor = 0;
+    out_buffer->data[0] = '\0';
+    return result;
+}
+
+// A run of instructions of `program` being evaluated into `out`, looking up
+// properties in `properties`. Runs other than the outermost one either make
+// up the argument of the substitution at `substitution`, with `out` as its
+// argument buffer, or a template of `continuation`. The arguments of range
+// substitutions are evaluated in two parts, the first of which is the range
+// itself, parsed into `range` once `range_pending` is cleared.
+// Arguments also note the literal text run last written to them, in
+// `last_run`.
+typedef struct {
+    const mtpl_program* program;
+    mtpl_hashtable* properties;
+    size_t substitution;
+    size_t next;
+    size_t end;
+    mtpl_buffer* out;
+    mtpl_continuation* continuation;
+    bool range_pending;
+    mtpl_range range;
+    size_t range_length;
+    mtpl__run last_run;
+} mtpl__frame;
+
+// Generator the evaluator on this thread is calling, its invocation, and the
+// continuation it has handed over, if any. The arguments of the call are
+// kept, along with the literal text run of `program` last written to them,
+// for generators to find the templates quoted in them.
+typedef struct {
+    mtpl_generator generator;
+    mtpl_profile_frame* invocation;
+    mtpl_continuation* continuation;
+    const mtpl_program* program;
+    const mtpl_buffer* arg;
+    mtpl__run run;
+} mtpl__call;
+
+static _Thread_local mtpl__call active_call = { NULL, NULL, NULL };
+
+// The evaluator keeps its frames in a pooled buffer, rather than recursing
+// for each nested substitution.
+static mtpl__frame* top_frame(const mtpl_buffer* frames) {
+    return (mtpl__frame*) &frames->data[frames->cursor - sizeof(mtpl__frame)];
+}
+
+static mtpl_result push_frame(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* frames,
+    const mtpl__frame* frame
+) {
+    if (frames->cursor + sizeof(mtpl__frame) > frames->size) {
+        size_t size = frames->size * 2;
+        while (frames->cursor + sizeof(mtpl__frame) > size) {
+            size *= 2;
+        }
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            frames->data,
+            size,
+            return MTPL_ERR_MEMORY
+        );
+        frames->size = size;
+    }
+    memcpy(&frames->data[frames->cursor], frame, sizeof(mtpl__frame));
+    frames->cursor += sizeof(mtpl__frame);
+    return MTPL_SUCCESS;
+}
+
+// Starts the profiled call of the generator of `substitution`, if profiling
+// or tracing.
+static void begin_call(
+    mtpl_profile_frame* frame,
+    const mtpl_program* program,
+    const mtpl_instruction* substitution,
+    size_t argument_bytes,
+    const mtpl_buffer* out_buffer
+) {
+    mtpl_profile_begin(
+        frame,
+        NULL,
+        &program->text->data[substitution->offset],
+        substitution->source,
+        argument_bytes,
+        out_buffer
+    );
+}
+
+// Starts an invocation of the generator of `substitution`, if it is within
+// budget. Returns the call to restore once the generator has returned.
+static mtpl_result begin_invocation(
+    mtpl_profile_frame* frame,
+    const mtpl_program* program,
+    const mtpl_instruction* substitution,
+    const mtpl_buffer* arg_buffer,
+    const mtpl__run* last_run,
+    size_t argument_bytes,
+    const mtpl_buffer* out_buffer,
+    mtpl__call* out_previous
+) {
+    const mtpl_result result = mtpl_budget_call();
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    begin_call(frame, program, substitution, argument_bytes, out_buffer);
+    *out_previous = active_call;
+    active_call = (mtpl__call) {
+        substitution->generator,
+        frame,
+        NULL,
+        program,
+        arg_buffer,
+        *last_run
+    };
+    return MTPL_SUCCESS;
+}
+
+// Ends the invocation of a generator once it has run its continuation, if it
+// handed one over, and releases the continuation.
+static mtpl_result end_continuation(
+    const mtpl_allocators* allocators,
+    mtpl_continuation* continuation,
+    mtpl_buffer* out_buffer,
+    mtpl_result result
+) {
+    result = continuation->finish(continuation, allocators, result);
+    result = mtpl_profile_end(&continuation->call, out_buffer, result);
+    result = mtpl_budget_return(out_buffer->cursor, result);
+    mtpl_arena_release_buffer(allocators, continuation->storage);
+    return result;
+}
+
+// Ends the invocation of a generator that has returned `result`, unless it
+// handed over a continuation, which is left in `out_continuation` for the
+// invocation to end once it is done.
+static mtpl_result end_invocation(
+    const mtpl_allocators* allocators,
+    mtpl_profile_frame* frame,
+    const mtpl__call* previous,
+    mtpl_buffer* out_buffer,
+    mtpl_result result,
+    mtpl_continuation** out_continuation
+) {
+    mtpl_continuation* continuation = active_call.continuation;
+    active_call = *previous;
+    if (!continuation) {
+        result = mtpl_profile_end(frame, out_buffer, result);
+        return mtpl_budget_return(out_buffer->cursor, result);
+    } else if (result != MTPL_SUCCESS) {
+        return end_continuation(allocators, continuation, out_buffer, result);
+    }
+    *out_continuation = continuation;
+    return MTPL_SUCCESS;
+}
+
+// Accounts for the call of the substitution at `index` that a list or range
+// variant stands in for: as a step of the render, and in the profile and
+// trace, as if it had written `output_bytes` to the argument buffer.
+static mtpl_result account_elided_call(
+    const mtpl_program* program,
+    size_t index,
+    size_t argument_bytes,
+    size_t output_bytes
+) {
+    mtpl_result result = mtpl_budget_call();
+    if (result != MTPL_SUCCESS) {
+        return result;
     }
+    mtpl_buffer output = { .cursor = 0 };
+    mtpl_profile_frame frame;
+    begin_call(
+        &frame,
+        program,
+        &program->instructions[index],
+        argument_bytes,
+        &output
+    );
+    output.cursor = output_bytes;
+    result = mtpl_profile_end(&frame, &output, MTPL_SUCCESS);
+    return mtpl_budget_return(output_bytes, result);
+}
+
+// Calls the list variant of the substitution at `index`, handing it the list
+// property rather than a copy of its value.
+static mtpl_result call_list_generator(
+    const mtpl_program* program,
+    size_t index,
+    const mtpl__run* last_run,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* arg_buffer,
+    mtpl_buffer* out_buffer,
+    mtpl_continuation** out_continuation
+) {
+    const mtpl_instruction* substitution = &program->instructions[index];
+    const mtpl_instruction* name = &program->instructions[index + 2];
 
-finish_substitution:
-    if (nested) {
-        result = MTPL_ERR_SYNTAX;
-        goto cleanup_arg_buffer;
+    // Look the property up only once the remaining arguments have been run,
+    // as they may add to the properties. The name is kept past the
+    // terminator of the arguments.
+    const size_t arg_length = arg_buffer->cursor++;
+    const mtpl_slice text = {
+        &program->text->data[name->offset],
+        name->length
+    };
+    mtpl_result result = mtpl_buffer_write(&text, allocators, arg_buffer);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_hashentry* list = mtpl_htable_lookup(
+        &arg_buffer->data[arg_length + 1],
+        properties
+    );
+    result = account_elided_call(
+        program,
+        index + 1,
+        name->length,
+        list ? mtpl_htable_entry_string(list).length : 0
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    if (!list) {
+        return MTPL_ERR_UNKNOWN_KEY;
     }
     arg_buffer->cursor = 0;
-    result = generator(
+    arg_buffer->data[arg_length] = '\0';
+    mtpl_profile_frame frame;
+    mtpl__call previous;
+    result = begin_invocation(
+        &frame,
+        program,
+        substitution,
+        arg_buffer,
+        last_run,
+        mtpl_htable_entry_string(list).length + arg_length,
+        out_buffer,
+        &previous
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = substitution->list(
         allocators,
+        list,
         arg_buffer,
         generators,
         properties,
         out_buffer
     );
+    return end_invocation(
+        allocators,
+        &frame,
+        &previous,
+        out_buffer,
+        result,
+        out_continuation
+    );
+}
 
-cleanup_arg_buffer:
-    mtpl_buffer_free(allocators, arg_buffer);
-cleanup_gen_name:
-    mtpl_buffer_free(allocators, gen_name);
-    return result;
+// Calls the range variant of the substitution at `index`, handing it the
+// range rather than the list of numbers it makes up.
+static mtpl_result call_range_generator(
+    const mtpl_program* program,
+    size_t index,
+    const mtpl__run* last_run,
+    const mtpl_range* range,
+    size_t range_length,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* arg_buffer,
+    mtpl_buffer* out_buffer,
+    mtpl_continuation** out_continuation
+) {
+    const mtpl_instruction* substitution = &program->instructions[index];
+    const size_t arg_length = arg_buffer->cursor;
+    arg_buffer->cursor = 0;
+    mtpl_profile_frame frame;
+    mtpl__call previous;
+    mtpl_result result = begin_invocation(
+        &frame,
+        program,
+        substitution,
+        arg_buffer,
+        last_run,
+        range_length + arg_length,
+        out_buffer,
+        &previous
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = substitution->range(
+        allocators,
+        range,
+        arg_buffer,
+        generators,
+        properties,
+        out_buffer
+    );
+    return end_invocation(
+        allocators,
+        &frame,
+        &previous,
+        out_buffer,
+        result,
+        out_continuation
+    );
 }
 
-mtpl_result mtpl_substitute(
-    const char* source,
+static mtpl_result call_generator(
+    const mtpl_program* program,
+    size_t index,
+    const mtpl__run* last_run,
     const mtpl_allocators* allocators,
     mtpl_hashtable* generators,
     mtpl_hashtable* properties,
-    mtpl_buffer* out_buffer
+    mtpl_buffer* arg_buffer,
+    mtpl_buffer* out_buffer,
+    mtpl_continuation** out_continuation
 ) {
-    mtpl_readbuffer buffer = {
-        .data = source,
-        .cursor = 0,
-        .size = 0
-    };
-    return perform_substitution(
-        mtpl_generator_copy,
+    const mtpl_instruction* substitution = &program->instructions[index];
+    const size_t arg_length = arg_buffer->cursor;
+    arg_buffer->cursor = 0;
+    mtpl_profile_frame frame;
+    mtpl__call previous;
+    mtpl_result result = begin_invocation(
+        &frame,
+        program,
+        substitution,
+        arg_buffer,
+        last_run,
+        arg_length,
+        out_buffer,
+        &previous
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = substitution->generator(
         allocators,
-        &buffer,
+        arg_buffer,
         generators,
         properties,
+        out_buffer
+    );
+    return end_invocation(
+        allocators,
+        &frame,
+        &previous,
         out_buffer,
-        false
+        result,
+        out_continuation
     );
 }
 
+static mtpl_result write_text(
+    const mtpl_program* program,
+    const mtpl_instruction* instruction,
+    const mtpl_allocators* allocators,
+    mtpl_buffer* out_buffer
+) {
+    const mtpl_slice text = {
+        &program->text->data[instruction->offset],
+        instruction->length
+    };
+    if (out_buffer != active_sink.buffer) {
+        return mtpl_buffer_write(&text, allocators, out_buffer);
+    }
+    // Pass literal text straight on to the sink.
+    mtpl_result result = flush_output(out_buffer, true);
+    if (result == MTPL_SUCCESS) {
+        result = active_sink.sink->write(
+            active_sink.sink->user,
+            text.data,
+            text.length
+        );
+        mtpl_profile_stream(text.length);
+    }
+    if (result == MTPL_SUCCESS) {
+        result = mtpl_budget_stream(text.length);
+    }
+    return result;
+}
+
+// Pushes a frame for the arguments of the substitution at `index` of the
+// frame on top, which goes on past them once they are done.
+static mtpl_result open_substitution(
+    size_t index,
+    const mtpl_allocators* allocators,
+    mtpl_buffer* frames
+) {
+    mtpl__frame* frame = top_frame(frames);
+    const mtpl_program* program = frame->program;
+    const mtpl_instruction* substitution = &program->instructions[index];
+    frame->next = substitution->skip;
+    mtpl__frame arguments = {
+        .program = program,
+        .properties = frame->properties,
+        .substitution = index,
+        .next = index + 1,
+        .end = substitution->skip,
+        .continuation = NULL,
+        .range_pending = false,
+        .last_run = { NO_TEXT_RUN, 0 }
+    };
+    if (substitution->list) {
+        // Skip the property reference, which is looked up once called.
+        arguments.next = index + 3;
+    } else if (substitution->range) {
+        arguments.next = index + 2;
+        arguments.end = program->instructions[index + 1].skip;
+        arguments.range_pending = true;
+    }
+    mtpl_result result = mtpl_arena_buffer(allocators, &arguments.out);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = push_frame(allocators, frames, &arguments);
+    if (result != MTPL_SUCCESS) {
+        mtpl_arena_release_buffer(allocators, arguments.out);
+    }
+    return result;
+}
+
+// Has the continuation set up its next template, if it has not already.
+static mtpl_result next_template(
+    mtpl_continuation* continuation,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators
+) {
+    if (continuation->program || !continuation->resume) {
+        return MTPL_SUCCESS;
+    }
+    return continuation->resume(continuation, allocators, generators);
+}
+
+// Points `frame` at the template the continuation has set up.
+static void enter_template(
+    mtpl__frame* frame,
+    mtpl_continuation* continuation
+) {
+    frame->program = continuation->program;
+    frame->properties = continuation->properties;
+    frame->next = 0;
+    frame->end = continuation->program->num_instructions;
+    frame->out = continuation->out;
+}
+
+// Pushes a frame for the templates of a continuation handed over by a
+// generator writing to the frame on top, or ends the invocation of the
+// generator right away if there are none.
+static mtpl_result start_continuation(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_continuation* continuation,
+    mtpl_buffer* frames
+) {
+    mtpl_buffer* out_buffer = top_frame(frames)->out;
+    mtpl_result result = next_template(continuation, allocators, generators);
+    if (result != MTPL_SUCCESS || !continuation->program) {
+        result = end_continuation(
+            allocators,
+            continuation,
+            out_buffer,
+            result
+        );
+        if (result == MTPL_SUCCESS) {
+            result = flush_output(out_buffer, false);
+        }
+        return result;
+    }
+    mtpl__frame frame = {
+        .substitution = NO_SUBSTITUTION,
+        .continuation = continuation,
+        .range_pending = false
+    };
+    enter_template(&frame, continuation);
+    result = push_frame(allocators, frames, &frame);
+    if (result != MTPL_SUCCESS) {
+        end_continuation(allocators, continuation, out_buffer, result);
+    }
+    return result;
+}
+
+// Goes on with the next template of the continuation on top, whose previous
+// template is done, or pops its frame and ends the invocation of its
+// generator if there are no more.
+static mtpl_result resume_continuation(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_buffer* frames
+) {
+    mtpl__frame* frame = top_frame(frames);
+    mtpl_continuation* continuation = frame->continuation;
+    continuation->program = NULL;
+    mtpl_result result = next_template(continuation, allocators, generators);
+    if (result == MTPL_SUCCESS && continuation->program) {
+        enter_template(frame, continuation);
+        return MTPL_SUCCESS;
+    }
+    frames->cursor -= sizeof(mtpl__frame);
+    mtpl_buffer* out_buffer = top_frame(frames)->out;
+    result = end_continuation(allocators, continuation, out_buffer, result);
+    if (result == MTPL_SUCCESS) {
+        result = flush_output(out_buffer, false);
+    }
+    return result;
+}
+
+// Calls the generator of the substitution on top, whose arguments are done,
+// and pops its frame. The range of a range substitution is parsed first, and
+// the rest of its arguments are evaluated before calling it. Any
+// continuation the generator hands over is started in place of the frame.
+static mtpl_result close_substitution(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_buffer* frames
+) {
+    mtpl__frame* frame = top_frame(frames);
+    const mtpl_program* program = frame->program;
+    mtpl_hashtable* properties = frame->properties;
+    const mtpl_instruction* substitution =
+        &program->instructions[frame->substitution];
+    mtpl_buffer* arg_buffer = frame->out;
+    if (frame->range_pending) {
+        frame->range_pending = false;
+        frame->range_length = arg_buffer->cursor;
+        frame->next = frame->end;
+        frame->end = substitution->skip;
+        frame->last_run.index = NO_TEXT_RUN;
+        arg_buffer->cursor = 0;
+        const mtpl_result result = mtpl_range_parse(
+            arg_buffer->data,
+            &frame->range
+        );
+        arg_buffer->data[0] = '\0';
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+        // The numbers of the range are never written out, and so aren't
+        // counted as output of its call.
+        return account_elided_call(
+            program,
+            frame->substitution + 1,
+            frame->range_length,
+            0
+        );
+    }
+
+    const mtpl__frame done = *frame;
+    frames->cursor -= sizeof(mtpl__frame);
+    mtpl_buffer* out_buffer = top_frame(frames)->out;
+    mtpl_continuation* continuation = NULL;
+    mtpl_result result;
+    if (substitution->list) {
+        result = call_list_generator(
+            program,
+            done.substitution,
+            &done.last_run,
+            allocators,
+            generators,
+            properties,
+            arg_buffer,
+            out_buffer,
+            &continuation
+        );
+    } else if (substitution->range) {
+        result = call_range_generator(
+            program,
+            done.substitution,
+            &done.last_run,
+            &done.range,
+            done.range_length,
+            allocators,
+            generators,
+            properties,
+            arg_buffer,
+            out_buffer,
+            &continuation
+        );
+    } else {
+        result = call_generator(
+            program,
+            done.substitution,
+            &done.last_run,
+            allocators,
+            generators,
+            properties,
+            arg_buffer,
+            out_buffer,
+            &continuation
+        );
+    }
+    mtpl_arena_release_buffer(allocators, arg_buffer);
+    if (continuation) {
+        return start_continuation(
+            allocators,
+            generators,
+            continuation,
+            frames
+        );
+    }
+    if (result == MTPL_SUCCESS) {
+        result = flush_output(out_buffer, false);
+    }
+    return result;
+}
+
+// Evaluates instructions `begin` up until `end` into `out_buffer`. Nested
+// substitutions are evaluated on a stack of frames rather than the C stack,
+// as are the templates that generators such as `if`, `for` and macros hand
+// over as continuations. Only generators that run templates themselves,
+// such as `pfor`, recurse, which is charged against the stack budget.
+static mtpl_result run_instructions(
+    const mtpl_program* program,
+    size_t begin,
+    size_t end,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out_buffer
+) {
+    mtpl_result result = mtpl_budget_descend();
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_buffer* frames;
+    result = mtpl_arena_buffer(allocators, &frames);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_stack;
+    }
+    const mtpl__frame outermost = {
+        .program = program,
+        .properties = properties,
+        .substitution = NO_SUBSTITUTION,
+        .next = begin,
+        .end = end,
+        .out = out_buffer,
+        .continuation = NULL
+    };
+    result = push_frame(allocators, frames, &outermost);
+    while (result == MTPL_SUCCESS) {
+        mtpl__frame* frame = top_frame(frames);
+        if (frame->next < frame->end) {
+            const mtpl_instruction* instruction =
+                &frame->program->instructions[frame->next];
+            if (instruction->generator) {
+                result = open_substitution(frame->next, allocators, frames);
+            } else {
+                if (frame->substitution != NO_SUBSTITUTION) {
+                    frame->last_run = (mtpl__run) {
+                        frame->next,
+                        frame->out->cursor
+                    };
+                }
+                result = write_text(
+                    frame->program,
+                    instruction,
+                    allocators,
+                    frame->out
+                );
+                frame->next++;
+            }
+        } else if (frame->substitution != NO_SUBSTITUTION) {
+            result = close_substitution(allocators, generators, frames);
+        } else if (frame->continuation) {
+            result = resume_continuation(allocators, generators, frames);
+        } else {
+            break;
+        }
+    }
+
+    // Release the argument buffers of any substitutions, and end the
+    // invocations of any continuations, left open by an error.
+    while (frames->cursor > sizeof(mtpl__frame)) {
+        const mtpl__frame frame = *top_frame(frames);
+        frames->cursor -= sizeof(mtpl__frame);
+        if (frame.continuation) {
+            end_continuation(
+                allocators,
+                frame.continuation,
+                top_frame(frames)->out,
+                result
+            );
+        } else {
+            mtpl_arena_release_buffer(allocators, frame.out);
+        }
+    }
+    mtpl_arena_release_buffer(allocators, frames);
+cleanup_stack:
+    mtpl_budget_ascend();
+    return result;
+}
+
+mtpl_result mtpl_continuation_create(
+    const mtpl_allocators* allocators,
+    size_t size,
+    mtpl_continuation** out_continuation
+) {
+    mtpl_buffer* storage;
+    mtpl_result result = mtpl_arena_buffer(allocators, &storage);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    if (storage->size < size) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            storage->data,
+            size,
+            goto cleanup_storage
+        );
+        storage->size = size;
+    }
+    memset(storage->data, 0, size);
+    mtpl_continuation* continuation = (mtpl_continuation*) storage->data;
+    continuation->storage = storage;
+    *out_continuation = continuation;
+    return MTPL_SUCCESS;
+
+cleanup_storage:
+    mtpl_arena_release_buffer(allocators, storage);
+    return MTPL_ERR_MEMORY;
+}
+
+mtpl_result mtpl_continue(
+    mtpl_generator generator,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_continuation* continuation
+) {
+    if (active_call.generator == generator && !active_call.continuation) {
+        mtpl_profile_move(active_call.invocation, &continuation->call);
+        active_call.continuation = continuation;
+        return MTPL_SUCCESS;
+    }
+
+    mtpl_result result = next_template(continuation, allocators, generators);
+    while (result == MTPL_SUCCESS && continuation->program) {
+        result = mtpl_run(
+            continuation->program,
+            allocators,
+            generators,
+            continuation->properties,
+            continuation->out
+        );
+        continuation->program = NULL;
+        if (result == MTPL_SUCCESS) {
+            result = next_template(continuation, allocators, generators);
+        }
+    }
+    result = continuation->finish(continuation, allocators, result);
+    mtpl_arena_release_buffer(allocators, continuation->storage);
+    return result;
+}
+
+// Finds the template kept at `offset` of the text pool. Extracted templates
+// are found by their offset alone, as their length follows from the text.
+static struct mtpl_quoted* find_quoted(
+    struct mtpl_quoted* quoted,
+    size_t offset,
+    size_t length,
+    bool extracted
+) {
+    for (; quoted; quoted = quoted->next) {
+        if (
+            quoted->offset == offset
+            && quoted->extracted == extracted
+            && (extracted || quoted->length == length)
+        ) {
+            return quoted;
+        }
+    }
+    return NULL;
+}
+
+static void release_quoted(
+    const mtpl_allocators* allocators,
+    struct mtpl_quoted* quoted
+) {
+    mtpl_arena_release_program(allocators, quoted->program);
+    mtpl_arena_release_buffer(allocators, quoted->storage);
+}
+
+// Compiles `source`, the template at `offset` of the text pool of the
+// program that `run` is part of, and has the run keep it, unless another
+// thread has already done so.
+static mtpl_result keep_quoted(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_instruction* run,
+    size_t offset,
+    size_t length,
+    bool extracted,
+    const char* source,
+    struct mtpl_quoted** out_quoted
+) {
+    mtpl_buffer* storage;
+    mtpl_result result = mtpl_arena_buffer(allocators, &storage);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    if (storage->size < sizeof(struct mtpl_quoted)) {
+        MTPL_REALLOC_CHECKED(
+            allocators,
+            storage->data,
+            sizeof(struct mtpl_quoted),
+            goto cleanup_storage
+        );
+        storage->size = sizeof(struct mtpl_quoted);
+    }
+    struct mtpl_quoted* quoted = (struct mtpl_quoted*) storage->data;
+    quoted->offset = offset;
+    quoted->length = length;
+    quoted->extracted = extracted;
+    quoted->storage = storage;
+    result = mtpl_arena_program(allocators, &quoted->program);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_storage;
+    }
+    result = mtpl_compile_into(
+        source,
+        allocators,
+        generators,
+        quoted->program
+    );
+    if (result != MTPL_SUCCESS) {
+        release_quoted(allocators, quoted);
+        return result;
+    }
+
+    // Programs may be run by several threads at once, so the template is
+    // only added if no other thread has added it in the meantime.
+    quoted->next = __atomic_load_n(&run->quoted, __ATOMIC_ACQUIRE);
+    do {
+        struct mtpl_quoted* found = find_quoted(
+            quoted->next,
+            offset,
+            length,
+            extracted
+        );
+        if (found) {
+            release_quoted(allocators, quoted);
+            *out_quoted = found;
+            return MTPL_SUCCESS;
+        }
+    } while (!__atomic_compare_exchange_n(
+        &run->quoted,
+        &quoted->next,
+        quoted,
+        false,
+        __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE
+    ));
+    *out_quoted = quoted;
+    return MTPL_SUCCESS;
+
+cleanup_storage:
+    mtpl_arena_release_buffer(allocators, storage);
+    return MTPL_ERR_MEMORY;
+}
+
+// Releases the templates kept by the literal text runs of `program`, along
+// with those that they keep in turn.
+static void forget_quoted(
+    const mtpl_allocators* allocators,
+    mtpl_program* program
+) {
+    for (size_t i = 0; i < program->num_instructions; ++i) {
+        struct mtpl_quoted* quoted = program->instructions[i].quoted;
+        while (quoted) {
+            struct mtpl_quoted* next = quoted->next;
+            forget_quoted(allocators, quoted->program);
+            release_quoted(allocators, quoted);
+            quoted = next;
+        }
+        program->instructions[i].quoted = NULL;
+    }
+}
+
+// Returns the literal text run of the program being run that bytes `begin`
+// up until `end` of the arguments `arg` were written by, or NULL if they
+// weren't all written by the same run, such as when they are the output of
+// a substitution.
+static mtpl_instruction* quoting_run(
+    const mtpl_buffer* arg,
+    size_t begin,
+    size_t end
+) {
+    const mtpl__call* call = &active_call;
+    if (call->arg != arg || call->run.index == NO_TEXT_RUN) {
+        return NULL;
+    }
+    mtpl_instruction* run = &call->program->instructions[call->run.index];
+    if (begin < call->run.at || end > call->run.at + run->length) {
+        return NULL;
+    }
+    return run;
+}
+
+// Offset in the text pool of byte `at` of the arguments, which `run` wrote.
+static size_t quoted_offset(const mtpl_instruction* run, size_t at) {
+    return run->offset + (at - active_call.run.at);
+}
+
+// Looks up the template kept by `run` at `offset`, compiling it from
+// `source` if there is none yet.
+static mtpl_result find_or_keep_quoted(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_instruction* run,
+    size_t offset,
+    size_t length,
+    bool extracted,
+    const char* source,
+    struct mtpl_quoted** out_quoted
+) {
+    *out_quoted = find_quoted(
+        __atomic_load_n(&run->quoted, __ATOMIC_ACQUIRE),
+        offset,
+        length,
+        extracted
+    );
+    if (*out_quoted) {
+        return MTPL_SUCCESS;
+    }
+    return keep_quoted(
+        allocators,
+        generators,
+        run,
+        offset,
+        length,
+        extracted,
+        source,
+        out_quoted
+    );
+}
+
+// Compiles a template that isn't quoted into a program from the arena.
+static mtpl_result compile_unquoted(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    const char* source,
+    mtpl_template* out_template
+) {
+    mtpl_program* program;
+    mtpl_result result = mtpl_arena_program(allocators, &program);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_compile_into(source, allocators, generators, program);
+    if (result != MTPL_SUCCESS) {
+        mtpl_arena_release_program(allocators, program);
+        return result;
+    }
+    *out_template = (mtpl_template) { program, program };
+    return MTPL_SUCCESS;
+}
+
+mtpl_result mtpl_template_compile_rest(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    const mtpl_buffer* arg,
+    mtpl_template* out_template
+) {
+    const size_t begin = arg->cursor;
+    const char* source = &arg->data[begin];
+    const size_t length = strlen(source);
+    mtpl_instruction* run = quoting_run(arg, begin, begin + length);
+    if (!run) {
+        return compile_unquoted(allocators, generators, source, out_template);
+    }
+    struct mtpl_quoted* quoted;
+    const mtpl_result result = find_or_keep_quoted(
+        allocators,
+        generators,
+        run,
+        quoted_offset(run, begin),
+        length,
+        false,
+        source,
+        &quoted
+    );
+    if (result == MTPL_SUCCESS) {
+        *out_template = (mtpl_template) { quoted->program, NULL };
+    }
+    return result;
+}
+
+mtpl_result mtpl_template_extract(
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_buffer* arg,
+    mtpl_template* out_template
+) {
+    const size_t begin = arg->cursor;
+    mtpl_instruction* run = quoting_run(arg, begin, begin);
+    struct mtpl_quoted* quoted = NULL;
+    if (run) {
+        quoted = find_quoted(
+            __atomic_load_n(&run->quoted, __ATOMIC_ACQUIRE),
+            quoted_offset(run, begin),
+            0,
+            true
+        );
+    }
+
+    mtpl_result result = MTPL_SUCCESS;
+    if (!quoted) {
+        mtpl_buffer* source;
+        result = mtpl_arena_buffer(allocators, &source);
+        if (result != MTPL_SUCCESS) {
+            return result;
+        }
+        result = mtpl_buffer_extract_sub(allocators, true, arg, source);
+        run = quoting_run(arg, begin, arg->cursor);
+        if (result == MTPL_SUCCESS && run) {
+            result = find_or_keep_quoted(
+                allocators,
+                generators,
+                run,
+                quoted_offset(run, begin),
+                arg->cursor - begin,
+                true,
+                source->data,
+                &quoted
+            );
+        } else if (result == MTPL_SUCCESS && out_template) {
+            result = compile_unquoted(
+                allocators,
+                generators,
+                source->data,
+                out_template
+            );
+        }
+        mtpl_arena_release_buffer(allocators, source);
+    }
+    if (quoted) {
+        arg->cursor = begin + quoted->length;
+        if (out_template) {
+            *out_template = (mtpl_template) { quoted->program, NULL };
+        }
+    }
+    return result;
+}
+
+void mtpl_template_release(
+    const mtpl_allocators* allocators,
+    mtpl_template* body
+) {
+    if (body->owned) {
+        mtpl_arena_release_program(allocators, body->owned);
+    }
+}
+
+mtpl_result mtpl_program_create(
+    const mtpl_allocators* allocators,
+    mtpl_program** out_program
+) {
+    mtpl_result result;
+    mtpl_program* program = mtpl_allocate(allocators, sizeof(mtpl_program));
+    if (!program) {
+        return MTPL_ERR_MEMORY;
+    }
+    program->instructions = mtpl_allocate(
+        allocators,
+        sizeof(mtpl_instruction) * MTPL_INITIAL_DESCRIPTORS
+    );
+    if (!program->instructions) {
+        result = MTPL_ERR_MEMORY;
+        goto cleanup_program;
+    }
+    program->num_instructions = 0;
+    program->cap_instructions = MTPL_INITIAL_DESCRIPTORS;
+    result = mtpl_buffer_create(
+        allocators,
+        MTPL_DEFAULT_BUFSIZE,
+        &program->text
+    );
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_instructions;
+    }
+    program->text->data[0] = '\0';
+
+    *out_program = program;
+    return MTPL_SUCCESS;
+
+cleanup_instructions:
+    mtpl_deallocate(allocators, program->instructions);
+cleanup_program:
+    mtpl_deallocate(allocators, program);
+    return result;
+}
+
+mtpl_result mtpl_compile_into(
+    const char* source,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_program* program
+) {
+    forget_quoted(allocators, program);
+    program->num_instructions = 0;
+    program->text->cursor = 0;
+    program->text->data[0] = '\0';
+
+    mtpl_buffer* gen_name;
+    mtpl_result result = mtpl_arena_buffer(allocators, &gen_name);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    mtpl_readbuffer buffer = {
+        .data = source,
+        .cursor = 0,
+        .size = 0
+    };
+    result = compile_template(
+        allocators,
+        &buffer,
+        generators,
+        gen_name,
+        program
+    );
+    mtpl_arena_release_buffer(allocators, gen_name);
+    return result;
+}
+
+mtpl_result mtpl_compile(
+    const char* source,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_program** out_program
+) {
+    mtpl_program* program;
+    mtpl_result result = mtpl_program_create(allocators, &program);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_compile_into(source, allocators, generators, program);
+    if (result != MTPL_SUCCESS) {
+        mtpl_program_free(allocators, program);
+        return result;
+    }
+
+    *out_program = program;
+    return MTPL_SUCCESS;
+}
+
+mtpl_result mtpl_run(
+    const mtpl_program* program,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out_buffer
+) {
+    mtpl_result result = run_instructions(
+        program,
+        0,
+        program->num_instructions,
+        allocators,
+        generators,
+        properties,
+        out_buffer
+    );
+    if (result == MTPL_SUCCESS && out_buffer->cursor < out_buffer->size) {
+        out_buffer->data[out_buffer->cursor] = '\0';
+    }
+    return result;
+}
+
+mtpl_result mtpl_run_sink(
+    const mtpl_program* program,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    const mtpl_sink* sink,
+    mtpl_buffer* out_buffer
+) {
+    const mtpl__sink_state previous = active_sink;
+    active_sink.sink = sink;
+    active_sink.buffer = out_buffer;
+    mtpl_result result = run_instructions(
+        program,
+        0,
+        program->num_instructions,
+        allocators,
+        generators,
+        properties,
+        out_buffer
+    );
+    if (result == MTPL_SUCCESS) {
+        result = flush_output(out_buffer, true);
+    }
+    active_sink = previous;
+    return result;
+}
+
+void mtpl_program_free(
+    const mtpl_allocators* allocators,
+    mtpl_program* program
+) {
+    forget_quoted(allocators, program);
+    mtpl_buffer_free(allocators, program->text);
+    mtpl_deallocate(allocators, program->instructions);
+    mtpl_deallocate(allocators, program);
+}
+
+mtpl_result mtpl_substitute(
+    const char* source,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out_buffer
+) {
+    mtpl_program* program;
+    mtpl_result result = mtpl_arena_program(allocators, &program);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    result = mtpl_compile_into(source, allocators, generators, program);
+    if (result == MTPL_SUCCESS) {
+        result = mtpl_run(
+            program,
+            allocators,
+            generators,
+            properties,
+            out_buffer
+        );
+    }
+    mtpl_arena_release_program(allocators, program);
+    return result;
+}
+
+// Compiles and runs a complete top level substitution or quote.
+static mtpl_result run_segment(
+    const mtpl_buffer* segment,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    const mtpl_sink* sink,
+    mtpl_program* program,
+    mtpl_buffer* out_buffer
+) {
+    mtpl_result result = mtpl_compile_into(
+        segment->data,
+        allocators,
+        generators,
+        program
+    );
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    return mtpl_run_sink(
+        program,
+        allocators,
+        generators,
+        properties,
+        sink,
+        out_buffer
+    );
+}
+
+static mtpl_result write_literal(
+    const mtpl_sink* sink,
+    const char* chunk,
+    size_t begin,
+    size_t end
+) {
+    if (begin >= end) {
+        return MTPL_SUCCESS;
+    }
+    const mtpl_result result = mtpl_budget_stream(end - begin);
+    if (result != MTPL_SUCCESS) {
+        return result;
+    }
+    return sink->write(sink->user, &chunk[begin], end - begin);
+}
+
+mtpl_result mtpl_substitute_stream(
+    const mtpl_reader* reader,
+    const mtpl_allocators* allocators,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    const mtpl_sink* sink,
+    mtpl_buffer* out_buffer
+) {
+    mtpl_result result;
+    char* chunk = mtpl_allocate(allocators, MTPL_READ_CHUNK_SIZE);
+    if (!chunk) {
+        return MTPL_ERR_MEMORY;
+    }
+    mtpl_buffer* segment;
+    result = mtpl_arena_buffer(allocators, &segment);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_chunk;
+    }
+    mtpl_program* program;
+    result = mtpl_arena_program(allocators, &program);
+    if (result != MTPL_SUCCESS) {
+        goto cleanup_segment;
+    }
+
+    // Nesting of the segment being read, tracked the same way as when
+    // compiling: within quotes, only braces are counted.
+    size_t brackets = 0;
+    size_t braces = 0;
+    bool escaped = false;
+    bool done = false;
+    while (!done) {
+        size_t length;
+        result = reader->read(reader->user, chunk, MTPL_READ_CHUNK_SIZE, &length);
+        if (result != MTPL_SUCCESS) {
+            break;
+        }
+        if (!length) {
+            result = (brackets || braces || escaped) ? MTPL_ERR_SYNTAX
+                : MTPL_SUCCESS;
+            break;
+        }
+
+        // Start of pending top level text, or of the segment being read.
+        size_t begin = 0;
+        for (size_t i = 0; i < length && !done; ++i) {
+            if (!escaped) {
+                // Plain text needs no tracking, whether it is passed on or
+                // part of a segment.
+                i += mtpl_scan_text_n(&chunk[i], length - i);
+                if (i == length) {
+                    break;
+                }
+            }
+            const char c = chunk[i];
+            if (brackets || braces) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (!c) {
+                    result = MTPL_ERR_SYNTAX;
+                    done = true;
+                } else if (braces) {
+                    braces += (c == '{') - (c == '}');
+                } else {
+                    brackets += (c == '[') - (c == ']');
+                    braces = (c == '{');
+                }
+                if (brackets || braces || done) {
+                    continue;
+                }
+                const mtpl_slice text = { &chunk[begin], i + 1 - begin };
+                result = mtpl_buffer_write(&text, allocators, segment);
+                if (result == MTPL_SUCCESS) {
+                    result = run_segment(
+                        segment,
+                        allocators,
+                        generators,
+                        properties,
+                        sink,
+                        program,
+                        out_buffer
+                    );
+                }
+                done = result != MTPL_SUCCESS;
+                begin = i + 1;
+                continue;
+            }
+
+            if (escaped) {
+                // Skip whitespace following a backslash, but keep anything
+                // else as literal text.
+                escaped = false;
+                if (!c) {
+                    result = MTPL_ERR_SYNTAX;
+                    done = true;
+                }
+                begin = is_whitespace(c) ? i + 1 : i;
+                continue;
+            }
+            switch (c) {
+            case '\\':
+                escaped = true;
+                break;
+            case '[':
+                brackets = 1;
+                break;
+            case '{':
+                braces = 1;
+                break;
+            case ']':
+            case '}':
+                result = MTPL_ERR_SYNTAX;
+                done = true;
+                continue;
+            case '\0':
+                result = write_literal(sink, chunk, begin, i);
+                done = true;
+                continue;
+            default:
+                continue;
+            }
+            result = write_literal(sink, chunk, begin, i);
+            done = result != MTPL_SUCCESS;
+            begin = escaped ? i + 1 : i;
+            segment->cursor = 0;
+        }
+        if (done) {
+            break;
+        }
+
+        // Keep the part of an unfinished segment, and pass on any text.
+        const mtpl_slice rest = { &chunk[begin], length - begin };
+        if (brackets || braces) {
+            result = mtpl_buffer_write(&rest, allocators, segment);
+        } else if (!escaped) {
+            result = write_literal(sink, chunk, begin, length);
+        }
+        if (result != MTPL_SUCCESS) {
+            break;
+        }
+    }
+
+    mtpl_arena_release_program(allocators, program);
+cleanup_segment:
+    mtpl_arena_release_buffer(allocators, segment);
+cleanup_chunk:
+    mtpl_deallocate(allocators, chunk);
+    return result;
+}
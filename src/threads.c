@@ -0,0 +1,248 @@
+#include "threads.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+// Pool and threads wanted by the render on this thread, or 0 for one per
+// processor.
+static _Thread_local mtpl_pool* active_pool = NULL;
+static _Thread_local size_t wanted = 0;
+
+struct mtpl_pool {
+    const mtpl_allocators* allocators;
+    pthread_mutex_t lock;
+    // Signalled as a run starts, and as the pool is stopping.
+    pthread_cond_t start;
+    // Signalled as the last thread taking part in a run is done with it.
+    pthread_cond_t done;
+    pthread_t* threads;
+    size_t num_threads;
+    // Work of the run under way, numbered so that each thread takes part in a
+    // run at most once. Runs are numbered from 1.
+    void (*work)(void* data);
+    void* data;
+    size_t run;
+    // Threads that may still join the run, and those taking part in it.
+    size_t open;
+    size_t running;
+    bool busy;
+    bool stopping;
+};
+
+static void* run_pool_thread(void* data) {
+    mtpl_pool* pool = data;
+    size_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        if (pool->run == seen || !pool->open) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+            continue;
+        }
+        seen = pool->run;
+        pool->open--;
+        pool->running++;
+        void (*work)(void* data) = pool->work;
+        void* work_data = pool->data;
+        pthread_mutex_unlock(&pool->lock);
+        work(work_data);
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->running) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+mtpl_result mtpl_pool_create(
+    const mtpl_allocators* allocators,
+    mtpl_pool** out_pool
+) {
+    mtpl_pool* pool = mtpl_allocate(allocators, sizeof(mtpl_pool));
+    if (!pool) {
+        return MTPL_ERR_MEMORY;
+    }
+    *pool = (mtpl_pool) {
+        .allocators = allocators,
+        .threads = NULL,
+        .num_threads = 0,
+        .run = 0,
+        .open = 0,
+        .running = 0,
+        .busy = false,
+        .stopping = false
+    };
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    *out_pool = pool;
+    return MTPL_SUCCESS;
+}
+
+void mtpl_pool_free(mtpl_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    if (pool->threads) {
+        mtpl_deallocate(pool->allocators, pool->threads);
+    }
+    mtpl_deallocate(pool->allocators, pool);
+}
+
+// Starts threads until the pool has `count`, or no more can be started.
+static void grow_pool(mtpl_pool* pool, size_t count) {
+    if (pool->num_threads >= count) {
+        return;
+    }
+    pthread_t* threads = pool->threads;
+    MTPL_REALLOC_CHECKED(
+        pool->allocators,
+        threads,
+        sizeof(pthread_t) * count,
+        return
+    );
+    pool->threads = threads;
+    while (
+        pool->num_threads < count
+        && pthread_create(
+            &pool->threads[pool->num_threads],
+            NULL,
+            run_pool_thread,
+            pool
+        ) == 0
+    ) {
+        pool->num_threads++;
+    }
+}
+
+// Runs `work` on the threads of `pool` along with the calling thread. Returns
+// false, without running anything, if the pool is busy.
+static bool run_on_pool(
+    mtpl_pool* pool,
+    size_t threads,
+    void (*work)(void* data),
+    void* data
+) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->busy) {
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+    pool->busy = true;
+    grow_pool(pool, threads - 1);
+    pool->work = work;
+    pool->data = data;
+    pool->run++;
+    pool->open = pool->num_threads < threads - 1
+        ? pool->num_threads
+        : threads - 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(data);
+
+    // Threads that haven't joined yet would find no work left.
+    pthread_mutex_lock(&pool->lock);
+    pool->open = 0;
+    while (pool->running) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->busy = false;
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+typedef struct {
+    pthread_t thread;
+    void (*work)(void* data);
+    void* data;
+} mtpl__worker;
+
+static void* run_worker(void* data) {
+    mtpl__worker* worker = data;
+    worker->work(worker->data);
+    return NULL;
+}
+
+void mtpl_threads_run(
+    mtpl_pool* pool,
+    const mtpl_allocators* allocators,
+    size_t threads,
+    void (*work)(void* data),
+    void* data
+) {
+    if (threads <= 1) {
+        work(data);
+        return;
+    }
+    if (pool && run_on_pool(pool, threads, work, data)) {
+        return;
+    }
+
+    mtpl__worker* workers = mtpl_allocate(
+        allocators,
+        sizeof(mtpl__worker) * (threads - 1)
+    );
+    size_t started = 0;
+    if (workers) {
+        for (; started < threads - 1; ++started) {
+            workers[started].work = work;
+            workers[started].data = data;
+            if (
+                pthread_create(
+                    &workers[started].thread,
+                    NULL,
+                    run_worker,
+                    &workers[started]
+                ) != 0
+            ) {
+                break;
+            }
+        }
+    }
+    work(data);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (workers) {
+        mtpl_deallocate(allocators, workers);
+    }
+}
+
+size_t mtpl_threads_available(void) {
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (size_t) processors : 1;
+}
+
+void mtpl_threads_enter(
+    mtpl_pool* pool,
+    size_t threads,
+    mtpl_pool** out_previous_pool,
+    size_t* out_previous_threads
+) {
+    *out_previous_pool = active_pool;
+    *out_previous_threads = wanted;
+    active_pool = pool;
+    wanted = threads;
+}
+
+void mtpl_threads_leave(mtpl_pool* previous_pool, size_t previous_threads) {
+    active_pool = previous_pool;
+    wanted = previous_threads;
+}
+
+mtpl_pool* mtpl_threads_pool(void) {
+    return active_pool;
+}
+
+size_t mtpl_threads_wanted(void) {
+    return wanted ? wanted : mtpl_threads_available();
+}
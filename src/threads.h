@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mintpl/common.h>
+
+#include <stddef.h>
+
+// Running work on several threads at once, for generators that spread their
+// iterations over processors.
+
+// Threads kept waiting for work between runs, so that running work on them
+// doesn't start threads anew every time. Threads are started as runs need
+// them, and stopped once the pool is freed.
+typedef struct mtpl_pool mtpl_pool;
+
+mtpl_result mtpl_pool_create(
+    const mtpl_allocators* allocators,
+    mtpl_pool** out_pool
+);
+
+void mtpl_pool_free(mtpl_pool* pool);
+
+// Runs `work` on `threads` threads at once, the calling thread being one of
+// them, and returns once all of them have finished. The others are taken from
+// `pool`, unless it is NULL or busy with another run, in which case they are
+// started for this run alone. Runs on fewer threads if no more can be
+// started, or if the calling thread is done before the others have joined,
+// so `work` should keep taking on work for as long as there is any left,
+// rather than expect a share of it.
+void mtpl_threads_run(
+    mtpl_pool* pool,
+    const mtpl_allocators* allocators,
+    size_t threads,
+    void (*work)(void* data),
+    void* data
+);
+
+// Number of processors available to the process, or 1 if unknown.
+size_t mtpl_threads_available(void);
+
+// Sets the pool and the number of threads that generators called on the
+// calling thread spread their iterations over, such as those of the render
+// about to start. Returns the previous settings, which should be restored
+// using mtpl_threads_leave().
+void mtpl_threads_enter(
+    mtpl_pool* pool,
+    size_t threads,
+    mtpl_pool** out_previous_pool,
+    size_t* out_previous_threads
+);
+
+void mtpl_threads_leave(mtpl_pool* previous_pool, size_t previous_threads);
+
+// Pool set for the calling thread, or NULL.
+mtpl_pool* mtpl_threads_pool(void);
+
+// Number of threads set for the calling thread, or if none are, the number
+// of processors available.
+size_t mtpl_threads_wanted(void);
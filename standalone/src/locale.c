@@ -1,7 +1,29 @@
 const char l_usage[] = (
     "Usage:\n\n"
-    "%s [-hv?] [-o OUTFILE] [-p PROPERTY=VALUE [-p ...]] [INFILE]\n"
+    "%s [-hv?] [--profile] [--trace TRACEFILE] [LIMITS] [-o OUTFILE]\n"
+    "    [-p PROPERTY=VALUE [-p ...]] [INFILE]\n"
+    "%s [-hv?] [--profile] [--trace TRACEFILE] [LIMITS] [-o OUTFILE]\n"
+    "    [-p PROPERTY=VALUE [-p ...]] -b RECORDS [-j THREADS] [INFILE]\n\n"
+    "With -b, the template is rendered once for each line of RECORDS, with\n"
+    "the properties given on that line as tab separated PROPERTY=VALUE\n"
+    "fields, using THREADS threads (one per processor by default).\n\n"
+    "With --profile, the calls of each generator and the time spent in them\n"
+    "are printed to stderr once done.\n\n"
+    "With --trace, the start and end of each generator call are written to\n"
+    "TRACEFILE as Chrome trace event JSON, to be opened in Perfetto.\n\n"
+    "LIMITS cap each render, failing it once exceeded, where 0 means\n"
+    "unlimited:\n"
+    "    --max-depth N       nesting of generator calls\n"
+    "    --max-stack BYTES   stack taken by templates nested on it\n"
+    "    --max-steps N       generator calls and loop iterations\n"
+    "    --max-output BYTES  size of the output and intermediate results\n"
+    "    --max-time MS       wall-clock time\n"
 );
+const char l_profile_header[] = (
+    "Generator                     Calls   Inclusive ms   Exclusive ms"
+    "   Output bytes Argument bytes\n"
+);
+const char l_profile_row[] = "%-24s %10zu %14.3f %14.3f %14zu %14zu\n";
 const char l_version[] = "mintpl-cli version %s\nlibmintpl version %s\n";
 
 const char l_err_mtpl_init_failed[] = "libmtpl init failed, error code %d\n"; 
@@ -14,5 +36,9 @@ const char l_err_read_bytes[] = "Failed to read %d bytes\n";
 const char l_err_parse[] = (
     "Failed to parse template, error code %d (position %d)\n"
 );
-const char l_err_write[] = "Failed to write %d bytes\n";
+const char l_err_io[] = "Failed to read input or write output\n";
+const char l_err_malformed_record[] = "Malformed record on line %zu\n";
+const char l_err_trace[] = "Failed to write the trace\n";
+const char l_err_threads[] = "Invalid number of threads: %s\n";
+const char l_err_limit[] = "Invalid limit: %s\n";
 
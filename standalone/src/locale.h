@@ -2,6 +2,8 @@
 
 extern const char l_usage[];
 extern const char l_version[];
+extern const char l_profile_header[];
+extern const char l_profile_row[];
 
 extern const char l_err_mtpl_init_failed[]; 
 extern const char l_err_unknown_opt[];
@@ -11,5 +13,9 @@ extern const char l_err_malformed_prop[];
 extern const char l_err_set_prop[];
 extern const char l_err_read_bytes[];
 extern const char l_err_parse[];
-extern const char l_err_write[];
+extern const char l_err_io[];
+extern const char l_err_malformed_record[];
+extern const char l_err_trace[];
+extern const char l_err_threads[];
+extern const char l_err_limit[];
 
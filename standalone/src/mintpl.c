@@ -3,6 +3,7 @@
 #include <mintpl/mintpl.h>
 #include <mintpl/buffers.h>
 
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,14 +11,27 @@
 
 #define VERSION "1.0.0"
 
+// Values of the long options that set limits.
+enum {
+    OPT_MAX_DEPTH = 256,
+    OPT_MAX_STACK,
+    OPT_MAX_STEPS,
+    OPT_MAX_OUTPUT,
+    OPT_MAX_TIME
+};
+
 typedef struct {
     FILE* in;
     FILE* out;
+    FILE* records;
+    size_t threads;
+    int profile;
+    FILE* trace;
     mtpl_context* ctx;
 } invocation_data;
 
 void display_usage(const char* name) {
-    fprintf(stdout, l_usage, name);
+    fprintf(stdout, l_usage, name, name);
 }
 
 int process_invocation(int argc, char** argv, invocation_data* run) {
@@ -25,6 +39,10 @@ int process_invocation(int argc, char** argv, invocation_data* run) {
 
     run->in = NULL;
     run->out = NULL;
+    run->records = NULL;
+    run->threads = 0;
+    run->profile = 0;
+    run->trace = NULL;
 
     mtpl_result result = mtpl_init(&(run->ctx));
     if (result != MTPL_SUCCESS) {
@@ -34,12 +52,51 @@ int process_invocation(int argc, char** argv, invocation_data* run) {
 
     int i = 0;
     char* value;
-    while ((opt = getopt(argc, argv, "ho:p:v?")) != -1) {
+    char* end;
+    unsigned long long limit;
+    mtpl_limits* limits = &run->ctx->limits;
+    const struct option long_options[] = {
+        { "profile", no_argument, &run->profile, 1 },
+        { "trace", required_argument, NULL, 't' },
+        { "max-depth", required_argument, NULL, OPT_MAX_DEPTH },
+        { "max-stack", required_argument, NULL, OPT_MAX_STACK },
+        { "max-steps", required_argument, NULL, OPT_MAX_STEPS },
+        { "max-output", required_argument, NULL, OPT_MAX_OUTPUT },
+        { "max-time", required_argument, NULL, OPT_MAX_TIME },
+        { 0, 0, 0, 0 }
+    };
+    while (
+        (opt = getopt_long(argc, argv, "b:hj:o:p:v?", long_options, NULL))
+            != -1
+    ) {
         switch (opt) {
+        case 0:
+            break;
+        case 'b':
+            run->records = fopen(optarg, "r");
+            if (!run->records) {
+                fprintf(stderr, l_err_open_in_failed, optarg);
+                return 2;
+            }
+            break;
         case 'h':
         case '?':
             display_usage(argv[0]);
             return 0;
+        case 'j':
+            run->threads = strtoul(optarg, &end, 10);
+            if (*end || !run->threads) {
+                fprintf(stderr, l_err_threads, optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            run->trace = fopen(optarg, "w");
+            if (!run->trace) {
+                fprintf(stderr, l_err_open_out_failed, optarg);
+                return 2;
+            }
+            break;
         case 'o':
             run->out = fopen(optarg, "w");
             if (!run->out) {
@@ -67,6 +124,28 @@ int process_invocation(int argc, char** argv, invocation_data* run) {
         case 'v':
             fprintf(stdout, l_version, VERSION, mtpl_version());
             return 0;
+        case OPT_MAX_DEPTH:
+        case OPT_MAX_STACK:
+        case OPT_MAX_STEPS:
+        case OPT_MAX_OUTPUT:
+        case OPT_MAX_TIME:
+            limit = strtoull(optarg, &end, 10);
+            if (!*optarg || *end) {
+                fprintf(stderr, l_err_limit, optarg);
+                return 1;
+            }
+            if (opt == OPT_MAX_DEPTH) {
+                limits->max_depth = limit;
+            } else if (opt == OPT_MAX_STACK) {
+                limits->max_stack = limit;
+            } else if (opt == OPT_MAX_STEPS) {
+                limits->max_steps = limit;
+            } else if (opt == OPT_MAX_OUTPUT) {
+                limits->max_output = limit;
+            } else {
+                limits->max_time_ms = limit;
+            }
+            break;
         default:
             fprintf(stderr, l_err_unknown_opt, opt);
             display_usage(argv[0]);
@@ -87,10 +166,228 @@ int process_invocation(int argc, char** argv, invocation_data* run) {
     if (!run->out) {
         run->out = stdout;
     }
-    
+    if (run->profile) {
+        result = mtpl_enable_profiling(run->ctx);
+        if (result != MTPL_SUCCESS) {
+            fprintf(stderr, l_err_mtpl_init_failed, result);
+            return result;
+        }
+    }
+    if (run->trace) {
+        result = mtpl_enable_tracing(run->ctx);
+        if (result != MTPL_SUCCESS) {
+            fprintf(stderr, l_err_mtpl_init_failed, result);
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static mtpl_result read_input(
+    void* in,
+    char* data,
+    size_t size,
+    size_t* out_length
+) {
+    *out_length = fread(data, 1, size, in);
+    return ferror(in) ? MTPL_ERR_IO : MTPL_SUCCESS;
+}
+
+static mtpl_result write_output(void* out, const char* data, size_t length) {
+    return fwrite(data, 1, length, out) == length ? MTPL_SUCCESS : MTPL_ERR_IO;
+}
+
+// Reads all of a file into a null terminated string.
+static char* read_all(FILE* in, size_t* out_length) {
+    size_t size = 4096;
+    size_t length = 0;
+    char* data = malloc(size);
+    while (data) {
+        length += fread(&data[length], 1, size - length - 1, in);
+        if (length < size - 1) {
+            break;
+        }
+        size *= 2;
+        char* grown = realloc(data, size);
+        if (!grown) {
+            free(data);
+            return NULL;
+        }
+        data = grown;
+    }
+    if (!data || ferror(in)) {
+        free(data);
+        return NULL;
+    }
+    data[length] = '\0';
+    *out_length = length;
+    return data;
+}
+
+// Splits the records file into a property set per non-empty line, in place.
+static int parse_records(
+    char* data,
+    mtpl_property_set** out_sets,
+    mtpl_property** out_properties,
+    size_t* out_count
+) {
+    size_t num_lines = 1;
+    size_t num_fields = 1;
+    for (const char* c = data; *c; ++c) {
+        num_lines += *c == '\n';
+        num_fields += *c == '\n' || *c == '\t';
+    }
+    mtpl_property_set* sets = malloc(sizeof(mtpl_property_set) * num_lines);
+    mtpl_property* properties = malloc(sizeof(mtpl_property) * num_fields);
+    if (!sets || !properties) {
+        free(sets);
+        free(properties);
+        return 4;
+    }
+
+    size_t count = 0;
+    size_t line = 0;
+    mtpl_property* property = properties;
+    for (char* c = data; *c;) {
+        line++;
+        char* line_end = strchr(c, '\n');
+        if (line_end) {
+            *line_end = '\0';
+        }
+        if (*c && *c != '\r') {
+            sets[count] = (mtpl_property_set) { property, 0 };
+            for (char* field = c; field; ) {
+                char* field_end = strchr(field, '\t');
+                if (field_end) {
+                    *field_end = '\0';
+                }
+                char* separator = strchr(field, '=');
+                if (!separator || separator == field) {
+                    fprintf(stderr, l_err_malformed_record, line);
+                    free(sets);
+                    free(properties);
+                    return 3;
+                }
+                *separator = '\0';
+                size_t length = strlen(separator + 1);
+                if (length && separator[length] == '\r') {
+                    length--;
+                }
+                *property++ = (mtpl_property) {
+                    field,
+                    { separator + 1, length }
+                };
+                sets[count].count++;
+                field = field_end ? field_end + 1 : NULL;
+            }
+            count++;
+        }
+        c = line_end ? line_end + 1 : &c[strlen(c)];
+    }
+    *out_sets = sets;
+    *out_properties = properties;
+    *out_count = count;
     return 0;
 }
 
+// Renders the template once for each record, with the output of all records
+// written in order.
+static int render_records(invocation_data* run, const mtpl_sink* sink) {
+    size_t length;
+    char* source = read_all(run->in, &length);
+    char* records = read_all(run->records, &length);
+    fclose(run->records);
+    if (!source || !records) {
+        free(source);
+        free(records);
+        fprintf(stderr, l_err_io);
+        return 6;
+    }
+
+    mtpl_property_set* sets;
+    mtpl_property* properties;
+    size_t count;
+    int result = parse_records(records, &sets, &properties, &count);
+    if (result != 0) {
+        goto cleanup_input;
+    }
+
+    mtpl_program* program;
+    mtpl_result res = mtpl_compile_template(source, run->ctx, &program);
+    if (res == MTPL_SUCCESS) {
+        const mtpl_batch batch = {
+            .threads = run->threads,
+            .sets = sets,
+            .sink = sink
+        };
+        res = mtpl_render_batch(program, run->ctx, count, &batch);
+        mtpl_program_free(run->ctx->allocators, program);
+    }
+    if (res == MTPL_ERR_IO) {
+        fprintf(stderr, l_err_io);
+        result = 6;
+    } else if (res != MTPL_SUCCESS) {
+        fprintf(stderr, l_err_parse, res, 0);
+        result = 5;
+    }
+
+    free(properties);
+    free(sets);
+cleanup_input:
+    free(source);
+    free(records);
+    return result;
+}
+
+static int by_exclusive_time(const void* a, const void* b) {
+    const mtpl_generator_stats* first = a;
+    const mtpl_generator_stats* second = b;
+    return (first->exclusive_ns < second->exclusive_ns)
+        - (first->exclusive_ns > second->exclusive_ns);
+}
+
+// Prints the statistics of each generator, those taking most time first.
+static void print_profile(const mtpl_context* ctx) {
+    const mtpl_stats stats = mtpl_get_stats(ctx);
+    mtpl_generator_stats* sorted = malloc(
+        sizeof(mtpl_generator_stats) * (stats.count + 1)
+    );
+    if (!sorted) {
+        return;
+    }
+    memcpy(sorted, stats.generators, sizeof(mtpl_generator_stats) * stats.count);
+    qsort(sorted, stats.count, sizeof(mtpl_generator_stats), by_exclusive_time);
+    fprintf(stderr, l_profile_header);
+    for (size_t i = 0; i < stats.count; ++i) {
+        fprintf(
+            stderr,
+            l_profile_row,
+            sorted[i].name,
+            sorted[i].calls,
+            sorted[i].inclusive_ns / 1e6,
+            sorted[i].exclusive_ns / 1e6,
+            sorted[i].output_bytes,
+            sorted[i].argument_bytes
+        );
+    }
+    free(sorted);
+}
+
+// Reports on the render, if asked to.
+static void report(invocation_data* run) {
+    if (run->profile) {
+        print_profile(run->ctx);
+    }
+    if (run->trace) {
+        const mtpl_sink sink = { write_output, run->trace };
+        if (mtpl_write_trace(run->ctx, &sink) != MTPL_SUCCESS) {
+            fprintf(stderr, l_err_trace);
+        }
+        fclose(run->trace);
+    }
+}
+
 int main(int argc, char** argv) {
     invocation_data run;
 
@@ -99,35 +396,24 @@ int main(int argc, char** argv) {
         return result; 
     }
 
-    char indata[1025];
-    mtpl_buffer in = { indata };
-    mtpl_buffer template = {
-        .data = malloc(1024),
-        .size = 1024
-    };
-    size_t read_bytes = 0;
-    while (read_bytes = fread(indata, 1, 1024, run.in)) {
-        indata[read_bytes] = '\0';
-        in.cursor = 0;
-        mtpl_buffer_print(&in, run.ctx->allocators, &template);
-    };
-    fclose(run.in);
-    result = mtpl_parse_template(template.data, run.ctx);
-    free(template.data);
-    if (result != MTPL_SUCCESS) {
-        fprintf(stderr, l_err_parse, result, 0);
-        exit(5);
+    const mtpl_sink sink = { write_output, run.out };
+    if (run.records) {
+        result = render_records(&run, &sink);
+        fclose(run.in);
+        report(&run);
+        return result;
     }
 
-    size_t wrote_bytes = fwrite(
-        run.ctx->output->data,
-        1,
-        run.ctx->output->cursor,
-        run.out
-    );
-    if (wrote_bytes != run.ctx->output->cursor) {
-        fprintf(stderr, l_err_write, run.ctx->output->cursor);
+    const mtpl_reader reader = { read_input, run.in };
+    result = mtpl_parse_stream(&reader, run.ctx, &sink);
+    fclose(run.in);
+    report(&run);
+    if (result == MTPL_ERR_IO) {
+        fprintf(stderr, l_err_io);
         exit(6);
+    } else if (result != MTPL_SUCCESS) {
+        fprintf(stderr, l_err_parse, result, 0);
+        exit(5);
     }
 
     return 0;
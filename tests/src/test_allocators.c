@@ -0,0 +1,125 @@
+#include "testdrive.h"
+
+#include <mintpl/mintpl.h>
+
+FIXTURE(accounting, "Accounting allocator")
+    mtpl_accounting_allocator accounting;
+    mtpl_accounting_init(&mtpl_std_allocators, &accounting);
+    const mtpl_allocators* allocators = &accounting.allocators;
+
+    SECTION("Counts allocations, resizes and live bytes")
+        char* first = mtpl_allocate(allocators, 100);
+        char* second = mtpl_allocate(allocators, 50);
+        REQUIRE(first && second);
+        first = mtpl_reallocate(allocators, first, 300);
+        REQUIRE(first);
+        first[299] = 'x';
+        mtpl_deallocate(allocators, second);
+
+        mtpl_allocation_stats stats = mtpl_accounting_stats(&accounting);
+        REQUIRE(stats.allocations == 2);
+        REQUIRE(stats.reallocations == 1);
+        REQUIRE(stats.bytes_allocated == 450);
+        REQUIRE(stats.live_bytes == 300);
+        REQUIRE(stats.peak_live_bytes == 350);
+
+        mtpl_accounting_reset(&accounting);
+        first = mtpl_reallocate(allocators, first, 10);
+        REQUIRE(first);
+        stats = mtpl_accounting_stats(&accounting);
+        REQUIRE(stats.allocations == 0);
+        REQUIRE(stats.reallocations == 1);
+        REQUIRE(stats.live_bytes == 10);
+        REQUIRE(stats.peak_live_bytes == 300);
+
+        mtpl_deallocate(allocators, first);
+        mtpl_deallocate(allocators, NULL);
+        REQUIRE(mtpl_accounting_stats(&accounting).live_bytes == 0);
+    END_SECTION
+
+    SECTION("Reallocating nothing allocates")
+        void* block = mtpl_reallocate(allocators, NULL, 16);
+        REQUIRE(block);
+        REQUIRE(mtpl_accounting_stats(&accounting).allocations == 1);
+        REQUIRE(mtpl_accounting_stats(&accounting).reallocations == 0);
+        mtpl_deallocate(allocators, block);
+    END_SECTION
+
+    SECTION("Allocations of a render")
+        mtpl_context* context;
+        mtpl_result res = mtpl_init_custom_alloc(allocators, &context);
+        REQUIRE(res == MTPL_SUCCESS);
+        mtpl_set_property("items", "a;b;c", context);
+        const char source[] = "[for> [=> items] x {<[=> x]>}]";
+
+        mtpl_accounting_reset(&accounting);
+        res = mtpl_parse_template(source, context);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(strcmp(context->output->data, "<a><b><c>") == 0);
+        const mtpl_allocation_stats first = mtpl_accounting_stats(&accounting);
+        REQUIRE(first.allocations > 0);
+        REQUIRE(first.peak_live_bytes >= first.live_bytes);
+
+        // Transient storage is kept by the context between renders.
+        mtpl_accounting_reset(&accounting);
+        res = mtpl_parse_template(source, context);
+        REQUIRE(res == MTPL_SUCCESS);
+        const mtpl_allocation_stats again = mtpl_accounting_stats(&accounting);
+        REQUIRE(again.allocations < first.allocations);
+
+        mtpl_free(context);
+        REQUIRE(mtpl_accounting_stats(&accounting).live_bytes == 0);
+    END_SECTION
+
+    SECTION("Parallel loops keep the arenas of their threads")
+        mtpl_context* context;
+        mtpl_result res = mtpl_init_custom_alloc(allocators, &context);
+        REQUIRE(res == MTPL_SUCCESS);
+        const char source[] = "[pfor> [range> 0 8] x {[:>[=> x]]}]";
+        size_t allocations[2];
+        for (size_t i = 0; i < 2; ++i) {
+            // Threads other than the rendering one only allocate their
+            // arenas the first time around.
+            context->pfor_threads = i ? 4 : 1;
+            res = mtpl_parse_template(source, context);
+            REQUIRE(res == MTPL_SUCCESS);
+            mtpl_accounting_reset(&accounting);
+            res = mtpl_parse_template(source, context);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(context->output->data, "01234567") == 0);
+            allocations[i] = mtpl_accounting_stats(&accounting).allocations;
+        }
+        // Beyond a single thread, only the list of their arenas, and whatever
+        // an arena that was left idle the first time around starts out with.
+        REQUIRE(allocations[1] <= allocations[0] + 2);
+
+        mtpl_free(context);
+        REQUIRE(mtpl_accounting_stats(&accounting).live_bytes == 0);
+    END_SECTION
+
+    SECTION("Huge templates are not kept between renders")
+        mtpl_context* context;
+        mtpl_result res = mtpl_init_custom_alloc(allocators, &context);
+        REQUIRE(res == MTPL_SUCCESS);
+        res = mtpl_parse_template("[!> {}]", context);
+        REQUIRE(res == MTPL_SUCCESS);
+        const size_t before = mtpl_accounting_stats(&accounting).live_bytes;
+
+        const size_t length = 4 * MTPL_READ_CHUNK_SIZE;
+        char* source = malloc(length + 8);
+        REQUIRE(source);
+        memcpy(source, "[!> {", 5);
+        memset(&source[5], 'x', length);
+        strcpy(&source[5 + length], "}]");
+        res = mtpl_parse_template(source, context);
+        free(source);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(mtpl_accounting_stats(&accounting).live_bytes < before + length);
+
+        mtpl_free(context);
+    END_SECTION
+END_FIXTURE
+
+int main(void) {
+    return RUN_TEST(accounting);
+}
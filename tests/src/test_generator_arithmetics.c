@@ -12,7 +12,12 @@
         REQUIRE(strcmp(out, EXPECTED) == 0);\
     }
 
-static const mtpl_allocators allocs = { malloc, realloc, free };
+static const mtpl_allocators allocs = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
 
 FIXTURE(generator_arithmetics, "Arithmetics generator")
     char out[32] = { 0 };
@@ -54,6 +59,55 @@ FIXTURE(generator_arithmetics, "Arithmetics generator")
     SECTION("Parentheses")
         TEST_EXPR("-(2 + 2) * 1.5", "-6")
     END_SECTION
+
+    SECTION("Large integers are exact")
+        TEST_EXPR("1000 * 1000", "1000000")
+        buf.cursor = 0;
+        TEST_EXPR("9007199254740993 + 2", "9007199254740995")
+    END_SECTION
+
+    SECTION("Integer overflow falls back to floating point")
+        TEST_EXPR("9223372036854775807 + 1", "9223372036854776000")
+    END_SECTION
+
+    SECTION("Fractions are printed with the shortest exact digits")
+        TEST_EXPR("1 / 3", "0.3333333333333333")
+        buf.cursor = 0;
+        TEST_EXPR("0.1 + 0.2", "0.30000000000000004")
+        buf.cursor = 0;
+        TEST_EXPR("19.99 * 3", "59.97")
+    END_SECTION
+
+    SECTION("Very large and very small results use exponents")
+        TEST_EXPR("10 ^ 21 * 1.5", "1.5e+21")
+        buf.cursor = 0;
+        TEST_EXPR("1 / 10000000", "1e-7")
+    END_SECTION
+
+    SECTION("Subtraction after parentheses")
+        TEST_EXPR("(2 + 2) - 1", "3")
+    END_SECTION
+
+    SECTION("Same expression with different values")
+        TEST_EXPR("2 * (3 + 4)", "14")
+        buf.cursor = 0;
+        TEST_EXPR("5 * (1 + 1)", "10")
+    END_SECTION
+
+    SECTION("Long expression")
+        TEST_EXPR(
+            "1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1"
+            " + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1"
+            " + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1",
+            "48"
+        )
+    END_SECTION
+
+    SECTION("Unbalanced parentheses")
+        mtpl_buffer input = { "(1 + 2" };
+        res = mtpl_generator_arithmetics(&allocs, &input, NULL, NULL, &buf);
+        REQUIRE(res == MTPL_ERR_SYNTAX);
+    END_SECTION
 END_FIXTURE
 
 int main(void) {
@@ -4,7 +4,26 @@
 
 #include <string.h>
 
-static const mtpl_allocators allocs = { malloc, realloc, free };
+static const mtpl_allocators allocs = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
+
+// Copies its argument, but fails on "3".
+static mtpl_result copy_until_three(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    if (strcmp(arg->data, "3") == 0) {
+        return MTPL_ERR_SYNTAX;
+    }
+    return mtpl_generator_copy(allocators, arg, generators, properties, out);
+}
 
 FIXTURE(generators, "Generators")
     char out[32] = { 0 };
@@ -50,6 +69,18 @@ FIXTURE(generators, "Generators")
 
         REQUIRE(res == MTPL_SUCCESS);
         REQUIRE(strcmp("bar", out) == 0);
+
+        SECTION("Binary value")
+            const mtpl_slice value = { "a\0b", 3 };
+            mtpl_htable_insert_string("foo", &value, &allocs, props);
+            buf.cursor = 0;
+            input.cursor = 0;
+            res = mtpl_generator_replace(&allocs, &input, NULL, props, &buf);
+
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(buf.cursor == 3);
+            REQUIRE(memcmp("a\0b", out, 4) == 0);
+        END_SECTION
     END_SECTION
 
     SECTION("has_prop")
@@ -110,6 +141,22 @@ FIXTURE(generators, "Generators")
             REQUIRE(res == MTPL_SUCCESS);
             REQUIRE(strcmp(out, "123456") == 0);
         END_SECTION
+
+        SECTION("Redefinition")
+            mtpl_buffer in = { "operation 123 456" };
+            res = mtpl_generator_expand(&allocs, &in, gens, props, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+
+            mtpl_buffer redefined = { "operation foo;bar [=>bar][=>foo]" };
+            res = mtpl_generator_macro(&allocs, &redefined, gens, props, NULL);
+            REQUIRE(res == MTPL_SUCCESS);
+
+            in.cursor = 0;
+            buf.cursor = 0;
+            res = mtpl_generator_expand(&allocs, &in, gens, props, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(out, "456123") == 0);
+        END_SECTION
     END_SECTION
 
     SECTION("for")
@@ -133,6 +180,64 @@ FIXTURE(generators, "Generators")
             REQUIRE(res == MTPL_SUCCESS);
             REQUIRE(strcmp("baz qux", out) == 0);
         END_SECTION
+
+        SECTION("Range")
+            const mtpl_range range = {
+                { .real = 0 },
+                { .real = 4 },
+                { .real = 1.5 }
+            };
+            mtpl_buffer input = { "n [:>[=>n]\\;]" };
+            res = mtpl_generator_for_range(
+                &allocs,
+                &range,
+                &input,
+                gens,
+                props,
+                &buf
+            );
+
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("0;1.5;3;", out) == 0);
+        END_SECTION
+    END_SECTION
+
+    SECTION("pfor")
+        SECTION("Output in list order")
+            mtpl_htable_insert("test", "ok", 3, &allocs, props);
+
+            mtpl_buffer input = {
+                "1;2;3;4;5;6;7;8;9 meta [:>[=>meta][=>test]]"
+            };
+            res = mtpl_generator_pfor(&allocs, &input, gens, props, &buf);
+
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("1ok2ok3ok4ok5ok6ok7ok8ok9ok", out) == 0);
+        END_SECTION
+
+        SECTION("Output stops at the first failed iteration")
+            mtpl_generator fail = copy_until_three;
+            mtpl_htable_insert("fail", &fail, sizeof(fail), &allocs, gens);
+
+            mtpl_buffer input = { "1;2;3;4;5;6 meta [fail>[=>meta]]" };
+            res = mtpl_generator_pfor(&allocs, &input, gens, props, &buf);
+
+            REQUIRE(res == MTPL_ERR_SYNTAX);
+            REQUIRE(strcmp("12", out) == 0);
+        END_SECTION
+
+        SECTION("Nested loops")
+            mtpl_generator pfor = mtpl_generator_pfor;
+            mtpl_htable_insert("pfor", &pfor, sizeof(pfor), &allocs, gens);
+
+            mtpl_buffer input = {
+                "a;b;c outer [pfor>1\\;2 inner {[=>outer][=>inner]}]"
+            };
+            res = mtpl_generator_pfor(&allocs, &input, gens, props, &buf);
+
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("a1a2b1b2c1c2", out) == 0);
+        END_SECTION
     END_SECTION
 
     SECTION("if")
@@ -214,6 +319,19 @@ FIXTURE(generators, "Generators")
             END_SECTION
         END_SECTION
         
+        SECTION("Numbers are compared numerically")
+            mtpl_buffer input = { "10 9" };
+            res = mtpl_generator_greater(&allocs, &input, gens, NULL, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("#t", out) == 0);
+
+            mtpl_buffer large = { "9007199254740993 9007199254740992" };
+            buf.cursor = 0;
+            res = mtpl_generator_greater(&allocs, &large, gens, NULL, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("#t", out) == 0);
+        END_SECTION
+
         SECTION("less")
             SECTION("Less results in #t")
                 res = mtpl_generator_less(&allocs, &i1223, gens, NULL, &buf);
@@ -330,6 +448,20 @@ FIXTURE(generators, "Generators")
             REQUIRE(res == MTPL_SUCCESS);
             REQUIRE(strcmp(out, "6;4.5;3;1.5") == 0);
         END_SECTION
+
+        SECTION("Large numbers")
+            mtpl_buffer input = { "999999 1000002" };
+            res = mtpl_generator_range(&allocs, &input, NULL, NULL, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(out, "999999;1000000;1000001") == 0);
+        END_SECTION
+
+        SECTION("Integers beyond double precision")
+            mtpl_buffer input = { "9007199254740993 9007199254740994" };
+            res = mtpl_generator_range(&allocs, &input, NULL, NULL, &buf);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(out, "9007199254740993") == 0);
+        END_SECTION
     END_SECTION
 
     SECTION("len")
@@ -353,6 +485,23 @@ FIXTURE(generators, "Generators")
             REQUIRE(res == MTPL_SUCCESS);
             REQUIRE(strcmp(out, "4") == 0);
         END_SECTION
+
+        SECTION("List property")
+            mtpl_buffer input = { "" };
+            const mtpl_slice list = { "foo;bar\\;baz;qux", 16 };
+            mtpl_htable_insert_string("list", &list, &allocs, props);
+            mtpl_hashentry* entry = mtpl_htable_lookup("list", props);
+            res = mtpl_generator_len_list(
+                &allocs,
+                entry,
+                &input,
+                NULL,
+                props,
+                &buf
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(out, "3") == 0);
+        END_SECTION
     END_SECTION
     
     SECTION("element")
@@ -368,6 +517,53 @@ FIXTURE(generators, "Generators")
             REQUIRE(res == MTPL_SUCCESS);
             REQUIRE(strcmp(out, "baz") == 0);
         END_SECTION
+
+        SECTION("List property")
+            const mtpl_slice list = { "foo;bar\\;baz;qux", 16 };
+            mtpl_htable_insert_string("list", &list, &allocs, props);
+            mtpl_hashentry* entry = mtpl_htable_lookup("list", props);
+            mtpl_buffer input = { " 1" };
+            res = mtpl_generator_element_list(
+                &allocs,
+                entry,
+                &input,
+                NULL,
+                props,
+                &buf
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            // As for the list as text, escapes are removed before the
+            // elements are told apart.
+            REQUIRE(strcmp(out, "bar") == 0);
+
+            input.data = " 4";
+            res = mtpl_generator_element_list(
+                &allocs,
+                entry,
+                &input,
+                NULL,
+                props,
+                &buf
+            );
+            REQUIRE(res == MTPL_ERR_UNKNOWN_KEY);
+
+            SECTION("Index is rebuilt when the list is written")
+                const mtpl_slice longer = { "a;b;c;d", 7 };
+                mtpl_htable_insert_string("list", &longer, &allocs, props);
+                buf.cursor = 0;
+                input.data = " 3";
+                res = mtpl_generator_element_list(
+                    &allocs,
+                    entry,
+                    &input,
+                    NULL,
+                    props,
+                    &buf
+                );
+                REQUIRE(res == MTPL_SUCCESS);
+                REQUIRE(strcmp(out, "d") == 0);
+            END_SECTION
+        END_SECTION
     END_SECTION
 
     mtpl_htable_free(&allocs, gens);
@@ -2,7 +2,33 @@
 
 #include <mintpl/hashtable.h>
 
-static const mtpl_allocators allocs = { malloc, realloc, free };
+static const mtpl_allocators allocs = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
+
+// Kinds of caches are told apart by their release function, so these count
+// separately to keep them from being folded into one.
+static size_t released_first = 0;
+static size_t released_second = 0;
+
+static void free_first_cache(
+    const mtpl_allocators* allocators,
+    mtpl_hashcache* cache
+) {
+    released_first++;
+    mtpl_deallocate(allocators, cache);
+}
+
+static void free_second_cache(
+    const mtpl_allocators* allocators,
+    mtpl_hashcache* cache
+) {
+    released_second++;
+    mtpl_deallocate(allocators, cache);
+}
 
 FIXTURE(hashtable, "Hashtable")
     char input[] = "foo bar";
@@ -29,6 +55,31 @@ FIXTURE(hashtable, "Hashtable")
             REQUIRE(found != input);
         END_SECTION
 
+        SECTION("Overwriting")
+            found = mtpl_htable_search("test", htable);
+            res = mtpl_htable_insert("test", "baz", 4, &allocs, htable);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(htable->count == 1);
+            REQUIRE(mtpl_htable_search("test", htable) == found);
+            REQUIRE(strcmp(found, "baz") == 0);
+
+            res = mtpl_htable_insert(
+                "test",
+                "a much longer value",
+                20,
+                &allocs,
+                htable
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(htable->count == 1);
+            found = mtpl_htable_search("test", htable);
+            REQUIRE(strcmp(found, "a much longer value") == 0);
+
+            res = mtpl_htable_insert("test", &found[2], 18, &allocs, htable);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(found, "much longer value") == 0);
+        END_SECTION
+
         SECTION("Deletion")
             res = mtpl_htable_delete("test", &allocs, htable);
             found = mtpl_htable_search("test", htable);
@@ -52,6 +103,112 @@ FIXTURE(hashtable, "Hashtable")
         END_SECTION
     END_SECTION
 
+    SECTION("Growing past the inline slots")
+        char key[16];
+        for (int i = 0; i < 20; ++i) {
+            sprintf(key, "key%d", i);
+            mtpl_htable_insert(key, key, strlen(key) + 1, &allocs, htable);
+        }
+        REQUIRE(htable->count == 20);
+        bool found = true;
+        for (int i = 0; i < 20; ++i) {
+            sprintf(key, "key%d", i);
+            found &= strcmp(mtpl_htable_search(key, htable), key) == 0;
+        }
+        REQUIRE(found);
+    END_SECTION
+
+    SECTION("Deletion from a grown table")
+        char key[16];
+        for (int i = 0; i < 1000; ++i) {
+            sprintf(key, "key%d", i);
+            mtpl_htable_insert(key, key, strlen(key) + 1, &allocs, htable);
+        }
+        bool intact = true;
+        for (int i = 0; i < 1000; i += 2) {
+            sprintf(key, "key%d", i);
+            res = mtpl_htable_delete(key, &allocs, htable);
+            intact &= res == MTPL_SUCCESS;
+        }
+        REQUIRE(htable->count == 500);
+        for (int i = 0; i < 1000; ++i) {
+            sprintf(key, "key%d", i);
+            const char* found = mtpl_htable_search(key, htable);
+            intact &= i % 2 ? found && strcmp(found, key) == 0 : !found;
+        }
+        REQUIRE(intact);
+    END_SECTION
+
+    SECTION("Inline deletion")
+        mtpl_htable_insert("a", "1", 2, &allocs, htable);
+        mtpl_htable_insert("b", "2", 2, &allocs, htable);
+        mtpl_htable_insert("c", "3", 2, &allocs, htable);
+        res = mtpl_htable_delete("a", &allocs, htable);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(htable->count == 2);
+        REQUIRE(!mtpl_htable_search("a", htable));
+        REQUIRE(strcmp(mtpl_htable_search("b", htable), "2") == 0);
+        REQUIRE(strcmp(mtpl_htable_search("c", htable), "3") == 0);
+    END_SECTION
+
+    SECTION("Scope chain")
+        mtpl_hashtable* scope;
+        mtpl_htable_create(&allocs, &scope);
+        scope->next = htable;
+        mtpl_htable_insert("outer", "1", 2, &allocs, htable);
+        mtpl_htable_insert("shadowed", "2", 2, &allocs, htable);
+        mtpl_htable_insert("shadowed", "3", 2, &allocs, scope);
+        REQUIRE(strcmp(mtpl_htable_search("outer", scope), "1") == 0);
+        REQUIRE(strcmp(mtpl_htable_search("shadowed", scope), "3") == 0);
+        REQUIRE(strcmp(mtpl_htable_search("shadowed", htable), "2") == 0);
+        scope->next = NULL;
+        mtpl_htable_free(&allocs, scope);
+    END_SECTION
+
+    SECTION("Frozen table")
+        mtpl_htable_insert("kept", "1", 2, &allocs, htable);
+        mtpl_htable_freeze(htable);
+        res = mtpl_htable_insert("kept", "2", 2, &allocs, htable);
+        REQUIRE(res == MTPL_ERR_FROZEN);
+        res = mtpl_htable_insert("added", "2", 2, &allocs, htable);
+        REQUIRE(res == MTPL_ERR_FROZEN);
+        REQUIRE(mtpl_htable_delete("kept", &allocs, htable) == MTPL_ERR_FROZEN);
+        REQUIRE(strcmp(mtpl_htable_search("kept", htable), "1") == 0);
+
+        mtpl_hashtable* scope;
+        mtpl_htable_create(&allocs, &scope);
+        scope->next = htable;
+        res = mtpl_htable_insert("kept", "3", 2, &allocs, scope);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(strcmp(mtpl_htable_search("kept", scope), "3") == 0);
+        REQUIRE(strcmp(mtpl_htable_search("kept", htable), "1") == 0);
+        mtpl_htable_free(&allocs, scope);
+    END_SECTION
+
+    SECTION("Caches of different kinds")
+        mtpl_htable_insert("cached", "1", 2, &allocs, htable);
+        mtpl_hashentry* entry = mtpl_htable_lookup("cached", htable);
+        mtpl_hashcache* first = malloc(sizeof(mtpl_hashcache));
+        mtpl_hashcache* second = malloc(sizeof(mtpl_hashcache));
+        mtpl_hashcache* duplicate = malloc(sizeof(mtpl_hashcache));
+        *first = (mtpl_hashcache) { free_first_cache };
+        *second = (mtpl_hashcache) { free_second_cache };
+        *duplicate = (mtpl_hashcache) { free_first_cache };
+        REQUIRE(mtpl_htable_attach_cache(entry, first, &allocs) == first);
+        REQUIRE(mtpl_htable_attach_cache(entry, second, &allocs) == second);
+        REQUIRE(mtpl_htable_find_cache(entry, free_first_cache) == first);
+        REQUIRE(mtpl_htable_find_cache(entry, free_second_cache) == second);
+
+        // A second cache of the same kind gives way to the first one.
+        REQUIRE(mtpl_htable_attach_cache(entry, duplicate, &allocs) == first);
+        REQUIRE(released_first == 1);
+
+        mtpl_htable_insert("cached", "2", 2, &allocs, htable);
+        REQUIRE(released_first == 2);
+        REQUIRE(released_second == 1);
+        REQUIRE(!mtpl_htable_find_cache(entry, free_first_cache));
+    END_SECTION
+
     mtpl_htable_free(&allocs, htable);
 END_FIXTURE
 
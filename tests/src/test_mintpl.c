@@ -0,0 +1,650 @@
+#include "testdrive.h"
+
+#include <mintpl/mintpl.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#define NUM_THREADS 8
+#define RENDERS_PER_THREAD 200
+
+static const char shared_template[] =
+    "[let> greeting Hello][**> greet [=> name]]"
+    " [len> [=> names]] [()> [=> names] 1]";
+
+typedef struct {
+    const mtpl_context* base;
+    const mtpl_program* program;
+    char name[16];
+    bool ok;
+} render_job;
+
+// Renders with an overlay of its own, checking that no other thread's
+// bindings leak into the output.
+static void* render_concurrently(void* data) {
+    render_job* job = data;
+    char expected[64];
+    snprintf(expected, sizeof(expected), "Hello, %s! 3 b", job->name);
+
+    mtpl_context* overlay;
+    if (mtpl_init_overlay(job->base, &overlay) != MTPL_SUCCESS) {
+        return NULL;
+    }
+    job->ok = true;
+    for (size_t i = 0; i < RENDERS_PER_THREAD && job->ok; ++i) {
+        mtpl_clear_properties(overlay);
+        job->ok = mtpl_set_property("name", job->name, overlay) == MTPL_SUCCESS
+            && mtpl_run_template(job->program, overlay) == MTPL_SUCCESS
+            && strcmp(overlay->output->data, expected) == 0;
+    }
+    mtpl_free(overlay);
+    return NULL;
+}
+
+#define BATCH_RECORDS 100
+
+typedef struct {
+    char data[4096];
+    size_t length;
+    char records[BATCH_RECORDS][16];
+} batch_output;
+
+static mtpl_result write_stream(void* user, const char* data, size_t length) {
+    batch_output* output = user;
+    if (output->length + length >= sizeof(output->data)) {
+        return MTPL_ERR_IO;
+    }
+    memcpy(&output->data[output->length], data, length);
+    output->length += length;
+    output->data[output->length] = '\0';
+    return MTPL_SUCCESS;
+}
+
+static mtpl_result write_record(
+    void* user,
+    size_t index,
+    const char* data,
+    size_t length
+) {
+    batch_output* output = user;
+    if (length >= sizeof(output->records[index])) {
+        return MTPL_ERR_IO;
+    }
+    memcpy(output->records[index], data, length);
+    output->records[index][length] = '\0';
+    return MTPL_SUCCESS;
+}
+
+// Sets `n` to the index of the record, failing on record 42.
+static mtpl_result prepare_record(
+    void* user,
+    size_t index,
+    mtpl_context* record_context
+) {
+    (void) user;
+    if (index == 42) {
+        return MTPL_ERR_UNKNOWN_KEY;
+    }
+    char n[16];
+    snprintf(n, sizeof(n), "%zu", index);
+    return mtpl_set_property("n", n, record_context);
+}
+
+static size_t count_occurrences(const char* text, const char* part) {
+    size_t count = 0;
+    for (text = strstr(text, part); text; text = strstr(text + 1, part)) {
+        count++;
+    }
+    return count;
+}
+
+static const mtpl_generator_stats* find_stats(
+    const mtpl_context* context,
+    const char* name
+) {
+    const mtpl_stats stats = mtpl_get_stats(context);
+    for (size_t i = 0; i < stats.count; ++i) {
+        if (strcmp(stats.generators[i].name, name) == 0) {
+            return &stats.generators[i];
+        }
+    }
+    return NULL;
+}
+
+static pthread_t main_thread;
+static bool ran_elsewhere;
+
+// Notes whether it was called on a thread other than the main one. Takes a
+// millisecond, giving other threads of a loop the time to start.
+static mtpl_result note_thread(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    (void) allocators;
+    (void) arg;
+    (void) generators;
+    (void) properties;
+    (void) out;
+    const struct timespec pause = { 0, 1000000 };
+    nanosleep(&pause, NULL);
+    if (!pthread_equal(pthread_self(), main_thread)) {
+        __atomic_store_n(&ran_elsewhere, true, __ATOMIC_RELAXED);
+    }
+    return MTPL_SUCCESS;
+}
+
+static size_t threads_noted;
+
+// Counts the threads it is called on, each the first time around.
+static mtpl_result count_thread(
+    const mtpl_allocators* allocators,
+    mtpl_buffer* arg,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    mtpl_buffer* out
+) {
+    static _Thread_local bool noted = false;
+    if (!noted) {
+        noted = true;
+        __atomic_add_fetch(&threads_noted, 1, __ATOMIC_RELAXED);
+    }
+    return note_thread(allocators, arg, generators, properties, out);
+}
+
+#define SMALL_STACK (64 * 1024)
+
+typedef struct {
+    const char* source;
+    mtpl_context* context;
+    mtpl_result result;
+} stack_render;
+
+static void* render_stack(void* data) {
+    stack_render* render = data;
+    render->result = mtpl_parse_template(render->source, render->context);
+    return NULL;
+}
+
+// Renders on a thread with a stack of SMALL_STACK bytes.
+static mtpl_result render_on_small_stack(
+    const char* source,
+    mtpl_context* context
+) {
+    stack_render render = { source, context, MTPL_ERR_IO };
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, SMALL_STACK);
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, render_stack, &render) == 0) {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attributes);
+    return render.result;
+}
+
+FIXTURE(context, "Context")
+    mtpl_context* base;
+    mtpl_result res = mtpl_init(&base);
+    REQUIRE(res == MTPL_SUCCESS);
+    mtpl_set_property("shared", "base", base);
+    mtpl_set_property("names", "a;b;c", base);
+    mtpl_set_property("greet", "who [=> greeting], [=> who]!", base);
+    mtpl_freeze(base);
+
+    SECTION("Frozen context rejects changes")
+        REQUIRE(mtpl_set_property("shared", "x", base) == MTPL_ERR_FROZEN);
+        REQUIRE(
+            mtpl_set_generator("noop", mtpl_generator_nop, base)
+                == MTPL_ERR_FROZEN
+        );
+        REQUIRE(mtpl_parse_template("[let> x 1]", base) == MTPL_ERR_FROZEN);
+        REQUIRE(strcmp(mtpl_htable_search("shared", base->properties), "base") == 0);
+    END_SECTION
+
+    SECTION("Overlay")
+        mtpl_context* overlay;
+        res = mtpl_init_overlay(base, &overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(overlay->generators == base->generators);
+
+        SECTION("Reads properties of the base")
+            res = mtpl_parse_template("[=> shared] [len> [=> names]]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "base 3") == 0);
+        END_SECTION
+
+        SECTION("Bindings shadow the base without changing it")
+            res = mtpl_parse_template("[let> shared overlay][=> shared]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "overlay") == 0);
+            REQUIRE(strcmp(mtpl_htable_search("shared", base->properties), "base") == 0);
+
+            mtpl_clear_properties(overlay);
+            res = mtpl_parse_template("[=> shared]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "base") == 0);
+        END_SECTION
+
+        SECTION("Generators are shared")
+            REQUIRE(
+                mtpl_set_generator("noop", mtpl_generator_nop, overlay)
+                    == MTPL_ERR_FROZEN
+            );
+        END_SECTION
+
+        mtpl_free(overlay);
+    END_SECTION
+
+    SECTION("Concurrent rendering")
+        mtpl_program* program;
+        res = mtpl_compile_template(shared_template, base, &program);
+        REQUIRE(res == MTPL_SUCCESS);
+
+        pthread_t threads[NUM_THREADS];
+        render_job jobs[NUM_THREADS];
+        for (size_t i = 0; i < NUM_THREADS; ++i) {
+            jobs[i] = (render_job) { base, program, { 0 }, false };
+            snprintf(jobs[i].name, sizeof(jobs[i].name), "thread_%zu", i);
+            pthread_create(&threads[i], NULL, render_concurrently, &jobs[i]);
+        }
+        size_t succeeded = 0;
+        for (size_t i = 0; i < NUM_THREADS; ++i) {
+            pthread_join(threads[i], NULL);
+            succeeded += jobs[i].ok;
+        }
+        mtpl_program_free(base->allocators, program);
+        REQUIRE(succeeded == NUM_THREADS);
+    END_SECTION
+
+    SECTION("Batch rendering")
+        mtpl_program* program;
+        res = mtpl_compile_template("[=> shared][=> n];", base, &program);
+        REQUIRE(res == MTPL_SUCCESS);
+
+        static batch_output output;
+        output.length = 0;
+        output.data[0] = '\0';
+        const mtpl_sink sink = { write_stream, &output };
+
+        char expected[4096] = { 0 };
+        size_t expected_length = 0;
+        for (size_t i = 0; i < BATCH_RECORDS; ++i) {
+            expected_length += sprintf(
+                &expected[expected_length],
+                "base%zu;",
+                i
+            );
+        }
+
+        SECTION("Property sets to one ordered stream")
+            static char values[BATCH_RECORDS][16];
+            static mtpl_property properties[BATCH_RECORDS];
+            static mtpl_property_set sets[BATCH_RECORDS];
+            for (size_t i = 0; i < BATCH_RECORDS; ++i) {
+                const size_t length = sprintf(values[i], "%zu", i);
+                properties[i] = (mtpl_property) {
+                    "n",
+                    { values[i], length }
+                };
+                sets[i] = (mtpl_property_set) { &properties[i], 1 };
+            }
+            const mtpl_batch batch = {
+                .threads = 4,
+                .sets = sets,
+                .sink = &sink
+            };
+            res = mtpl_render_batch(program, base, BATCH_RECORDS, &batch);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(output.data, expected) == 0);
+        END_SECTION
+
+        SECTION("Prepared records to per-record output")
+            const mtpl_batch batch = {
+                .threads = 4,
+                .prepare = prepare_record,
+                .write = write_record,
+                .user = &output
+            };
+            res = mtpl_render_batch(program, base, 42, &batch);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(output.records[0], "base0;") == 0);
+            REQUIRE(strcmp(output.records[41], "base41;") == 0);
+        END_SECTION
+
+        SECTION("Errors stop the batch")
+            const mtpl_batch batch = {
+                .threads = 4,
+                .prepare = prepare_record,
+                .sink = &sink
+            };
+            res = mtpl_render_batch(program, base, BATCH_RECORDS, &batch);
+            REQUIRE(res == MTPL_ERR_UNKNOWN_KEY);
+            // Output ends in order, before the failed record.
+            REQUIRE(strncmp(output.data, expected, output.length) == 0);
+            REQUIRE(!strstr(output.data, "base42;"));
+        END_SECTION
+
+        mtpl_program_free(base->allocators, program);
+    END_SECTION
+
+    SECTION("Profiling")
+        mtpl_context* overlay;
+        res = mtpl_init_overlay(base, &overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(mtpl_get_stats(overlay).count == 0);
+        res = mtpl_enable_profiling(overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+
+        SECTION("Generators and macros")
+            res = mtpl_parse_template(
+                "[let> greeting Hi][**> greet [=> shared]]",
+                overlay
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "Hi, base!") == 0);
+            REQUIRE(mtpl_get_stats(overlay).count == 4);
+
+            const mtpl_generator_stats* replace = find_stats(overlay, "=");
+            REQUIRE(replace && replace->calls == 3);
+            REQUIRE(replace->output_bytes == strlen("baseHibase"));
+            const mtpl_generator_stats* expand = find_stats(overlay, "**");
+            REQUIRE(expand && expand->calls == 1);
+            REQUIRE(expand->output_bytes == strlen("Hi, base!"));
+            REQUIRE(expand->argument_bytes == strlen("greet base"));
+            const mtpl_generator_stats* greet = find_stats(overlay, "**> greet");
+            REQUIRE(greet && greet->calls == 1);
+            REQUIRE(greet->argument_bytes == strlen("base"));
+            REQUIRE(greet->output_bytes == strlen("Hi, base!"));
+            REQUIRE(expand->inclusive_ns >= greet->inclusive_ns);
+            REQUIRE(greet->inclusive_ns >= greet->exclusive_ns);
+            REQUIRE(expand->exclusive_ns <= expand->inclusive_ns - greet->inclusive_ns);
+        END_SECTION
+
+        SECTION("Output streamed to a sink")
+            static batch_output output;
+            output.length = 0;
+            const mtpl_sink sink = { write_stream, &output };
+            res = mtpl_parse_template_sink(
+                "[for> [=> names] x {[=> x], }]",
+                overlay,
+                &sink
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            const mtpl_generator_stats* loop = find_stats(overlay, "for");
+            REQUIRE(loop && loop->output_bytes == strlen("a, b, c, "));
+        END_SECTION
+
+        SECTION("Lookups and ranges handed to generators as is")
+            res = mtpl_parse_template(
+                "[len> [=> names]][()> [=> names] 1]"
+                "[for> [range> 0 2] i {}]",
+                overlay
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "3b") == 0);
+            const mtpl_generator_stats* replace = find_stats(overlay, "=");
+            REQUIRE(replace && replace->calls == 2);
+            REQUIRE(replace->argument_bytes == 2 * strlen("names"));
+            REQUIRE(replace->output_bytes == 2 * strlen("a;b;c"));
+            const mtpl_generator_stats* range = find_stats(overlay, "range");
+            REQUIRE(range && range->calls == 1);
+        END_SECTION
+
+        SECTION("Iterations on other threads")
+            overlay->pfor_threads = 3;
+            res = mtpl_parse_template("[pfor> [=> names] x {[=> x]}]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "abc") == 0);
+            const mtpl_generator_stats* replace = find_stats(overlay, "=");
+            REQUIRE(replace && replace->calls == 4);
+        END_SECTION
+
+        SECTION("Enabling again starts over")
+            res = mtpl_parse_template("[=> shared]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_enable_profiling(overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(mtpl_get_stats(overlay).count == 0);
+            mtpl_disable_profiling(overlay);
+            res = mtpl_parse_template("[=> shared]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(mtpl_get_stats(overlay).count == 0);
+        END_SECTION
+
+        mtpl_free(overlay);
+    END_SECTION
+
+    SECTION("Profiling a batch")
+        mtpl_program* program;
+        res = mtpl_compile_template("[=> shared][=> n];", base, &program);
+        REQUIRE(res == MTPL_SUCCESS);
+        res = mtpl_enable_profiling(base);
+        REQUIRE(res == MTPL_SUCCESS);
+        static batch_output output;
+        const mtpl_batch batch = {
+            .threads = 4,
+            .prepare = prepare_record,
+            .write = write_record,
+            .user = &output
+        };
+        res = mtpl_render_batch(program, base, 42, &batch);
+        mtpl_program_free(base->allocators, program);
+        REQUIRE(res == MTPL_SUCCESS);
+        const mtpl_generator_stats* replace = find_stats(base, "=");
+        REQUIRE(replace && replace->calls == 84);
+    END_SECTION
+
+    SECTION("Tracing")
+        mtpl_context* overlay;
+        res = mtpl_init_overlay(base, &overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+        static batch_output output;
+        output.length = 0;
+        const mtpl_sink sink = { write_stream, &output };
+
+        SECTION("Without tracing enabled")
+            res = mtpl_write_trace(overlay, &sink);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(output.data, "{\"traceEvents\":[]}\n") == 0);
+        END_SECTION
+
+        SECTION("Substitutions and macros")
+            res = mtpl_enable_tracing(overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_parse_template(
+                "ab[let> greeting Hi][**> greet [=> shared]]",
+                overlay
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_write_trace(overlay, &sink);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strncmp(output.data, "{\"traceEvents\":[", 16) == 0);
+            REQUIRE(count_occurrences(output.data, "\"ph\":\"B\"") == 6);
+            REQUIRE(count_occurrences(output.data, "\"ph\":\"E\"") == 6);
+            REQUIRE(strstr(output.data, "\"argument_bytes\":10,\"offset\":20}"));
+            REQUIRE(strstr(output.data, "\"argument_bytes\":6,\"offset\":31}"));
+            // Macros are named after their expansion, and have no offset.
+            REQUIRE(strstr(output.data, "\"name\":\"**> greet\",\"ph\":\"B\""));
+            REQUIRE(strstr(output.data, "\"args\":{\"argument_bytes\":4}}"));
+            // Substitutions in the macro body have offsets into the body.
+            REQUIRE(strstr(output.data, "\"argument_bytes\":8,\"offset\":0}"));
+        END_SECTION
+
+        SECTION("Iterations on other threads")
+            res = mtpl_enable_tracing(overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            overlay->pfor_threads = 3;
+            res = mtpl_parse_template("[pfor> [=> names] x {[=> x]}]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_write_trace(overlay, &sink);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(count_occurrences(output.data, "\"name\":\"=\"") == 4);
+            REQUIRE(count_occurrences(output.data, "\"ph\":\"E\"") == 5);
+        END_SECTION
+
+        mtpl_free(overlay);
+    END_SECTION
+
+    SECTION("Threads of parallel loops are set per context")
+        static const char loop[] = "[pfor> [range> 0 16] x {[spot>]}]";
+        mtpl_context* serial;
+        res = mtpl_init(&serial);
+        REQUIRE(res == MTPL_SUCCESS);
+        mtpl_context* parallel;
+        res = mtpl_init(&parallel);
+        REQUIRE(res == MTPL_SUCCESS);
+        mtpl_set_generator("spot", note_thread, serial);
+        mtpl_set_generator("spot", note_thread, parallel);
+        serial->pfor_threads = 1;
+        parallel->pfor_threads = 4;
+        main_thread = pthread_self();
+
+        ran_elsewhere = false;
+        res = mtpl_parse_template(loop, parallel);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(ran_elsewhere);
+
+        ran_elsewhere = false;
+        res = mtpl_parse_template(loop, serial);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(!ran_elsewhere);
+
+        mtpl_context* overlay;
+        res = mtpl_init_overlay(parallel, &overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(overlay->pfor_threads == 4);
+        mtpl_free(overlay);
+
+        mtpl_free(parallel);
+        mtpl_free(serial);
+    END_SECTION
+
+    SECTION("Threads of parallel loops are kept between renders")
+        mtpl_context* parallel;
+        res = mtpl_init(&parallel);
+        REQUIRE(res == MTPL_SUCCESS);
+        mtpl_set_generator("spot", count_thread, parallel);
+        parallel->pfor_threads = 4;
+        main_thread = pthread_self();
+        ran_elsewhere = false;
+        threads_noted = 0;
+        for (size_t i = 0; i < 5; ++i) {
+            res = mtpl_parse_template(
+                "[for> [range> 0 2] y {[pfor> [range> 0 8] x {[spot>]}]}]",
+                parallel
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+        }
+        REQUIRE(ran_elsewhere);
+        REQUIRE(threads_noted <= 4);
+        mtpl_free(parallel);
+    END_SECTION
+
+    SECTION("Limits")
+        mtpl_context* overlay;
+        res = mtpl_init_overlay(base, &overlay);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(overlay->limits.max_depth == MTPL_DEFAULT_MAX_DEPTH);
+        REQUIRE(overlay->limits.max_stack == MTPL_DEFAULT_STACK_SIZE);
+        res = mtpl_parse_template(
+            "[macro> down n {[if> [eq> [=>n] 0] 0 {[**> down [#> [=>n] - 1]]}]}]",
+            overlay
+        );
+        REQUIRE(res == MTPL_SUCCESS);
+
+        SECTION("Runaway recursion")
+            overlay->limits.max_depth = 1000;
+            res = mtpl_parse_template("[**> down 0.5]", overlay);
+            REQUIRE(res == MTPL_ERR_DEPTH_LIMIT);
+            res = mtpl_parse_template("[**> down 10]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "0") == 0);
+        END_SECTION
+
+        SECTION("Steps")
+            overlay->limits.max_steps = 100;
+            res = mtpl_parse_template("[for> [range> 0 50] x {}]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_parse_template("[for> [range> 0 1000000] x {}]", overlay);
+            REQUIRE(res == MTPL_ERR_STEP_LIMIT);
+            overlay->pfor_threads = 3;
+            res = mtpl_parse_template("[pfor> [range> 0 200] x {}]", overlay);
+            REQUIRE(res == MTPL_ERR_STEP_LIMIT);
+        END_SECTION
+
+        SECTION("Output")
+            overlay->limits.max_output = 1000;
+            res = mtpl_parse_template("[range> 0 100]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            res = mtpl_parse_template("[range> 0 1000000000]", overlay);
+            REQUIRE(res == MTPL_ERR_OUTPUT_LIMIT);
+
+            batch_output output = { .length = 0 };
+            const mtpl_sink sink = { write_stream, &output };
+            res = mtpl_parse_template_sink(
+                "[for> [range> 0 600] x {ab}]",
+                overlay,
+                &sink
+            );
+            REQUIRE(res == MTPL_ERR_OUTPUT_LIMIT);
+        END_SECTION
+
+        SECTION("Time")
+            overlay->limits.max_time_ms = 10;
+            res = mtpl_parse_template(
+                "[for> [range> 0 1000000000000] x {[!> x]}]",
+                overlay
+            );
+            REQUIRE(res == MTPL_ERR_TIME_LIMIT);
+        END_SECTION
+
+        SECTION("Deep recursion")
+            res = mtpl_parse_template("[**> down 5000]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "0") == 0);
+        END_SECTION
+
+        SECTION("Unlimited")
+            overlay->limits = (mtpl_limits) { 0 };
+            res = mtpl_parse_template("[**> down 2000]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+        END_SECTION
+
+        SECTION("Deep recursion on a small stack")
+            // Built-in generators nest on the heap, not taking up the stack.
+            overlay->limits = (mtpl_limits) { .max_stack = SMALL_STACK / 2 };
+            res = render_on_small_stack("[**> down 5000]", overlay);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp(overlay->output->data, "0") == 0);
+        END_SECTION
+
+        SECTION("Runaway recursion on a small stack")
+            overlay->limits.max_depth = 1000;
+            overlay->limits.max_stack = SMALL_STACK / 2;
+            res = render_on_small_stack("[**> down 0.5]", overlay);
+            REQUIRE(res == MTPL_ERR_DEPTH_LIMIT);
+
+            // Nesting through `pfor` takes up the stack, whatever the depth.
+            overlay->pfor_threads = 1;
+            overlay->limits.max_depth = 0;
+            res = mtpl_parse_template(
+                "[macro> spin n {[pfor> a x {[**> spin [=>n]]}]}]",
+                overlay
+            );
+            REQUIRE(res == MTPL_SUCCESS);
+            res = render_on_small_stack("[**> spin 0]", overlay);
+            REQUIRE(res == MTPL_ERR_DEPTH_LIMIT);
+        END_SECTION
+
+        mtpl_free(overlay);
+    END_SECTION
+
+    mtpl_free(base);
+END_FIXTURE
+
+int main(void) {
+    return RUN_TEST(context);
+}
@@ -3,7 +3,98 @@
 #include <mintpl/generators.h>
 #include <mintpl/substitute.h>
 
-static const mtpl_allocators allocs = { malloc, realloc, free };
+#include <pthread.h>
+
+static const mtpl_allocators allocs = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
+
+typedef struct {
+    char data[4096];
+    size_t length;
+    size_t chunks;
+} collected_output;
+
+static mtpl_result collect(void* user, const char* data, size_t length) {
+    collected_output* collected = user;
+    if (collected->length + length >= sizeof(collected->data)) {
+        return MTPL_ERR_IO;
+    }
+    memcpy(&collected->data[collected->length], data, length);
+    collected->length += length;
+    collected->data[collected->length] = '\0';
+    collected->chunks++;
+    return MTPL_SUCCESS;
+}
+
+typedef struct {
+    const char* data;
+    size_t chunk_size;
+} chunked_input;
+
+static mtpl_result read_chunk(
+    void* user,
+    char* data,
+    size_t size,
+    size_t* out_length
+) {
+    chunked_input* input = user;
+    size_t length = strlen(input->data);
+    if (length > input->chunk_size) {
+        length = input->chunk_size;
+    }
+    memcpy(data, input->data, length);
+    input->data += length;
+    *out_length = length;
+    return MTPL_SUCCESS;
+}
+
+#define DEEP_NESTING 5000
+#define SMALL_STACK (64 * 1024)
+
+typedef struct {
+    mtpl_hashtable* generators;
+    mtpl_buffer* out;
+    mtpl_result result;
+} deep_render;
+
+// Renders DEEP_NESTING nested substitutions, far more than the frames of a
+// recursive evaluator would fit in a small stack.
+static void* render_deep(void* data) {
+    deep_render* render = data;
+    static char source[DEEP_NESTING * 4 + 2];
+    for (size_t i = 0; i < DEEP_NESTING; ++i) {
+        memcpy(&source[i * 3], "[:>", 3);
+    }
+    source[DEEP_NESTING * 3] = 'x';
+    memset(&source[DEEP_NESTING * 3 + 1], ']', DEEP_NESTING);
+    source[DEEP_NESTING * 4 + 1] = '\0';
+    render->result = mtpl_substitute(
+        source,
+        &allocs,
+        render->generators,
+        NULL,
+        render->out
+    );
+    return NULL;
+}
+
+// Renders `source` using the given properties, returning the result and the
+// output in `out`.
+static mtpl_result render_into(
+    const char* source,
+    mtpl_hashtable* generators,
+    mtpl_hashtable* properties,
+    char* out,
+    size_t size
+) {
+    mtpl_buffer buffer = { .data = out, .cursor = 0, .size = size };
+    out[0] = '\0';
+    return mtpl_substitute(source, &allocs, generators, properties, &buffer);
+}
 
 FIXTURE(substitution, "Substitution")
     char text[256] = { 0 };
@@ -69,6 +160,37 @@ FIXTURE(substitution, "Substitution")
         END_SECTION
     END_SECTION
 
+    SECTION("Long literal runs")
+        res = mtpl_substitute(
+            "0123456789abcdefghijklmnopqrstuv\\[0123456789abcdefghijklmnop"
+                "{[x]}0123456789[:>abcdefghijklmnopqrstuvwxyz]0123456789",
+            &allocs,
+            gens,
+            NULL,
+            &buffer
+        );
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(
+            strcmp(
+                "0123456789abcdefghijklmnopqrstuv[0123456789abcdefghijklmnop"
+                    "[x]0123456789abcdefghijklmnopqrstuvwxyz0123456789",
+                text
+            ) == 0
+        );
+    END_SECTION
+
+    SECTION("Nested quotes")
+        res = mtpl_substitute(
+            "[:>{a{b\\}c}{d}}e]{f[}",
+            &allocs,
+            gens,
+            NULL,
+            &buffer
+        );
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(strcmp("a{b}c}{d}ef[", text) == 0);
+    END_SECTION
+
     SECTION("Nested")
         res = mtpl_substitute("[:>foo[:>bar]]", &allocs, gens, NULL, &buffer);
         REQUIRE(res == MTPL_SUCCESS);
@@ -102,6 +224,277 @@ FIXTURE(substitution, "Substitution")
         REQUIRE(res == MTPL_SUCCESS);
         REQUIRE(strcmp("[:>foobar]", text) == 0);
     END_SECTION
+
+    SECTION("Compiled program")
+        mtpl_hashtable* properties;
+        mtpl_htable_create(&allocs, &properties);
+        mtpl_program* program;
+        res = mtpl_compile(
+            "<[:>[=>test1]]\\]\\ {[=>test2]}>",
+            &allocs,
+            gens,
+            &program
+        );
+        REQUIRE(res == MTPL_SUCCESS);
+
+        SECTION("Rendering")
+            mtpl_htable_insert("test1", "foo", 4, &allocs, properties);
+            res = mtpl_run(program, &allocs, gens, properties, &buffer);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("<foo][=>test2]>", text) == 0);
+        END_SECTION
+
+        SECTION("Rendering is repeatable")
+            mtpl_htable_insert("test1", "foo", 4, &allocs, properties);
+            res = mtpl_run(program, &allocs, gens, properties, &buffer);
+            REQUIRE(res == MTPL_SUCCESS);
+            buffer.cursor = 0;
+            mtpl_htable_insert("test1", "bar", 4, &allocs, properties);
+            res = mtpl_run(program, &allocs, gens, properties, &buffer);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("<bar][=>test2]>", text) == 0);
+        END_SECTION
+
+        SECTION("Missing property")
+            res = mtpl_run(program, &allocs, gens, properties, &buffer);
+            REQUIRE(res == MTPL_ERR_UNKNOWN_KEY);
+        END_SECTION
+
+        mtpl_program_free(&allocs, program);
+        mtpl_htable_free(&allocs, properties);
+    END_SECTION
+
+    SECTION("Compiling into an existing program")
+        mtpl_program* program;
+        res = mtpl_program_create(&allocs, &program);
+        REQUIRE(res == MTPL_SUCCESS);
+        res = mtpl_compile_into("[:>foo] bar", &allocs, gens, program);
+        REQUIRE(res == MTPL_SUCCESS);
+        res = mtpl_compile_into("baz", &allocs, gens, program);
+        REQUIRE(res == MTPL_SUCCESS);
+        res = mtpl_run(program, &allocs, gens, NULL, &buffer);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(strcmp("baz", text) == 0);
+        mtpl_program_free(&allocs, program);
+    END_SECTION
+
+    SECTION("Streaming to a sink")
+        mtpl_hashtable* properties;
+        mtpl_htable_create(&allocs, &properties);
+        char big[3001];
+        memset(big, 'x', 3000);
+        big[3000] = '\0';
+        mtpl_htable_insert("big", big, sizeof(big), &allocs, properties);
+        mtpl_program* program;
+        res = mtpl_compile("a[=>big]b[:>c]", &allocs, gens, &program);
+        REQUIRE(res == MTPL_SUCCESS);
+
+        collected_output collected = { .length = 0, .chunks = 0 };
+        const mtpl_sink sink = { collect, &collected };
+        mtpl_buffer* staging;
+        mtpl_buffer_create(&allocs, MTPL_DEFAULT_BUFSIZE, &staging);
+        res = mtpl_run_sink(program, &allocs, gens, properties, &sink, staging);
+        mtpl_buffer_free(&allocs, staging);
+        REQUIRE(res == MTPL_SUCCESS);
+        REQUIRE(collected.length == 3003);
+        REQUIRE(collected.chunks > 1);
+        REQUIRE(collected.data[0] == 'a');
+        REQUIRE(strcmp(&collected.data[3001], "bc") == 0);
+
+        mtpl_program_free(&allocs, program);
+        mtpl_htable_free(&allocs, properties);
+    END_SECTION
+
+    SECTION("Streaming from a reader")
+        const char* source = "a\\ b[:>x{y]}\\]z] \\[c{d[}e";
+        res = mtpl_substitute(source, &allocs, gens, NULL, &buffer);
+        REQUIRE(res == MTPL_SUCCESS);
+
+        bool identical = true;
+        for (size_t chunk_size = 1; chunk_size < 8; ++chunk_size) {
+            chunked_input input = { source, chunk_size };
+            const mtpl_reader reader = { read_chunk, &input };
+            collected_output collected = { .length = 0, .chunks = 0 };
+            const mtpl_sink sink = { collect, &collected };
+            mtpl_buffer* staging;
+            mtpl_buffer_create(&allocs, MTPL_DEFAULT_BUFSIZE, &staging);
+            res = mtpl_substitute_stream(
+                &reader,
+                &allocs,
+                gens,
+                NULL,
+                &sink,
+                staging
+            );
+            mtpl_buffer_free(&allocs, staging);
+            identical &= res == MTPL_SUCCESS;
+            identical &= strcmp(collected.data, text) == 0;
+        }
+        REQUIRE(identical);
+
+        SECTION("Unterminated substitution")
+            chunked_input input = { "foo [:>bar", 4 };
+            const mtpl_reader reader = { read_chunk, &input };
+            collected_output collected = { .length = 0, .chunks = 0 };
+            const mtpl_sink sink = { collect, &collected };
+            res = mtpl_substitute_stream(
+                &reader,
+                &allocs,
+                gens,
+                NULL,
+                &sink,
+                &buffer
+            );
+            REQUIRE(res == MTPL_ERR_SYNTAX);
+        END_SECTION
+    END_SECTION
+
+    SECTION("Compilation errors")
+        mtpl_program* program;
+        res = mtpl_compile("foo [bar>baz]", &allocs, gens, &program);
+        REQUIRE(res == MTPL_ERR_UNKNOWN_KEY);
+
+        res = mtpl_compile("foo [:>baz", &allocs, gens, &program);
+        REQUIRE(res == MTPL_ERR_SYNTAX);
+    END_SECTION
+
+    SECTION("List variants render like their generators")
+        mtpl_generator len = mtpl_generator_len;
+        mtpl_generator element = mtpl_generator_element;
+        mtpl_htable_insert("len", &len, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_htable_insert("()", &element, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_hashtable* properties;
+        mtpl_htable_create(&allocs, &properties);
+
+        static const char* lists[] = {
+            "a;b;c",
+            "a\\;b;c",
+            "a\\\\;b",
+            "a\\ b;c",
+            "a b;c",
+            " a;b",
+            "a; b ;c",
+            "a;;c",
+            "a;",
+            "",
+        };
+        // The first of each pair uses the list variant; wrapping the property
+        // reference in a copy substitution keeps the second from doing so.
+        static const char* sources[][2] = {
+            { "[len> [=> e]]", "[len> [:>[=> e]]]" },
+            { "[len> [=> e] x;y]", "[len> [:>[=> e]] x;y]" },
+            { "[()> [=> e] 0]", "[()> [:>[=> e]] 0]" },
+            { "[()> [=> e] 1]", "[()> [:>[=> e]] 1]" },
+            { "[()> [=> e] 2]", "[()> [:>[=> e]] 2]" },
+            { "[()> [=> e]  1 trailing]", "[()> [:>[=> e]]  1 trailing]" },
+            { "[()> [=> e]]", "[()> [:>[=> e]]]" },
+        };
+        for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+            const mtpl_slice value = { lists[i], strlen(lists[i]) };
+            mtpl_htable_insert_string("e", &value, &allocs, properties);
+            for (size_t j = 0; j < sizeof(sources) / sizeof(sources[0]); ++j) {
+                char indexed[64];
+                char generic[64];
+                const mtpl_result indexed_res = render_into(
+                    sources[j][0],
+                    gens,
+                    properties,
+                    indexed,
+                    sizeof(indexed)
+                );
+                const mtpl_result generic_res = render_into(
+                    sources[j][1],
+                    gens,
+                    properties,
+                    generic,
+                    sizeof(generic)
+                );
+                REQUIRE(
+                    indexed_res == generic_res
+                        && (
+                            indexed_res != MTPL_SUCCESS
+                            || strcmp(indexed, generic) == 0
+                        )
+                );
+            }
+        }
+
+        mtpl_htable_free(&allocs, properties);
+    END_SECTION
+
+    SECTION("Quoted templates are compiled once per program")
+        mtpl_generator gen_for = mtpl_generator_for;
+        mtpl_generator gen_if = mtpl_generator_if;
+        mtpl_generator gen_eq = mtpl_generator_equals;
+        mtpl_generator gen_let = mtpl_generator_let;
+        mtpl_htable_insert("for", &gen_for, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_htable_insert("if", &gen_if, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_htable_insert("eq", &gen_eq, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_htable_insert("let", &gen_let, sizeof(mtpl_generator), &allocs, gens);
+        mtpl_hashtable* properties;
+        mtpl_htable_create(&allocs, &properties);
+        // The body of the third loop is the output of a substitution, and so
+        // is compiled anew every time.
+        mtpl_program* program;
+        res = mtpl_compile(
+            "[for> a;b x {[for> 1;2 y {<[=> x][=> y]>}]}]"
+            "[let> t {{[=> x]}}][for> c;d x [=> t]]"
+            "[for> a;b x {[if> [eq> {[=> x]} b] {!} {?}]}]",
+            &allocs,
+            gens,
+            &program
+        );
+        REQUIRE(res == MTPL_SUCCESS);
+
+        struct mtpl_quoted* kept[64] = { NULL };
+        REQUIRE(program->num_instructions <= 64);
+        bool same = true;
+        size_t num_kept = 0;
+        for (size_t run = 0; run < 3; ++run) {
+            buffer.cursor = 0;
+            res = mtpl_run(program, &allocs, gens, properties, &buffer);
+            REQUIRE(res == MTPL_SUCCESS);
+            REQUIRE(strcmp("<a1><a2><b1><b2>cd?!", text) == 0);
+            for (size_t i = 0; i < program->num_instructions; ++i) {
+                struct mtpl_quoted* quoted = program->instructions[i].quoted;
+                if (run == 0) {
+                    kept[i] = quoted;
+                    num_kept += quoted != NULL;
+                } else {
+                    same = same && kept[i] == quoted;
+                }
+            }
+        }
+        REQUIRE(num_kept >= 3);
+        REQUIRE(same);
+
+        // Compiling anew drops the templates kept by the previous contents.
+        res = mtpl_compile_into("[for> a x {[=> x]}]", &allocs, gens, program);
+        REQUIRE(res == MTPL_SUCCESS);
+        bool dropped = true;
+        for (size_t i = 0; i < program->num_instructions; ++i) {
+            dropped = dropped && !program->instructions[i].quoted;
+        }
+        REQUIRE(dropped);
+
+        mtpl_program_free(&allocs, program);
+        mtpl_htable_free(&allocs, properties);
+    END_SECTION
+
+    SECTION("Deeply nested on a small stack")
+        deep_render render = { gens, &buffer, MTPL_ERR_IO };
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, SMALL_STACK);
+        pthread_t thread;
+        REQUIRE(
+            pthread_create(&thread, &attributes, render_deep, &render) == 0
+        );
+        pthread_join(thread, NULL);
+        pthread_attr_destroy(&attributes);
+        REQUIRE(render.result == MTPL_SUCCESS);
+        REQUIRE(strcmp("x", text) == 0);
+    END_SECTION
 END_FIXTURE
 
 int main(void) {
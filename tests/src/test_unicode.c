@@ -3,7 +3,12 @@
 #include <mintpl/generators.h>
 #include <mintpl/substitute.h>
 
-static const mtpl_allocators allocs = { malloc, realloc, free };
+static const mtpl_allocators allocs = {
+    mtpl_std_malloc,
+    mtpl_std_realloc,
+    mtpl_std_free,
+    NULL
+};
 
 FIXTURE(unicode, "Unicode preservation")
     mtpl_buffer utf8 = { "\x61\xe4\xb8\xad\xd0\xaf" };